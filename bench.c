@@ -0,0 +1,874 @@
+/* Microbenchmarks for the core primitives in chess.c.
+ *
+ * Each benchmark runs a batch of operations over a corpus of positions
+ * (every position of games/PGN/fischer_spas.txt plus the files in
+ * games/FEN), a few times to warm up and then [reps] times for real, and
+ * reports the median and 99th percentile of the per-batch ns per op.
+ *
+ * Usage: bench [-r reps] [-c corpus.fen] [-b baseline] [-t percent]
+ *              [-w new_baseline] [-p depth] [-s depth] [-n weights]
+ *              [-f fen_checks] [benchmark names...]
+ *   -b compares every median against the baseline file and exits with 1
+ *      if any is more than [percent] (default 10) slower.
+ *   -w writes the results as a new baseline file.
+ *   -p doesn't time anything: it walks [depth] plies from every corpus
+ *      position with both full move generation and the incremental 
+ *      MoveTracker mode, and exits with 1 if they ever disagree (or if
+ *      a pawn key kept up move by move is ever off).
+ *   -s doesn't run the benchmarks either: it searches up to 
+ *      SEARCH_POSITIONS corpus positions (spread out evenly) to [depth] 
+ *      with the ALPHA_BETA bot, once with each search feature on its 
+ *      own, with none and with all, and reports time-to-depth, nodes,
+ *      how often the move found is the same as with none, and how often
+ *      the pawn hash table had the pawns already.
+ *   -n doesn't run the benchmarks either: it loads the NNUE weight file
+ *      [weights] (or makes a random net if it's "random"), checks that
+ *      every kernel this CPU has gets exactly what the scalar one does,
+ *      and that accumulators moved forward with NNUE_update match ones
+ *      summed from scratch, walking NNUE_WALK_PLIES plies from every 
+ *      corpus position; then times refreshing, updating and evaluating
+ *      with each kernel. Exits with 1 if anything disagrees.
+ *   -f doesn't run the benchmarks either: it reads lines of a FENStatus
+ *      name and a FEN (as in games/fen_checks.txt), and exits with 1 if
+ *      Game_set_FEN doesn't return that status for any of them. */
+#define _POSIX_C_SOURCE 199309L
+#include "chess_bot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PGN_FILE "games/PGN/fischer_spas.txt"
+#define DEFAULT_REPS 200
+#define WARMUP_REPS 10
+#define DEFAULT_THRESHOLD 10.0
+#define MAX_CORPUS 4096
+#define MAX_BASELINES 64
+#define NAME_SIZE 32
+#define MAX_CHECK_DEPTH 8
+#define SEARCH_POSITIONS 32
+#define NNUE_WALK_PLIES 16
+#define NNUE_RANDOM_SEED 1
+#define FEN_CHECK_LINE 256
+
+/* Everything the benchmarks work on, built before timing starts. */
+typedef struct {
+	ChessGame *games[MAX_CORPUS];
+	char fens[MAX_CORPUS][FEN_MAX_LENGTH];
+	int length;
+
+	/* Scratch games for benchmarks that change the position */
+	ChessGame *scratch[MAX_CORPUS];
+
+	/* Random squares for Position_is_attacked */
+	int squares[MAX_CORPUS];
+} BenchData;
+
+typedef struct {
+	const char *name;
+	/* Runs one batch, returns how many ops it did */
+	long (*run)(BenchData *d);
+} Benchmark;
+
+typedef struct {
+	char name[NAME_SIZE];
+	double median;
+	double p99;
+} BenchResult;
+
+/* Stops the compiler from throwing away results. */
+volatile long sink;
+
+double now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+
+/* BENCHMARKS */
+
+long run_is_attacked(BenchData *d)
+{
+	long attacked = 0;
+	int rep, i;
+	for (rep = 0; rep < 16; rep++)
+		for (i = 0; i < d->length; i++){
+			const int sq = (d->squares[i] + rep) % 64;
+			attacked += Position_is_attacked(&d->games[i]->current_pos, 
+											 sq % 8, sq / 8);
+		}
+	sink = attacked;
+	return 16 * d->length;
+}
+
+long run_find_all_legal_moves(BenchData *d)
+{
+	int i;
+	for (i = 0; i < d->length; i++)
+		Game_find_all_legal_moves(d->games[i]);
+	return d->length;
+}
+
+long run_count_legal_moves(BenchData *d)
+{
+	long moves = 0;
+	int i;
+	for (i = 0; i < d->length; i++)
+		moves += Game_count_legal_moves(d->games[i]);
+	sink = moves;
+	return d->length;
+}
+
+long run_has_legal_move(BenchData *d)
+{
+	long found = 0;
+	int i;
+	for (i = 0; i < d->length; i++)
+		found += Game_has_legal_move(d->games[i]);
+	sink = found;
+	return d->length;
+}
+
+long run_alter_position(BenchData *d)
+{
+	int i;
+	for (i = 0; i < d->length; i++)
+		if (d->scratch[i]->num_possible_moves > 0)
+			Game_alter_position(d->scratch[i], 
+								d->scratch[i]->current_possible_moves[0]);
+	/* run_benchmark copies the scratch games back between batches */
+	return d->length;
+}
+
+long run_game_copy(BenchData *d)
+{
+	int i;
+	for (i = 0; i < d->length; i++)
+		Game_copy(d->games[i], d->scratch[i]);
+	return d->length;
+}
+
+long run_position_copy(BenchData *d)
+{
+	int i;
+	for (i = 0; i < d->length; i++)
+		d->scratch[i]->current_pos = d->games[i]->current_pos;
+	return d->length;
+}
+
+long run_pieceat(BenchData *d)
+{
+	long pieces = 0;
+	int i, sq;
+	for (i = 0; i < d->length; i++)
+		for (sq = 0; sq < 64; sq++)
+			pieces += Game_pieceat(d->games[i], sq / 8, sq % 8);
+	sink = pieces;
+	return 64 * d->length;
+}
+
+long run_set_shorttitle(BenchData *d)
+{
+	long ops = 0;
+	int i, j;
+	for (i = 0; i < d->length; i++)
+		for (j = 0; j < d->games[i]->num_possible_moves; j += 4){
+			Move_set_shorttitle(&d->games[i]->current_possible_moves[j],
+								d->games[i]);
+			ops++;
+		}
+	return ops;
+}
+
+long run_set_FEN(BenchData *d)
+{
+	int i;
+	for (i = 0; i < d->length; i++)
+		Game_set_FEN(d->scratch[i], d->fens[i]);
+	return d->length;
+}
+
+long run_get_FEN(BenchData *d)
+{
+	char fen[FEN_MAX_LENGTH];
+	int i;
+	for (i = 0; i < d->length; i++)
+		Game_get_FEN(d->games[i], fen);
+	sink = fen[0];
+	return d->length;
+}
+
+long run_pgn_replay(BenchData *d)
+{
+	Movie *movie = Movie_create_from_PGN(PGN_FILE, NULL);
+	sink = movie->length;
+	Movie_destroy(movie);
+	return 1;
+}
+
+/* Counts leaf nodes [depth] plies below [g]. */
+long perft(ChessGame *g, int depth, ChessGame **stack)
+{
+	long nodes = 0;
+	int i;
+	if (depth == 1)
+		return g->num_possible_moves;
+	for (i = 0; i < g->num_possible_moves; i++){
+		Game_copy(g, stack[depth - 1]);
+		Game_advanceturn_index(stack[depth - 1], i);
+		nodes += perft(stack[depth - 1], depth - 1, stack);
+	}
+	return nodes;
+}
+
+long run_perft(BenchData *d)
+{
+	static ChessGame *stack[4];
+	int i;
+	if (stack[0] == NULL)
+		for (i = 0; i < 4; i++)
+			stack[i] = Game_create();
+
+	/* Start position, depth 3 */
+	Game_copy(d->games[0], stack[3]);
+	return perft(stack[3], 3, stack);
+}
+
+Benchmark benchmarks[] = {
+	{ "is_attacked",          run_is_attacked },
+	{ "find_all_legal_moves", run_find_all_legal_moves },
+	{ "count_legal_moves",    run_count_legal_moves },
+	{ "has_legal_move",       run_has_legal_move },
+	{ "alter_position",       run_alter_position },
+	{ "game_copy",            run_game_copy },
+	{ "position_copy",        run_position_copy },
+	{ "pieceat",              run_pieceat },
+	{ "set_shorttitle",       run_set_shorttitle },
+	{ "set_FEN",              run_set_FEN },
+	{ "get_FEN",              run_get_FEN },
+	{ "pgn_replay",           run_pgn_replay },
+	{ "perft3",               run_perft },
+};
+#define NUM_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+
+
+/* SETUP */
+
+/* Adds a copy of [g] to the corpus. */
+void corpus_add(BenchData *d, ChessGame *g)
+{
+	if (d->length >= MAX_CORPUS)
+		return;
+	d->games[d->length] = Game_create();
+	Game_copy(g, d->games[d->length]);
+	Game_get_FEN(g, d->fens[d->length]);
+	d->scratch[d->length] = Game_create();
+	d->squares[d->length] = rand() % 64;
+	d->length++;
+}
+
+/* Adds every readable position in FEN file [filename]. */
+void corpus_add_fens(BenchData *d, char *filename)
+{
+	ChessGame *g = Game_create();
+	FENReader *reader = FENReader_open(filename);
+	FENStatus status;
+	if (reader == NULL){
+		fprintf(stderr, "Can't open %s\n", filename);
+		exit(2);
+	}
+	while ((status = FENReader_next(reader, g)) != FEN_EOF)
+		if (status == FEN_OK)
+			corpus_add(d, g);
+	FENReader_close(reader);
+	Game_destroy(g);
+}
+
+void corpus_build(BenchData *d, char *corpus_file)
+{
+	Movie *movie;
+	int i;
+
+	d->length = 0;
+	/* Fixed seed so every run benchmarks the same squares */
+	srand(12345);
+
+	/* Start position first, perft uses it */
+	movie = Movie_create_from_PGN(PGN_FILE, NULL);
+	if (movie == NULL){
+		fprintf(stderr, "Can't read %s\n", PGN_FILE);
+		exit(2);
+	}
+	for (i = 0; i < movie->length; i++)
+		corpus_add(d, movie->games[i]);
+	Movie_destroy(movie);
+
+	corpus_add_fens(d, "games/FEN/ep_checkmate_test");
+	corpus_add_fens(d, "games/FEN/test_position");
+	if (corpus_file != NULL)
+		corpus_add_fens(d, corpus_file);
+}
+
+
+
+/* TIMING */
+
+int compare_doubles(const void *a, const void *b)
+{
+	const double x = *(const double *)a;
+	const double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+void run_benchmark(BenchData *d, Benchmark *b, int reps, BenchResult *result)
+{
+	double *samples = (double *)malloc(reps * sizeof(double));
+	int i, j;
+
+	for (i = -WARMUP_REPS; i < reps; i++){
+		double start, end;
+		long ops;
+
+		/* Reset scratch games so alter_position changes the same
+		 * positions each time */
+		if (b->run == run_alter_position)
+			for (j = 0; j < d->length; j++)
+				Game_copy(d->games[j], d->scratch[j]);
+
+		start = now_ns();
+		ops = b->run(d);
+		end = now_ns();
+
+		if (i >= 0)
+			samples[i] = (end - start) / (ops > 0 ? ops : 1);
+	}
+
+	qsort(samples, reps, sizeof(double), compare_doubles);
+	strncpy(result->name, b->name, NAME_SIZE - 1);
+	result->name[NAME_SIZE - 1] = '\0';
+	result->median = samples[reps / 2];
+	result->p99 = samples[(reps * 99) / 100];
+	free(samples);
+}
+
+
+
+/* BASELINES */
+
+/* Reads baseline file lines of "name median p99". Returns how many. */
+int read_baseline(char *filename, BenchResult *baselines)
+{
+	FILE *fp = fopen(filename, "r");
+	char line[128];
+	int n = 0;
+	if (fp == NULL){
+		fprintf(stderr, "Can't open baseline %s\n", filename);
+		exit(2);
+	}
+	while (n < MAX_BASELINES && fgets(line, sizeof(line), fp) != NULL){
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%31s %lf %lf", baselines[n].name, 
+				   &baselines[n].median, &baselines[n].p99) == 3)
+			n++;
+	}
+	fclose(fp);
+	return n;
+}
+
+void write_baseline(char *filename, BenchResult *results, int n)
+{
+	FILE *fp = fopen(filename, "w");
+	int i;
+	if (fp == NULL){
+		fprintf(stderr, "Can't write baseline %s\n", filename);
+		exit(2);
+	}
+	fprintf(fp, "# name median_ns p99_ns\n");
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s %.2f %.2f\n", 
+				results[i].name, results[i].median, results[i].p99);
+	fclose(fp);
+}
+
+BenchResult *find_baseline(BenchResult *baselines, int n, const char *name)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		if (strcmp(baselines[i].name, name) == 0)
+			return &baselines[i];
+	return NULL;
+}
+
+
+
+/* PERFT CHECK */
+
+/* Returns 1 if [a] and [b] have the same legal moves in the same order. */
+int same_moves(ChessGame *a, ChessGame *b)
+{
+	int i;
+	if (a->num_possible_moves != b->num_possible_moves)
+		return 0;
+	for (i = 0; i < a->num_possible_moves; i++){
+		Move *x = &a->current_possible_moves[i];
+		Move *y = &b->current_possible_moves[i];
+		if (x->src != y->src || x->dest != y->dest || 
+			x->promoting_to != y->promoting_to || 
+			x->is_en_passant != y->is_en_passant)
+			return 0;
+	}
+	return 1;
+}
+
+/* Walks [depth] plies below full[depth] (regenerated every move) and
+ * tracked[depth] (moved forward with trackers[depth]), counting the 
+ * nodes where the two disagree, or where the tracker or the pawn key
+ * doesn't match one built from scratch. */
+long perft_check(ChessGame **full, ChessGame **tracked, MoveTracker *trackers,
+				 int depth, long *nodes)
+{
+	MoveTracker fresh;
+	Position fresh_pos;
+	long bad = 0;
+	int i;
+
+	(*nodes)++;
+	MoveTracker_init(&fresh, &tracked[depth]->current_pos);
+	fresh_pos = full[depth]->current_pos;
+	Position_refresh_sets(&fresh_pos);
+	if (!same_moves(full[depth], tracked[depth]) ||
+		memcmp(&fresh, &trackers[depth], sizeof(MoveTracker)) != 0 ||
+		fresh_pos.pawn_key != full[depth]->current_pos.pawn_key){
+		char fen[FEN_MAX_LENGTH];
+		Game_get_FEN(full[depth], fen);
+		printf("mismatch: %s\n", fen);
+		return 1;
+	}
+	if (depth == 0)
+		return 0;
+
+	for (i = 0; i < full[depth]->num_possible_moves; i++){
+		const Move m = full[depth]->current_possible_moves[i];
+		Game_copy(full[depth], full[depth - 1]);
+		Game_advanceturn(full[depth - 1], m);
+		Game_copy(tracked[depth], tracked[depth - 1]);
+		trackers[depth - 1] = trackers[depth];
+		Game_advanceturn_tracked(tracked[depth - 1], &trackers[depth - 1], m);
+		bad += perft_check(full, tracked, trackers, depth - 1, nodes);
+	}
+	return bad;
+}
+
+int run_perft_check(BenchData *d, int depth)
+{
+	static MoveTracker trackers[MAX_CHECK_DEPTH + 1];
+	ChessGame *full[MAX_CHECK_DEPTH + 1];
+	ChessGame *tracked[MAX_CHECK_DEPTH + 1];
+	long nodes = 0;
+	long bad = 0;
+	int i;
+
+	if (depth < 0 || depth > MAX_CHECK_DEPTH){
+		fprintf(stderr, "perft check depth has to be 0-%d\n", MAX_CHECK_DEPTH);
+		return 2;
+	}
+	for (i = 0; i <= depth; i++){
+		full[i] = Game_create();
+		tracked[i] = Game_create();
+	}
+
+	for (i = 0; i < d->length; i++){
+		Game_copy(d->games[i], full[depth]);
+		Game_copy(d->games[i], tracked[depth]);
+		MoveTracker_init(&trackers[depth], &tracked[depth]->current_pos);
+		bad += perft_check(full, tracked, trackers, depth, &nodes);
+	}
+
+	for (i = 0; i <= depth; i++){
+		Game_destroy(full[i]);
+		Game_destroy(tracked[i]);
+	}
+	printf("%ld nodes checked, %ld mismatched\n", nodes, bad);
+	return bad > 0;
+}
+
+
+
+/* SEARCH TIME-TO-DEPTH */
+
+int run_search_depth(BenchData *d, int depth)
+{
+	/* Each feature alone, then none and all */
+	const char *configs[] = { "none", "pvs", "aspiration", "null", "lmr", 
+							  "futility", "all" };
+	const int num_configs = sizeof(configs) / sizeof(configs[0]);
+	int plain_moves[SEARCH_POSITIONS];
+	double plain_ms = 0;
+	int positions[SEARCH_POSITIONS];
+	int num_positions = 0;
+	int c, i;
+
+	if (depth < 1 || depth > SEARCH_DEFAULT_DEPTH){
+		fprintf(stderr, "search depth has to be 1-%d\n", SEARCH_DEFAULT_DEPTH);
+		return 2;
+	}
+	for (i = 0; i < SEARCH_POSITIONS; i++){
+		const int index = (int)((long)i * d->length / SEARCH_POSITIONS);
+		if ((num_positions == 0 || index != positions[num_positions - 1]) &&
+			d->games[index]->num_possible_moves > 0)
+			positions[num_positions++] = index;
+	}
+
+	printf("%d positions, depth %d\n", num_positions, depth);
+	printf("%-12s %12s %12s %8s %9s %9s\n", "features", "ms/position",
+		   "nodes", "vs none", "same move", "pawn hits");
+
+	for (c = 0; c < num_configs; c++){
+		double total_ms = 0;
+		long total_nodes = 0;
+		long pawn_probes = 0, pawn_hits = 0;
+		int same = 0;
+
+		for (i = 0; i < num_positions; i++){
+			ChessGame *g = d->games[positions[i]];
+			ChessBot *bot = ChessBot_create(g, ALPHA_BETA, 
+											g->current_pos.to_move, 0);
+			double start;
+			int move;
+
+			ChessBot_set_search(bot, ChessBot_search_features(configs[c]),
+								depth, 0);
+			start = now_ns();
+			move = ChessBot_search(bot);
+			total_ms += (now_ns() - start) / 1e6;
+			total_nodes += bot->last_search.nodes;
+			pawn_probes += bot->last_search.pawn_probes;
+			pawn_hits += bot->last_search.pawn_hits;
+
+			if (c == 0)
+				plain_moves[i] = move;
+			same += move == plain_moves[i];
+			ChessBot_destroy(bot);
+		}
+		if (c == 0)
+			plain_ms = total_ms;
+
+		printf("%-12s %12.2f %12ld %+7.1f%% %6d/%d %8.1f%%\n", configs[c], 
+			   total_ms / num_positions, total_nodes / num_positions,
+			   100.0 * (total_ms - plain_ms) / plain_ms, same, num_positions,
+			   100.0 * pawn_hits / (pawn_probes > 0 ? pawn_probes : 1));
+	}
+	return 0;
+}
+
+
+
+/* FEN CHECK */
+
+/* FENStatus names, in order */
+const char *fen_status_names[] = { "FEN_OK", "FEN_BAD_BOARD", 
+	"FEN_BAD_TO_MOVE", "FEN_BAD_CASTLING", "FEN_BAD_EN_PASSANT", 
+	"FEN_BAD_CLOCKS", "FEN_NO_FILE", "FEN_EOF" };
+
+int run_fen_check(const char *filename)
+{
+	char line[FEN_CHECK_LINE];
+	ChessGame *g;
+	long checked = 0, bad = 0;
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL){
+		fprintf(stderr, "Can't open %s\n", filename);
+		return 2;
+	}
+
+	g = Game_create();
+	while (fgets(line, FEN_CHECK_LINE, fp) != NULL){
+		char *fen = strchr(line, ' ');
+		FENStatus status;
+		int expected;
+		if (line[0] == '#' || fen == NULL)
+			continue;
+		*fen++ = '\0';
+		fen[strcspn(fen, "\r\n")] = '\0';
+		for (expected = FEN_OK; expected <= FEN_EOF; expected++)
+			if (strcmp(line, fen_status_names[expected]) == 0)
+				break;
+
+		status = Game_set_FEN(g, fen);
+		checked++;
+		if ((int)status != expected){
+			printf("%s: got %s, expected %s\n", fen, 
+				   fen_status_names[status], line);
+			bad++;
+		}
+	}
+	fclose(fp);
+	Game_destroy(g);
+	printf("%ld FENs checked, %ld wrong\n", checked, bad);
+	return bad > 0;
+}
+
+
+
+/* NNUE */
+
+/* Helper function. Walks NNUE_WALK_PLIES plies from the corpus position
+ * [g] (taking the moves in turn by [index]), with one accumulator per
+ * kernel moved forward by NNUE_update. Counts the positions where any of
+ * them differs from one summed from scratch with the scalar kernel, or
+ * any kernel's eval from the scalar one's. */
+long nnue_walk(NNUE *net, const ChessGame *start, int index, 
+			   int num_kernels, long *checked)
+{
+	static ChessGame g;
+	NNUEAccumulator accs[3];
+	NNUEAccumulator fresh;
+	PositionUndo undo;
+	long bad = 0;
+	int ply, k;
+
+	Game_copy(start, &g);
+	Game_ensure_moves(&g);
+	for (k = 0; k < num_kernels; k++){
+		net->kernel = k;
+		NNUE_refresh(net, &g.current_pos, &accs[k]);
+	}
+
+	for (ply = 0; ; ply++){
+		int evals[3];
+		int wrong = 0;
+
+		net->kernel = NNUE_SCALAR;
+		NNUE_refresh(net, &g.current_pos, &fresh);
+		for (k = 0; k < num_kernels; k++){
+			net->kernel = k;
+			evals[k] = NNUE_evaluate(net, &accs[k], g.current_pos.to_move);
+			if (memcmp(&accs[k], &fresh, sizeof(fresh)) != 0 || 
+				evals[k] != evals[0] || 
+				NNUE_eval(net, &g.current_pos) != evals[0])
+				wrong = 1;
+		}
+		(*checked)++;
+		if (wrong){
+			char fen[FEN_MAX_LENGTH];
+			Game_get_FEN(&g, fen);
+			printf("mismatch: %s\n", fen);
+			bad++;
+		}
+
+		if (ply == NNUE_WALK_PLIES || g.num_possible_moves == 0)
+			return bad;
+		Position_make_move(&g.current_pos, 
+			g.current_possible_moves[(index + ply) % g.num_possible_moves],
+			&undo);
+		Game_find_all_legal_moves(&g);
+		for (k = 0; k < num_kernels; k++){
+			net->kernel = k;
+			NNUE_update(net, &accs[k], &g.current_pos, &undo, &accs[k]);
+		}
+	}
+}
+
+int run_nnue(BenchData *d, const char *weights, int reps)
+{
+	static NNUEAccumulator accs[MAX_CORPUS];
+	static Position children[MAX_CORPUS];
+	static PositionUndo undos[MAX_CORPUS];
+	NNUEAccumulator child;
+	const int num_kernels = NNUE_best_kernel() + 1;
+	NNUE *net;
+	NNUEStatus status;
+	long checked = 0;
+	long bad = 0;
+	long evals = 0;
+	double start, pst_ns;
+	int rep, i, k;
+
+	if (strcmp(weights, "random") == 0)
+		net = NNUE_create_random(NNUE_RANDOM_SEED);
+	else if ((net = NNUE_load(weights, &status)) == NULL){
+		fprintf(stderr, "couldn't load %s (%d)\n", weights, (int)status);
+		return 2;
+	}
+
+	for (i = 0; i < d->length; i++)
+		bad += nnue_walk(net, d->games[i], i, num_kernels, &checked);
+	printf("%ld positions checked, %d kernels, %ld mismatched\n", checked,
+		   num_kernels, bad);
+
+	/* Each position's first move, to time updates with */
+	for (i = 0; i < d->length; i++){
+		children[i] = d->games[i]->current_pos;
+		if (d->games[i]->num_possible_moves > 0)
+			Position_make_move(&children[i], 
+							   d->games[i]->current_possible_moves[0], 
+							   &undos[i]);
+		else
+			undos[i].num_changes = 0;
+	}
+
+	start = now_ns();
+	for (rep = 0; rep < reps; rep++)
+		for (i = 0; i < d->length; i++)
+			evals += pst_eval(&d->games[i]->current_pos);
+	sink = evals;
+	pst_ns = (now_ns() - start) / ((double)reps * d->length);
+
+	printf("%-10s %12s %12s %12s %14s\n", "kernel", "refresh ns", 
+		   "update ns", "evaluate ns", "update+eval/s");
+	for (k = 0; k < num_kernels; k++){
+		double refresh_ns, update_ns, evaluate_ns;
+		net->kernel = k;
+
+		start = now_ns();
+		for (rep = 0; rep < reps; rep++)
+			for (i = 0; i < d->length; i++)
+				NNUE_refresh(net, &d->games[i]->current_pos, &accs[i]);
+		refresh_ns = (now_ns() - start) / ((double)reps * d->length);
+
+		start = now_ns();
+		for (rep = 0; rep < reps; rep++)
+			for (i = 0; i < d->length; i++)
+				evals += NNUE_evaluate(net, &accs[i], 
+									   d->games[i]->current_pos.to_move);
+		evaluate_ns = (now_ns() - start) / ((double)reps * d->length);
+		sink = evals;
+
+		start = now_ns();
+		for (rep = 0; rep < reps; rep++)
+			for (i = 0; i < d->length; i++)
+				if (undos[i].num_changes > 0)
+					NNUE_update(net, &accs[i], &children[i], &undos[i], 
+								&child);
+		update_ns = (now_ns() - start) / ((double)reps * d->length);
+
+		printf("%-10s %12.1f %12.1f %12.1f %14.0f\n", 
+			   NNUE_kernel_name(k), refresh_ns, update_ns, evaluate_ns,
+			   1e9 / (update_ns + evaluate_ns));
+	}
+	printf("%-10s %12s %12s %12.1f %14.0f\n", "pst_eval", "", "", pst_ns,
+		   1e9 / pst_ns);
+
+	NNUE_destroy(net);
+	return bad > 0;
+}
+
+
+
+int main(int argc, char **argv)
+{
+	static BenchData data;
+	BenchResult results[NUM_BENCHMARKS];
+	BenchResult baselines[MAX_BASELINES];
+	int num_baselines = 0;
+	int num_results = 0;
+	int regressions = 0;
+
+	int reps = DEFAULT_REPS;
+	double threshold = DEFAULT_THRESHOLD;
+	char *corpus_file = NULL;
+	char *baseline_file = NULL;
+	char *write_file = NULL;
+	char **names = NULL;
+	int num_names = 0;
+	int check_depth = -1;
+	int search_depth = -1;
+	char *nnue_weights = NULL;
+	char *fen_checks = NULL;
+	int i, j;
+
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			reps = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			corpus_file = argv[++i];
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			baseline_file = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			threshold = atof(argv[++i]);
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+			write_file = argv[++i];
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			check_depth = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			search_depth = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			nnue_weights = argv[++i];
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			fen_checks = argv[++i];
+		else if (argv[i][0] == '-'){
+			fprintf(stderr, "usage: %s [-r reps] [-c corpus.fen] [-b baseline]"
+					" [-t percent] [-w new_baseline] [-p depth] [-s depth]"
+					" [-n weights] [-f fen_checks] [names...]\n",
+					argv[0]);
+			return 2;
+		}
+		else {
+			names = &argv[i];
+			num_names = argc - i;
+			break;
+		}
+	}
+	if (reps < 1)
+		reps = 1;
+	if (fen_checks != NULL)
+		return run_fen_check(fen_checks);
+
+	corpus_build(&data, corpus_file);
+	if (check_depth >= 0)
+		return run_perft_check(&data, check_depth);
+	if (search_depth >= 0)
+		return run_search_depth(&data, search_depth);
+	if (nnue_weights != NULL)
+		return run_nnue(&data, nnue_weights, reps);
+	if (baseline_file != NULL)
+		num_baselines = read_baseline(baseline_file, baselines);
+
+	printf("%d positions, %d reps\n", data.length, reps);
+	printf("%-22s %12s %12s %12s %8s\n", 
+		   "benchmark", "median ns", "p99 ns", "baseline", "change");
+
+	for (i = 0; i < NUM_BENCHMARKS; i++){
+		BenchResult *result = &results[num_results];
+		BenchResult *baseline;
+
+		/* Only run the named ones, if any are named */
+		if (num_names > 0){
+			for (j = 0; j < num_names; j++)
+				if (strcmp(names[j], benchmarks[i].name) == 0)
+					break;
+			if (j == num_names)
+				continue;
+		}
+
+		run_benchmark(&data, &benchmarks[i], reps, result);
+		num_results++;
+
+		printf("%-22s %12.1f %12.1f", result->name, result->median, result->p99);
+		baseline = find_baseline(baselines, num_baselines, result->name);
+		if (baseline != NULL){
+			const double change = 
+				100.0 * (result->median - baseline->median) / baseline->median;
+			printf(" %12.1f %+7.1f%%", baseline->median, change);
+			if (change > threshold){
+				printf("  REGRESSION");
+				regressions++;
+			}
+		}
+		printf("\n");
+	}
+
+	if (write_file != NULL)
+		write_baseline(write_file, results, num_results);
+
+	if (regressions > 0){
+		printf("%d benchmark%s regressed more than %.1f%%\n", regressions,
+			   regressions == 1 ? "" : "s", threshold);
+		return 1;
+	}
+	return 0;
+}
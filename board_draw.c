@@ -0,0 +1,61 @@
+#include "board_draw.h"
+#include <SDL2/SDL_image.h>
+
+SDL_Texture *Board_load_pieces(SDL_Renderer *rend)
+{
+	SDL_Surface *sheet = IMG_Load(PIECES_PIC);
+	SDL_Texture *pieces;
+
+	if (sheet == NULL)
+		return NULL;
+	pieces = SDL_CreateTextureFromSurface(rend, sheet);
+	SDL_FreeSurface(sheet);
+	return pieces;
+}
+
+Uint32 Board_square_color(int sq)
+{
+	const int is_light = (sq % 2) == ((sq / 8) % 2);
+	return is_light ? LIGHT_SQ_COLOR : DARK_SQ_COLOR;
+}
+
+void Board_draw_piece(SDL_Renderer *rend, SDL_Texture *pieces, 
+					  ChessPiece piece, int x, int y, int side)
+{
+	SDL_Rect frame, dest;
+	if (piece == EMT)
+		return;
+
+	frame.x = (piece % PIECES_COLS) * PIECES_FRAME_SIDELEN;
+	frame.y = (piece / PIECES_COLS) * PIECES_FRAME_SIDELEN;
+	frame.w = frame.h = PIECES_FRAME_SIDELEN;
+	dest.x = x;
+	dest.y = y;
+	dest.w = dest.h = side;
+	SDL_RenderCopy(rend, pieces, &frame, &dest);
+}
+
+void Board_draw_square(SDL_Renderer *rend, SDL_Texture *pieces, 
+					   ChessPiece piece, Uint32 color, int x, int y, 
+					   int side)
+{
+	SDL_Rect square;
+	square.x = x;
+	square.y = y;
+	square.w = square.h = side;
+
+	SDL_SetRenderDrawColor(rend, (color >> 24) & 0xFF, (color >> 16) & 0xFF,
+						   (color >> 8) & 0xFF, color & 0xFF);
+	SDL_RenderFillRect(rend, &square);
+	Board_draw_piece(rend, pieces, piece, x, y, side);
+}
+
+void Board_draw_position(SDL_Renderer *rend, SDL_Texture *pieces, 
+						 const Position *p, int x, int y, int side)
+{
+	int sq;
+	for (sq = 0; sq < 64; sq++)
+		Board_draw_square(rend, pieces, p->piece_locations[sq], 
+						  Board_square_color(sq), x + ((sq % 8) * side),
+						  y + ((sq / 8) * side), side);
+}
@@ -0,0 +1,41 @@
+/* Drawing chess boards with SDL, shared by the viewer (display.c) and
+ * the headless image renderer (board_pics.c). Only plain SDL_Renderer
+ * calls, so it draws the same to a window or to an offscreen software
+ * renderer. Each renderer needs its own pieces texture (see 
+ * Board_load_pieces); different renderers can be drawn with from 
+ * different threads. */
+#include <SDL2/SDL.h>
+#include "chess.h"
+
+#define DARK_SQ_COLOR 0x592A0AFF
+#define LIGHT_SQ_COLOR 0xFFC6A1FF
+
+/* Sprite sheet of the pieces: a frame per ChessPiece, PIECES_COLS to a
+ * row, in ChessPiece order */
+#define PIECES_PIC "pics/pieces.png"
+#define PIECES_COLS 6
+#define PIECES_FRAME_SIDELEN 128
+
+/* Loads PIECES_PIC as a texture for [rend], or NULL (see SDL_GetError)
+ * if it can't. */
+SDL_Texture *Board_load_pieces(SDL_Renderer *rend);
+
+/* LIGHT_SQ_COLOR or DARK_SQ_COLOR, as square [sq] is (indexed like 
+ * piece_locations). Colors are 0xRRGGBBAA. */
+Uint32 Board_square_color(int sq);
+
+/* Draws [piece] from [pieces] as a [side] pixel square at [x], [y]. 
+ * Draws nothing for EMT. */
+void Board_draw_piece(SDL_Renderer *rend, SDL_Texture *pieces, 
+					  ChessPiece piece, int x, int y, int side);
+
+/* Draws a [side] pixel square at [x], [y] in [color], with [piece] (or
+ * EMT) on it. */
+void Board_draw_square(SDL_Renderer *rend, SDL_Texture *pieces, 
+					   ChessPiece piece, Uint32 color, int x, int y, 
+					   int side);
+
+/* Draws the board of [p], its top left corner at [x], [y] and each 
+ * square [side] pixels across. */
+void Board_draw_position(SDL_Renderer *rend, SDL_Texture *pieces, 
+						 const Position *p, int x, int y, int side);
@@ -0,0 +1,222 @@
+/* Headless board images: renders positions to PNG files with an 
+ * offscreen SDL software renderer (no window or GPU needed), drawing 
+ * with board_draw.c like the viewer does, on a pool of worker threads.
+ *
+ * Usage: boardpics [-j workers] [-s square_px] [-o out_dir] -f fens.txt
+ *        boardpics [-j workers] [-s square_px] [-o out_dir] -p game.pgn
+ *   -f writes an image per FEN line, out_dir/pos_00001.png onward (by
+ *      line number; lines that aren't FENs are skipped).
+ *   -p writes an image per ply of the game, out_dir/ply_000.png onward
+ *      (ply 0 being the start), as frames to animate it with.
+ * [out_dir] has to exist already. Prints how many images it wrote and
+ * how many per second. */
+#include "board_draw.h"
+#include <SDL2/SDL_image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 64
+#define DEFAULT_SQUARE 64
+#define PATH_SIZE 512
+/* Jobs there's room for at first */
+#define JOBS_START 256
+
+/* One image to write */
+typedef struct {
+	Position pos;
+	char path[PATH_SIZE];
+} RenderJob;
+
+/* All of the images, shared by the workers */
+typedef struct {
+	RenderJob *jobs;
+	int num_jobs;
+	int capacity;
+	int square;
+	/* Next job no worker has taken yet, and how many couldn't be 
+	 * written */
+	SDL_atomic_t next;
+	SDL_atomic_t failed;
+} RenderQueue;
+
+/* Adds a job for [pos], written to [path]. Returns 0 if there's no 
+ * memory for it. */
+int queue_add(RenderQueue *q, const Position *pos, const char *path)
+{
+	if (q->num_jobs == q->capacity){
+		const int capacity = q->capacity > 0 ? 2 * q->capacity : JOBS_START;
+		RenderJob *jobs = (RenderJob *) realloc(q->jobs, 
+												capacity * sizeof(RenderJob));
+		if (jobs == NULL)
+			return 0;
+		q->jobs = jobs;
+		q->capacity = capacity;
+	}
+	q->jobs[q->num_jobs].pos = *pos;
+	strncpy(q->jobs[q->num_jobs].path, path, PATH_SIZE - 1);
+	q->jobs[q->num_jobs].path[PATH_SIZE - 1] = '\0';
+	q->num_jobs++;
+	return 1;
+}
+
+/* Queues every position of FEN file [filename]. Returns 0 if it can't
+ * be read. */
+int queue_fens(RenderQueue *q, const char *filename, const char *out_dir)
+{
+	FENReader *reader = FENReader_open(filename);
+	ChessGame game;
+	char path[PATH_SIZE];
+	FENStatus status;
+
+	if (reader == NULL)
+		return 0;
+	Game_init(&game);
+	while ((status = FENReader_next(reader, &game)) != FEN_EOF){
+		if (status != FEN_OK){
+			fprintf(stderr, "%s:%ld: not a FEN, skipped\n", filename, 
+					FENReader_line_number(reader));
+			continue;
+		}
+		sprintf(path, "%.400s/pos_%05ld.png", out_dir, 
+				FENReader_line_number(reader));
+		if (!queue_add(q, &game.current_pos, path))
+			break;
+	}
+	FENReader_close(reader);
+	return 1;
+}
+
+/* Queues every ply of PGN file [filename]. Returns 0 if it can't be 
+ * read. */
+int queue_pgn(RenderQueue *q, const char *filename, const char *out_dir)
+{
+	PGNStatus status;
+	Movie *movie = Movie_create_from_PGN(filename, &status);
+	char path[PATH_SIZE];
+	int ply;
+
+	if (movie == NULL)
+		return 0;
+	for (ply = 0; ply < movie->length; ply++){
+		sprintf(path, "%.400s/ply_%03d.png", out_dir, ply);
+		if (!queue_add(q, &movie->games[ply]->current_pos, path))
+			break;
+	}
+	Movie_destroy(movie);
+	return 1;
+}
+
+/* Worker thread: takes jobs off the queue until there are none left, 
+ * drawing each into its own offscreen surface and saving that. */
+int render_worker(void *data)
+{
+	RenderQueue *q = (RenderQueue *)data;
+	const int side = 8 * q->square;
+	SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, side, side, 32,
+												SDL_PIXELFORMAT_RGBA32);
+	SDL_Renderer *rend = NULL;
+	SDL_Texture *pieces = NULL;
+	int i;
+
+	if (surface != NULL)
+		rend = SDL_CreateSoftwareRenderer(surface);
+	if (rend != NULL)
+		pieces = Board_load_pieces(rend);
+
+	if (pieces == NULL)
+		/* The other workers will take the jobs */
+		fprintf(stderr, "worker couldn't start: %s\n", SDL_GetError());
+	else
+		while ((i = SDL_AtomicAdd(&q->next, 1)) < q->num_jobs){
+			Board_draw_position(rend, pieces, &q->jobs[i].pos, 0, 0, 
+								q->square);
+			/* Draws everything still batched up */
+			SDL_RenderPresent(rend);
+			if (IMG_SavePNG(surface, q->jobs[i].path) != 0){
+				fprintf(stderr, "couldn't write %s: %s\n", q->jobs[i].path,
+						SDL_GetError());
+				SDL_AtomicAdd(&q->failed, 1);
+			}
+		}
+
+	if (pieces != NULL)
+		SDL_DestroyTexture(pieces);
+	if (rend != NULL)
+		SDL_DestroyRenderer(rend);
+	if (surface != NULL)
+		SDL_FreeSurface(surface);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	RenderQueue queue;
+	SDL_Thread *workers[MAX_WORKERS];
+	int num_workers = DEFAULT_WORKERS;
+	const char *out_dir = ".";
+	const char *fen_file = NULL;
+	const char *pgn_file = NULL;
+	unsigned long long start;
+	double seconds;
+	int written, i;
+
+	memset(&queue, 0, sizeof(queue));
+	queue.square = DEFAULT_SQUARE;
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			num_workers = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			queue.square = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			out_dir = argv[++i];
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			fen_file = argv[++i];
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			pgn_file = argv[++i];
+		else
+			break;
+	}
+	if (i < argc || (fen_file == NULL) == (pgn_file == NULL) || 
+		num_workers < 1 || num_workers > MAX_WORKERS || queue.square < 1){
+		fprintf(stderr, "usage: %s [-j workers] [-s square_px] [-o out_dir]"
+				" (-f fens.txt | -p game.pgn)\n", argv[0]);
+		return 2;
+	}
+
+	if (fen_file != NULL ? !queue_fens(&queue, fen_file, out_dir)
+						 : !queue_pgn(&queue, pgn_file, out_dir)){
+		fprintf(stderr, "couldn't read %s\n", 
+				fen_file != NULL ? fen_file : pgn_file);
+		return 1;
+	}
+
+	/* No video: the software renderer needs none. PNG support gets 
+	 * loaded here, once, before the workers all want it. */
+	if (SDL_Init(0) != 0 || (IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG) == 0){
+		fprintf(stderr, "couldn't start SDL: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	start = SDL_GetPerformanceCounter();
+	for (i = 0; i < num_workers; i++)
+		workers[i] = SDL_CreateThread(render_worker, "render", &queue);
+	for (i = 0; i < num_workers; i++)
+		if (workers[i] != NULL)
+			SDL_WaitThread(workers[i], NULL);
+	seconds = (double)(SDL_GetPerformanceCounter() - start) 
+			  / SDL_GetPerformanceFrequency();
+
+	/* Jobs nobody took (if no worker could start) weren't written */
+	written = queue.num_jobs - SDL_AtomicGet(&queue.failed);
+	if (SDL_AtomicGet(&queue.next) < queue.num_jobs)
+		written -= queue.num_jobs - SDL_AtomicGet(&queue.next);
+	printf("%d images in %.2f s, %.1f images/s, %d workers\n", written, 
+		   seconds, seconds > 0 ? written / seconds : 0.0, num_workers);
+
+	free(queue.jobs);
+	IMG_Quit();
+	SDL_Quit();
+	return written == queue.num_jobs ? 0 : 1;
+}
@@ -1,9 +1,18 @@
 #include "chess_bot.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define PLAYER_1_ALGO MIN_OPPT_MOVES
 #define PLAYER_2_ALGO MIN_OPPT_MOVES
 
+/* Tournaments: each game starts with this many random plies so that 
+ * they don't all play out the same, and is a draw if it gets this long */
+#define OPENING_PLIES 4
+#define TOURNAMENT_MAX_PLIES 400
+#define TOURNAMENT_DEFAULT_MS 100
+
 
 void bb_print_board(ChessGame *g)
 {
@@ -22,13 +31,174 @@ void bb_print_board(ChessGame *g)
 	}
 }
 
-/* Makes two ChessBots play against each other. */
+/* Plays one game between ALPHA_BETA bots searching with 
+ * [features][WHITE_MOVE] and [features][BLACK_MOVE], [ms] per move,
+ * evaluating with [net] (pst_eval if NULL), after OPENING_PLIES random
+ * moves picked from [seed]. Adds up the depth each color got to in
+ * [depths] and its moves in [moves]. */
+GameCondition tournament_game(const int features[2], long ms, 
+							  const NNUE *net, unsigned long long seed,
+							  long depths[2], long moves[2])
+{
+	ChessGame *game = Game_create();
+	ChessBot *opener = ChessBot_create(game, RANDOM_MOVE, WHITE_MOVE, seed);
+	ChessBot *bots[2];
+	GameCondition status = PLAYING;
+	int ply, color;
+
+	for (color = 0; color < 2; color++){
+		bots[color] = ChessBot_create(game, ALPHA_BETA, color, seed);
+		ChessBot_set_search(bots[color], features[color], 
+							SEARCH_DEFAULT_DEPTH, ms);
+		ChessBot_set_net(bots[color], net);
+	}
+
+	for (ply = 0; status == PLAYING && ply < TOURNAMENT_MAX_PLIES; ply++){
+		Move m;
+		color = game->current_pos.to_move;
+		if (ply < OPENING_PLIES)
+			m = ChessBot_find_next_move(opener);
+		else {
+			m = ChessBot_find_next_move(bots[color]);
+			depths[color] += bots[color]->last_search.depth;
+			moves[color]++;
+		}
+		status = Game_advanceturn(game, m);
+	}
+
+	for (color = 0; color < 2; color++)
+		ChessBot_destroy(bots[color]);
+	ChessBot_destroy(opener);
+	Game_destroy(game);
+	return status == PLAYING ? DRAW : status;
+}
+
+/* Plays [games] games between search feature sets [names_a] and 
+ * [names_b] (see ChessBot_search_features), swapping colors every game
+ * and playing each opening once with each color, to see which is 
+ * stronger at the same time per move. Both evaluate with [net], or
+ * pst_eval if it's NULL. */
+int tournament(int games, const char *names_a, const char *names_b, 
+			   long ms, const NNUE *net, unsigned long long seed)
+{
+	const char *names[2];
+	int features[2];
+	/* Per feature set: wins, draws, losses, depth reached, moves */
+	int results[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } };
+	long depths[2] = { 0, 0 };
+	long moves[2] = { 0, 0 };
+	int i, side;
+
+	names[0] = names_a;
+	names[1] = names_b;
+	for (side = 0; side < 2; side++){
+		features[side] = ChessBot_search_features(names[side]);
+		if (features[side] < 0){
+			fprintf(stderr, "unknown search features: %s\n", names[side]);
+			return 2;
+		}
+	}
+	printf("Seed: %llu\n", seed);
+	printf("%s vs %s, %d games, %ld ms per move\n", names_a, names_b, 
+		   games, ms);
+
+	for (i = 0; i < games; i++){
+		/* Side (0 for a, 1 for b) playing white this game */
+		const int white = i % 2;
+		int game_features[2];
+		long game_depths[2] = { 0, 0 };
+		long game_moves[2] = { 0, 0 };
+		GameCondition status;
+		int winner = -1;
+
+		game_features[WHITE_MOVE] = features[white];
+		game_features[BLACK_MOVE] = features[1 - white];
+		status = tournament_game(game_features, ms, net, seed + (i / 2), 
+								 game_depths, game_moves);
+
+		if (status == WHITE)
+			winner = white;
+		else if (status == BLACK)
+			winner = 1 - white;
+		for (side = 0; side < 2; side++){
+			const int color = side == white ? WHITE_MOVE : BLACK_MOVE;
+			results[side][winner < 0 ? 1 : (winner == side ? 0 : 2)]++;
+			depths[side] += game_depths[color];
+			moves[side] += game_moves[color];
+		}
+
+		printf("Game %d: %s (white) vs %s: %s\n", i + 1, names[white], 
+			   names[1 - white], 
+			   status == WHITE ? "1-0" : (status == BLACK ? "0-1" : "1/2"));
+	}
+
+	for (side = 0; side < 2; side++)
+		printf("%-24s +%d =%d -%d  score %.1f/%d  mean depth %.2f\n", 
+			   names[side], results[side][0], results[side][1], 
+			   results[side][2], results[side][0] + (0.5 * results[side][1]),
+			   games, moves[side] ? (double)depths[side] / moves[side] : 0.0);
+	return 0;
+}
+
+/* Makes two ChessBots play against each other. 
+ * Usage: botbattle [seed]
+ *        botbattle [-n weights] -t games features_a features_b
+ *                  [ms_per_move [seed]]
+ * Both bots are seeded with [seed] (the time, if not given), and it's 
+ * printed first so that any game can be played again exactly. With -t,
+ * plays a tournament between two sets of ALPHA_BETA search features
+ * instead (see tournament), evaluating with the NNUE weight file
+ * [weights] if given (as selfplay's -n does). */
 int main(int argc, char **argv)
 {
 	ChessGame *game = Game_create();
+	unsigned long long seed = (unsigned long long)time(NULL);
+	const char *weights = NULL;
+	/* Where the arguments after -n's start */
+	int a = 1;
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0){
+		weights = argv[2];
+		a = 3;
+	}
+	if (argc > a && strcmp(argv[a], "-t") == 0){
+		long ms = TOURNAMENT_DEFAULT_MS;
+		NNUE *net = NULL;
+		int result;
+
+		if (argc < a + 4 || atoi(argv[a + 1]) < 1 || 
+			(argc > a + 4 && sscanf(argv[a + 4], "%ld", &ms) != 1) ||
+			(argc > a + 5 && sscanf(argv[a + 5], "%llu", &seed) != 1)){
+			fprintf(stderr, "usage: %s [-n weights] -t games features_a"
+					" features_b [ms_per_move [seed]]\n", argv[0]);
+			return 2;
+		}
+		if (weights != NULL){
+			NNUEStatus status;
+			if ((net = NNUE_load(weights, &status)) == NULL){
+				fprintf(stderr, "couldn't load %s (%d)\n", weights,
+						(int)status);
+				return 1;
+			}
+		}
+		result = tournament(atoi(argv[a + 1]), argv[a + 2], argv[a + 3], ms,
+							net, seed);
+		if (net != NULL)
+			NNUE_destroy(net);
+		return result;
+	}
+	if (weights != NULL){
+		fprintf(stderr, "-n is for tournaments (-t) only\n");
+		return 2;
+	}
+	if (argc > 1 && sscanf(argv[1], "%llu", &seed) != 1){
+		fprintf(stderr, "usage: %s [seed]\n", argv[0]);
+		return 2;
+	}
+	printf("Seed: %llu\n", seed);
 
-	ChessBot *player_1 = ChessBot_create(game, PLAYER_1_ALGO, WHITE_MOVE);
-	ChessBot *player_2 = ChessBot_create(game, PLAYER_2_ALGO, BLACK_MOVE);
+	ChessBot *player_1 = ChessBot_create(game, PLAYER_1_ALGO, WHITE_MOVE, seed);
+	ChessBot *player_2 = ChessBot_create(game, PLAYER_2_ALGO, BLACK_MOVE, seed);
 
 	Move current_move;
 	GameCondition status = PLAYING;
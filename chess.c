@@ -1,11 +1,13 @@
 #include "chess.h"
+#include "chess_prof.h"
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 /* For debugging :) */
-void print_board(ChessGame *g)
+void print_board(const ChessGame *g)
 {
 	int r, c;
 	ChessPiece current_p;
@@ -31,7 +33,7 @@ int pgn_to_rowcol(char *pgn)
  *            MOVE			    *	
  * ******************************/
 
-int Move_is_capture(Move move, Position *pos)
+int Move_is_capture(Move move, const Position *pos)
 {
 	return move.is_en_passant || pos->piece_locations[move.dest] != EMT;
 }
@@ -49,9 +51,10 @@ int Move_castle_type(Move move)
 		return 0; /* Neither */
 }
 
-void Move_set_shorttitle(Move *move, ChessGame *game)
+void Move_set_shorttitle(Move *move, const ChessGame *game)
 {
-	Position *pos = game->current_pos;
+	PROF_BEGIN(PROF_SET_SHORTTITLE);
+	const Position *pos = &game->current_pos;
 
 	/* Assume valid piece */
 	ChessPiece piece_orig_color = pos->piece_locations[move->src];
@@ -66,6 +69,7 @@ void Move_set_shorttitle(Move *move, ChessGame *game)
 				move->title[1] = '-'; 
 				move->title[2] = 'O'; 
 				move->title[3] = '\0'; 
+				PROF_END(PROF_SET_SHORTTITLE);
 				return;
 			}
 			else if (Move_castle_type(*move) == 2){
@@ -76,6 +80,7 @@ void Move_set_shorttitle(Move *move, ChessGame *game)
 				move->title[3] = '-'; 
 				move->title[4] = 'O'; 
 				move->title[5] = '\0'; 
+				PROF_END(PROF_SET_SHORTTITLE);
 				return;
 			}
 
@@ -100,8 +105,7 @@ void Move_set_shorttitle(Move *move, ChessGame *game)
 			break;
 		case W_P:
 			break;
-		default:
-			printf("something is terribly wrong");
+		default: /* Not a piece, so no letter */
 			break;
 	}
 	int src_col = move->src % 8;
@@ -114,22 +118,29 @@ void Move_set_shorttitle(Move *move, ChessGame *game)
 		int ambiguous = 0;
 		int same_row  = 0;
 		int same_col  = 0;
-		int r, c;
-
-		for (r = 0; r < 8; r++)
-			for (c = 0; c < 8; c++)
-				if (Game_pieceat(game, r, c) == piece_orig_color
-					&& (r != src_row || c != src_col)){
-					Move temp = *move;
-					temp.src = c + (8 * r);
-					if (Game_get_legal(game, temp) > -1){
-						ambiguous = 1;
-						if (r == src_row)
-							same_row = 1;
-						if (c == src_col)
-							same_col = 1;
-					}
-				}
+		/* Only look at the other pieces of the same kind */
+		SquareSet others = pos->piece_sets[piece_orig_color] 
+							& ~SQUARE_BIT(move->src);
+
+		while (others){
+			const int other_src = SQUARESET_FIRST(others);
+			int legal = 0;
+			int i;
+			others &= others - 1;
+
+			/* Same as Game_get_legal, which can't take a const game */
+			for (i = 0; i < game->num_possible_moves; i++)
+				if (game->current_possible_moves[i].src == other_src &&
+					game->current_possible_moves[i].dest == move->dest)
+					legal = 1;
+			if (legal){
+				ambiguous = 1;
+				if (other_src / 8 == src_row)
+					same_row = 1;
+				if (other_src % 8 == src_col)
+					same_col = 1;
+			}
+		}
 
 		if (ambiguous){
 			if (!same_col)
@@ -174,25 +185,27 @@ void Move_set_shorttitle(Move *move, ChessGame *game)
 			case B_N:
 				move->title[on_letter] = 'N';
 				break;
-			default:
-				printf("LOL you can't promote to that\n");
+			default: /* LOL you can't promote to that */
+				move->title[on_letter] = '?';
 		}
 		on_letter++;
 	}
 
-	/* Append check and checkmate notation, if necessary. */
-	ChessGame *game_copy = Game_create();
-	Game_copy(game, game_copy);
-	Game_advanceturn(game_copy, *move);
-	if (Position_in_check(game_copy->current_pos)){
-		if (game_copy->num_possible_moves == 0) /* Checkmate */
+	/* Append check and checkmate notation, if necessary. Only the 
+	 * position is needed, and only whether there's any reply. */
+	ChessGame game_copy;
+	game_copy.current_pos = game->current_pos;
+	game_copy.moves_pending = 1;
+	Game_alter_position(&game_copy, *move);
+	if (Position_in_check(&game_copy.current_pos)){
+		if (!Game_has_legal_move(&game_copy)) /* Checkmate */
 			move->title[on_letter++] = '#';
 		else /* Just check */
 			move->title[on_letter++] = '+';
 	}
-	Game_destroy(game_copy);
 
 	move->title[on_letter] = '\0';
+	PROF_END(PROF_SET_SHORTTITLE);
 }
 
 
@@ -203,6 +216,12 @@ void Move_set_shorttitle(Move *move, ChessGame *game)
 Position *Position_create()
 {
 	Position *local_p = (Position*)malloc(sizeof(Position));
+	Position_init(local_p);
+	return local_p;
+}
+
+void Position_init(Position *local_p)
+{
 	local_p->to_move = WHITE_MOVE;
 	local_p->castling_rights[0] = BOTH;
 	local_p->castling_rights[1] = BOTH;
@@ -275,7 +294,7 @@ Position *Position_create()
 	local_p->white_kingsrc = 4 + (7 * 8);
 	local_p->black_kingsrc = 4 + (0 * 8);
 
-	return local_p;
+	Position_refresh_sets(local_p);
 }
 
 void Position_destroy(Position *p)
@@ -283,123 +302,308 @@ void Position_destroy(Position *p)
 	free(p);
 }
 
-ChessPiece Position_pieceat(Position *p, int row, int col)
+/* Random keys for a pawn of each color on each square, XORed together
+ * into Position.pawn_key. Filled in by init_tables (see below). */
+unsigned long long pawn_zobrist[2][64];
+
+/* Helper function. Puts [piece] on [sq] in the mailbox and square sets
+ * only, leaving the attack maps alone. Used for the quick temporary
+ * moves of in_check_after_move, which puts everything back after. */
+void put_piece_sets(Position *p, int sq, ChessPiece piece)
+{
+	const ChessPiece old_piece = p->piece_locations[sq];
+	if (old_piece != EMT){
+		p->piece_sets[old_piece] &= ~SQUARE_BIT(sq);
+		p->color_sets[old_piece / 6] &= ~SQUARE_BIT(sq);
+		if (old_piece % 6 == W_P)
+			p->pawn_key ^= pawn_zobrist[old_piece / 6][sq];
+	}
+
+	p->piece_locations[sq] = piece;
+	if (piece != EMT){
+		p->piece_sets[piece] |= SQUARE_BIT(sq);
+		p->color_sets[piece / 6] |= SQUARE_BIT(sq);
+		if (piece % 6 == W_P)
+			p->pawn_key ^= pawn_zobrist[piece / 6][sq];
+	}
+}
+
+/* Directions as (col, row) steps. The first four are orthogonal, the
+ * last four diagonal, and dir_opposite gives the reverse of each. */
+const int dir_cols[8] = { 1, -1, 0,  0, 1,  1, -1, -1 };
+const int dir_rows[8] = { 0,  0, 1, -1, 1, -1,  1, -1 };
+const int dir_opposite[8] = { 1, 0, 3, 2, 7, 6, 5, 4 };
+
+const int knight_cols[8] = { 2,  2, -2, -2, 1,  1, -1, -1 };
+const int knight_rows[8] = { 1, -1,  1, -1, 2, -2,  2, -2 };
+
+/* Lookup tables, filled in once by init_tables: every square in 
+ * direction [dir] from a square (to the edge of the board), and the
+ * squares attacked from a square by a knight, a king and a pawn of each
+ * color (and pawn_zobrist). Read-only after that, so any thread can
+ * use them. */
+SquareSet ray_masks[8][64];
+SquareSet knight_attacks[64];
+SquareSet king_attacks[64];
+SquareSet pawn_attacks[2][64];
+pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+/* Seed for pawn_zobrist's keys, the same every run */
+#define ZOBRIST_SEED 0x9E3779B97F4A7C15ULL
+
+/* Helper function. Next number from a SplitMix64 generator at [state]. */
+unsigned long long splitmix64(unsigned long long *state)
 {
-	if (row > 7 || row < 0 || col < 0 || col > 7)
-		return -1;
-	return p->piece_locations[col + (8*row)];
+	unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
 }
 
+void fill_tables()
+{
+	unsigned long long zobrist_state = ZOBRIST_SEED;
+	int sq, i;
+
+	for (sq = 0; sq < 64; sq++){
+		const int col = sq % 8;
+		const int row = sq / 8;
+
+		for (i = 0; i < 8; i++){
+			int c = col + dir_cols[i];
+			int r = row + dir_rows[i];
+			ray_masks[i][sq] = 0;
+			while (c >= 0 && c < 8 && r >= 0 && r < 8){
+				ray_masks[i][sq] |= SQUARE_BIT(c + (8 * r));
+				c += dir_cols[i];
+				r += dir_rows[i];
+			}
+		}
 
-/* Increments out in direction determined by [xinc] and [yinc] for
- * [piece_to_find]. Returns true (1) if piece is found, else false (0). */
-int find_piece_in_direction(int xinc, int yinc, int xorigin, int yorigin, 
-							 ChessPiece piece_to_find, Position *p){
-	ChessPiece sq_piece;
-	int curr_x = xorigin + xinc;
-	int curr_y = yorigin + yinc;
-	while(curr_x >= 0 && curr_x < 8 && curr_y >= 0 && curr_y < 8){
-		sq_piece = Position_pieceat(p, curr_y, curr_x);
-		if (sq_piece != EMT) /* A piece of some sort! Let's see if it's it */
-			return (sq_piece == piece_to_find);
+		knight_attacks[sq] = 0;
+		king_attacks[sq] = 0;
+		for (i = 0; i < 8; i++){
+			int c = col + knight_cols[i];
+			int r = row + knight_rows[i];
+			if (c >= 0 && c < 8 && r >= 0 && r < 8)
+				knight_attacks[sq] |= SQUARE_BIT(c + (8 * r));
+
+			c = col + dir_cols[i];
+			r = row + dir_rows[i];
+			if (c >= 0 && c < 8 && r >= 0 && r < 8)
+				king_attacks[sq] |= SQUARE_BIT(c + (8 * r));
+		}
 
-		curr_x += xinc;
-		curr_y += yinc;
+		/* White pawns attack up the board (row - 1), black down */
+		pawn_attacks[WHITE_MOVE][sq] = 0;
+		pawn_attacks[BLACK_MOVE][sq] = 0;
+		for (i = -1; i <= 1; i += 2){
+			if (col + i < 0 || col + i > 7)
+				continue;
+			if (row > 0)
+				pawn_attacks[WHITE_MOVE][sq] |= SQUARE_BIT(col + i + (8 * (row - 1)));
+			if (row < 7)
+				pawn_attacks[BLACK_MOVE][sq] |= SQUARE_BIT(col + i + (8 * (row + 1)));
+		}
+
+		pawn_zobrist[WHITE_MOVE][sq] = splitmix64(&zobrist_state);
+		pawn_zobrist[BLACK_MOVE][sq] = splitmix64(&zobrist_state);
 	}
+}
 
-	return 0;
+/* Safe to call from several threads at once: only the first call fills
+ * the tables, and the rest wait for it. */
+void init_tables()
+{
+	pthread_once(&tables_once, fill_tables);
 }
 
+/* Helper function. Squares from [sq] out in direction [dir] up to the
+ * edge of the board or the first square of [occupied], that square
+ * included. */
+SquareSet ray_through(int sq, int dir, SquareSet occupied)
+{
+	const SquareSet ray = ray_masks[dir][sq];
+	const SquareSet blockers = ray & occupied;
+	int first;
+	if (blockers == 0)
+		return ray;
+
+	/* Nearest blocker is the lowest square going up the board
+	 * index-wise, the highest going down */
+	first = (dir_cols[dir] + (8 * dir_rows[dir]) > 0) 
+			 ? SQUARESET_FIRST(blockers) : 63 - __builtin_clzll(blockers);
+	return ray & ~ray_masks[dir][first];
+}
 
-int find_piece_in_diagonals(int xori, int yori, ChessPiece findme, Position *p){
-	return find_piece_in_direction( 1,  1, xori, yori, findme, p)
-		|| find_piece_in_direction( 1, -1, xori, yori, findme, p)
-		|| find_piece_in_direction(-1,  1, xori, yori, findme, p)
-		|| find_piece_in_direction(-1, -1, xori, yori, findme, p);
+/* Helper function. Same as ray_through, blocked by the pieces on the
+ * board. */
+SquareSet ray_from(const Position *p, int sq, int dir)
+{
+	return ray_through(sq, dir, p->color_sets[0] | p->color_sets[1]);
 }
 
-int find_piece_in_orthogonals(int xori, int yori, ChessPiece findme, Position *p){
-	return find_piece_in_direction( 1,  0, xori, yori, findme, p)
-		|| find_piece_in_direction( 0,  1, xori, yori, findme, p)
-		|| find_piece_in_direction(-1,  0, xori, yori, findme, p)
-		|| find_piece_in_direction( 0, -1, xori, yori, findme, p);
+/* Helper function. Returns true (1) if [piece] slides along direction
+ * [dir] (rooks/queens orthogonally, bishops/queens diagonally). */
+int slides_along(ChessPiece piece, int dir)
+{
+	const ChessPiece kind = piece % 6;
+	if (dir < 4)
+		return kind == W_Q || kind == W_R;
+	return kind == W_Q || kind == W_B;
 }
 
-int Position_in_check(Position *p)
+/* Helper function. Squares attacked by [piece] standing on [sq], given 
+ * the pieces on the board now. Squares with pieces of either color count
+ * as attacked, so defended pieces show up too. */
+SquareSet attacks_from(const Position *p, ChessPiece piece, int sq)
 {
-	int kingsrc = p->to_move == WHITE_MOVE ? p->white_kingsrc : p->black_kingsrc;
-	int kingx = kingsrc % 8;
-	int kingy = kingsrc / 8;
+	SquareSet attacks = 0;
+	int i;
 
-	return Position_is_attacked(p, kingx, kingy);
+	switch (piece % 6){
+		case W_P:
+			return pawn_attacks[piece / 6][sq];
+		case W_N:
+			return knight_attacks[sq];
+		case W_K:
+			return king_attacks[sq];
+		default: /* Sliders */
+			for (i = 0; i < 8; i++)
+				if (slides_along(piece, i))
+					attacks |= ray_from(p, sq, i);
+	}
+
+	return attacks;
 }
 
-int Position_is_attacked(Position *p, int col, int row)
+/* Helper function. Squares of [color]'s pieces that attack [sq], if
+ * the occupied squares were [occupied] (which can differ from the board,
+ * to ask what happens after a move). */
+SquareSet attackers_to(const Position *p, int sq, SquareSet occupied, int color)
 {
-	char opposite_color = (1 + p->to_move) % 2;
-	ChessPiece opp_bishop = W_B + (6 * opposite_color);
-	ChessPiece opp_knight = W_N + (6 * opposite_color);
-	ChessPiece opp_rook = W_R + (6 * opposite_color);
-	ChessPiece opp_queen = W_Q + (6 * opposite_color);
-	ChessPiece opp_king = W_K + (6 * opposite_color);
-	ChessPiece opp_pawn = W_P + (6 * opposite_color);
+	const ChessPiece offset = 6 * color;
+	const SquareSet straight = p->piece_sets[W_R + offset] 
+								| p->piece_sets[W_Q + offset];
+	const SquareSet diagonal = p->piece_sets[W_B + offset] 
+								| p->piece_sets[W_Q + offset];
+	SquareSet attackers = 
+		(pawn_attacks[1 - color][sq] & p->piece_sets[W_P + offset])
+		| (knight_attacks[sq] & p->piece_sets[W_N + offset])
+		| (king_attacks[sq] & p->piece_sets[W_K + offset]);
+	int dir;
+
+	if (straight)
+		for (dir = 0; dir < 4; dir++)
+			attackers |= ray_through(sq, dir, occupied) & straight;
+	if (diagonal)
+		for (dir = 4; dir < 8; dir++)
+			attackers |= ray_through(sq, dir, occupied) & diagonal;
+	return attackers;
+}
 
+/* Helper function. Adds [delta] to [color]'s attack count on every
+ * square of [squares]. */
+void add_attacks(Position *p, int color, SquareSet squares, int delta)
+{
+	while (squares){
+		const int sq = SQUARESET_FIRST(squares);
+		squares &= squares - 1;
 
-	/* Check bishop, queen, rook */
-	if (find_piece_in_diagonals(col, row, opp_queen, p))
-		return 1;
-	if (find_piece_in_orthogonals(col, row, opp_queen, p))
-		return 1;
-	if (find_piece_in_diagonals(col, row, opp_bishop, p))
-		return 1;
-	if (find_piece_in_orthogonals(col, row, opp_rook, p))
-		return 1;
+		p->attack_counts[color][sq] += delta;
+		if (p->attack_counts[color][sq] == 0)
+			p->attacked_sets[color] &= ~SQUARE_BIT(sq);
+		else
+			p->attacked_sets[color] |= SQUARE_BIT(sq);
+	}
+}
 
-	/* Check knights */
-	if (Position_pieceat(p, row + 2, col + 1) == opp_knight)
-		return 1;
-	if (Position_pieceat(p, row + 2, col - 1) == opp_knight)
-		return 1;
-	if (Position_pieceat(p, row - 2, col + 1) == opp_knight)
-		return 1;
-	if (Position_pieceat(p, row - 2, col - 1) == opp_knight)
-		return 1;
-	if (Position_pieceat(p, row + 1, col + 2) == opp_knight)
-		return 1;
-	if (Position_pieceat(p, row + 1, col - 2) == opp_knight)
-		return 1;
-	if (Position_pieceat(p, row - 1, col + 2) == opp_knight)
-		return 1;
-	if (Position_pieceat(p, row - 1, col - 2) == opp_knight)
-		return 1;
+/* Helper function. For when [sq] goes from empty to occupied (delta -1)
+ * or the other way around (delta 1): every slider attacking [sq] now
+ * stops there, or now sees past it, so take away or add its attacks on
+ * the far side. */
+void update_rays_through(Position *p, int sq, int delta)
+{
+	int dir;
+	for (dir = 0; dir < 8; dir++){
+		const SquareSet ray = ray_from(p, sq, dir);
+		int end, slider;
+		if (ray == 0)
+			continue;
+
+		/* The far end of the ray is the first piece that way, if any */
+		end = (dir_cols[dir] + (8 * dir_rows[dir]) > 0) 
+				? 63 - __builtin_clzll(ray) : SQUARESET_FIRST(ray);
+		slider = p->piece_locations[end];
+		if (slider != EMT && slides_along(slider, dir))
+			add_attacks(p, slider / 6, 
+						ray_from(p, sq, dir_opposite[dir]), delta);
+	}
+}
 
+void Position_put_piece(Position *p, int sq, ChessPiece piece)
+{
+	const ChessPiece old_piece = p->piece_locations[sq];
+	if (old_piece == piece)
+		return;
 
-	/* Check pawns */
-	int opp_pawn_yinc = (p->to_move == WHITE_MOVE) ? -1 : 1;
-	if (Position_pieceat(p, row + opp_pawn_yinc, col + 1) == opp_pawn)
-		return 1;
-	if (Position_pieceat(p, row + opp_pawn_yinc, col - 1) == opp_pawn)
-		return 1;
+	if (old_piece != EMT)
+		add_attacks(p, old_piece / 6, attacks_from(p, old_piece, sq), -1);
+	if (old_piece == EMT || piece == EMT)
+		update_rays_through(p, sq, (old_piece == EMT) ? -1 : 1);
 
-	/* Check king */
-	if (Position_pieceat(p, row + 1, col + 1) == opp_king)
-		return 1;
-	if (Position_pieceat(p, row + 1, col - 1) == opp_king)
-		return 1;
-	if (Position_pieceat(p, row - 1, col + 1) == opp_king)
-		return 1;
-	if (Position_pieceat(p, row - 1, col - 1) == opp_king)
-		return 1;
-	if (Position_pieceat(p, row + 1, col + 0) == opp_king)
-		return 1;
-	if (Position_pieceat(p, row - 1, col + 0) == opp_king)
-		return 1;
-	if (Position_pieceat(p, row + 0, col + 1) == opp_king)
-		return 1;
-	if (Position_pieceat(p, row + 0, col - 1) == opp_king)
-		return 1;
+	put_piece_sets(p, sq, piece);
 
-	return 0;
+	if (piece != EMT)
+		add_attacks(p, piece / 6, attacks_from(p, piece, sq), 1);
+}
+
+void Position_refresh_sets(Position *p)
+{
+	int i;
+	init_tables();
+	for (i = 0; i < 12; i++)
+		p->piece_sets[i] = 0;
+	p->color_sets[0] = 0;
+	p->color_sets[1] = 0;
+	p->pawn_key = 0;
+
+	for (i = 0; i < 64; i++)
+		if (p->piece_locations[i] != EMT){
+			p->piece_sets[p->piece_locations[i]] |= SQUARE_BIT(i);
+			p->color_sets[p->piece_locations[i] / 6] |= SQUARE_BIT(i);
+			if (p->piece_locations[i] % 6 == W_P)
+				p->pawn_key ^= pawn_zobrist[p->piece_locations[i] / 6][i];
+		}
+
+	/* Attack maps, once every piece is in place */
+	memset(p->attack_counts, 0, sizeof(p->attack_counts));
+	p->attacked_sets[0] = 0;
+	p->attacked_sets[1] = 0;
+	for (i = 0; i < 64; i++)
+		if (p->piece_locations[i] != EMT)
+			add_attacks(p, p->piece_locations[i] / 6, 
+						attacks_from(p, p->piece_locations[i], i), 1);
+}
+
+int Position_in_check(const Position *p)
+{
+	int kingsrc = p->to_move == WHITE_MOVE ? p->white_kingsrc : p->black_kingsrc;
+	int kingx = kingsrc % 8;
+	int kingy = kingsrc / 8;
+
+	return Position_is_attacked(p, kingx, kingy);
+}
+
+int Position_is_attacked(const Position *p, int col, int row)
+{
+	int attacked;
+	PROF_BEGIN(PROF_IS_ATTACKED);
+
+	attacked = p->attack_counts[(1 + p->to_move) % 2][col + (8 * row)] != 0;
+
+	PROF_END(PROF_IS_ATTACKED);
+	return attacked;
 }
 
 
@@ -411,58 +615,89 @@ int Position_is_attacked(Position *p, int col, int row)
 ChessGame *Game_create()
 {
 	ChessGame *game = (ChessGame *)malloc(sizeof(ChessGame));
-	game->current_pos = Position_create();
+	Game_init(game);
+	return game;
+}
 
-	Game_find_all_legal_moves(game);
-	
+ChessGame *Game_create_in(Arena *arena)
+{
+	ChessGame *game = (ChessGame *)Arena_alloc(arena, sizeof(ChessGame));
+	Game_init(game);
 	return game;
 }
 
+void Game_init(ChessGame *g)
+{
+	Position_init(&g->current_pos);
+	Game_find_all_legal_moves(g);
+}
+
 void Game_destroy(ChessGame *g)
 {
-	free(g->current_pos);
 	free(g);
 }
 
-void Game_alter_position(ChessGame *g, Move altering_move)
+/* Helper function. Puts [piece] on [sq] like Position_put_piece, but
+ * notes down what was there in [undo] first. */
+void put_piece_undoable(Position *p, PositionUndo *undo, int sq, 
+						ChessPiece piece)
+{
+	undo->changed_squares[undo->num_changes] = sq;
+	undo->old_pieces[undo->num_changes] = p->piece_locations[sq];
+	undo->num_changes++;
+	Position_put_piece(p, sq, piece);
+}
+
+void Position_make_move(Position *p, Move altering_move, PositionUndo *undo)
 {
 	int dest_sq = altering_move.dest;
 	int src_sq = altering_move.src;
 
 	/* Get info for editing non-board metadata */
-	ChessPiece moving_piece = g->current_pos->piece_locations[src_sq];
-	int is_capture = g->current_pos->piece_locations[dest_sq] != EMT;
-	int current_mover = (int)(g->current_pos->to_move);
-	CastlingRights current_cr = g->current_pos->castling_rights[current_mover];
+	ChessPiece moving_piece = p->piece_locations[src_sq];
+	int is_capture = p->piece_locations[dest_sq] != EMT;
+	int current_mover = (int)(p->to_move);
+	CastlingRights current_cr = p->castling_rights[current_mover];
 	int dst_col = altering_move.dest % 8;
 	int dst_row = (altering_move.dest - dst_col)/8;
 	int src_col = altering_move.src % 8;
 	int src_row = (altering_move.src - src_col)/8;
-	
+
+	/* Save everything the move is about to change */
+	undo->num_changes = 0;
+	undo->to_move = p->to_move;
+	undo->castling_rights[0] = p->castling_rights[0];
+	undo->castling_rights[1] = p->castling_rights[1];
+	undo->halfmove_clock = p->halfmove_clock;
+	undo->fullmove_clock = p->fullmove_clock;
+	undo->en_passant_target = p->en_passant_target;
+	undo->white_kingsrc = p->white_kingsrc;
+	undo->black_kingsrc = p->black_kingsrc;
+
 	/* Half move clock: set to zero if pawn push or capture, else 
 	 * increase */
 	if (is_capture || moving_piece % 6 == 5 /* Is pawn */ )
-		g->current_pos->halfmove_clock = 0;
+		p->halfmove_clock = 0;
 	else
-		g->current_pos->halfmove_clock++;
+		p->halfmove_clock++;
 	/* Full move clock: increase if it is black's turn, since that marks
 	 * the end of the "full move" */
 	if (current_mover == BLACK_MOVE)
-		g->current_pos->fullmove_clock++;
+		p->fullmove_clock++;
 
-	g->current_pos->en_passant_target = -1;
+	p->en_passant_target = -1;
 	/* Change en passant, if necessary */
 	if (moving_piece % 6 == 5 /* Is pawn */ )
 		/* If pawn movement of more than 1, that square is the
 		 * "en passant can happen here" square. */
 		if ((src_row - dst_row) > 1 || (src_row - dst_row) < -1) 
-			g->current_pos->en_passant_target = altering_move.dest;
+			p->en_passant_target = altering_move.dest;
 				
 
 	/* Change castling privileges, if necessary */
 	/* King moved */
 	if (moving_piece % 6 == 0 /* Is king */ )
-		g->current_pos->castling_rights[current_mover] = NONE;
+		p->castling_rights[current_mover] = NONE;
 	/* Rook moved */
 	else if (moving_piece % 6 == 2 /* Is rook */ && current_cr != NONE)
 		/* Check if rook is in original rank */
@@ -470,65 +705,93 @@ void Game_alter_position(ChessGame *g, Move altering_move)
 
 			/* Check kingside */
 			if (src_col == 7 && current_cr == BOTH)
-				g->current_pos->castling_rights[current_mover] = QUEENSIDE;
+				p->castling_rights[current_mover] = QUEENSIDE;
 			else if (src_col == 7 && current_cr == KINGSIDE)
-				g->current_pos->castling_rights[current_mover] = NONE;
+				p->castling_rights[current_mover] = NONE;
 			/* Check queenside */
 			else if (src_col == 0 && current_cr == BOTH)
-				g->current_pos->castling_rights[current_mover] = KINGSIDE;
+				p->castling_rights[current_mover] = KINGSIDE;
 			else if (src_col == 0 && current_cr == QUEENSIDE)
-				g->current_pos->castling_rights[current_mover] = NONE;
+				p->castling_rights[current_mover] = NONE;
 		}
 
+	/* Rook captured in its corner: the other side can't castle with it */
+	if (dest_sq == 0 || dest_sq == 56)
+		p->castling_rights[dest_sq == 0 ? BLACK_MOVE : WHITE_MOVE] &= ~QUEENSIDE;
+	else if (dest_sq == 7 || dest_sq == 63)
+		p->castling_rights[dest_sq == 7 ? BLACK_MOVE : WHITE_MOVE] &= ~KINGSIDE;
+
 	
-	/* Actually move the piece on the board */
-	g->current_pos->piece_locations[dest_sq] = moving_piece;
-	g->current_pos->piece_locations[src_sq] = EMT;
+	/* Actually move the piece on the board, promoting if necessary */
+	if (altering_move.promoting_to < EMT && altering_move.promoting_to >= 0)
+		put_piece_undoable(p, undo, dest_sq, altering_move.promoting_to);
+	else
+		put_piece_undoable(p, undo, dest_sq, moving_piece);
+	put_piece_undoable(p, undo, src_sq, EMT);
 	/* If King moved multiple squares, then they castled,
 	 * meaning move rook too. */
 	if (moving_piece % 6 == 0 /* Is king */ ){
 		if (dst_col - src_col < -1 || dst_col - src_col > 1) /* big mvmt */ {
 			if (dst_col == 6 /* Kingside castle */){
 				/* Move rook */
-				g->current_pos->piece_locations[dest_sq - 1] = 
-									g->current_pos->piece_locations[dest_sq + 1];
-				g->current_pos->piece_locations[dest_sq + 1] = EMT;
+				put_piece_undoable(p, undo, dest_sq - 1, 
+								p->piece_locations[dest_sq + 1]);
+				put_piece_undoable(p, undo, dest_sq + 1, EMT);
 			}
 			else { /* Queenside castle */
 				/* Move rook */
-				g->current_pos->piece_locations[dest_sq + 1] = 
-									g->current_pos->piece_locations[dest_sq - 2];
-				g->current_pos->piece_locations[dest_sq - 2] = EMT;
+				put_piece_undoable(p, undo, dest_sq + 1, 
+								p->piece_locations[dest_sq - 2]);
+				put_piece_undoable(p, undo, dest_sq - 2, EMT);
 			}
 		}
 
 		/* Modify kingsrc */
-		if (g->current_pos->to_move == WHITE_MOVE)
-			g->current_pos->white_kingsrc = dest_sq;
+		if (p->to_move == WHITE_MOVE)
+			p->white_kingsrc = dest_sq;
 		else
-			g->current_pos->black_kingsrc = dest_sq;
+			p->black_kingsrc = dest_sq;
 	}
 
 	/* Remove pawn that got en passanted, if necessary. */
 	if (altering_move.is_en_passant == 1){
 		int reverse_pawn_yinc = (current_mover == WHITE_MOVE) ? 1 : -1;
-		g->current_pos->piece_locations[dest_sq + (8*reverse_pawn_yinc)] = EMT;
+		put_piece_undoable(p, undo, dest_sq + (8*reverse_pawn_yinc), EMT);
 	}
 
 	/* Change next to move */
 	char next_mover = (current_mover == WHITE_MOVE) ? BLACK_MOVE : WHITE_MOVE;
-	g->current_pos->to_move = next_mover;
+	p->to_move = next_mover;
+}
 
-	/* Promote, if necessary */
-	if (altering_move.promoting_to < EMT && altering_move.promoting_to >= 0)
-		g->current_pos->piece_locations[dest_sq] = altering_move.promoting_to;
+void Position_unmake_move(Position *p, PositionUndo *undo)
+{
+	/* Put the pieces back in the reverse order they were changed, so
+	 * the attack maps are unwound step by step too. */
+	int i;
+	for (i = undo->num_changes - 1; i >= 0; i--)
+		Position_put_piece(p, undo->changed_squares[i], undo->old_pieces[i]);
+
+	p->to_move = undo->to_move;
+	p->castling_rights[0] = undo->castling_rights[0];
+	p->castling_rights[1] = undo->castling_rights[1];
+	p->halfmove_clock = undo->halfmove_clock;
+	p->fullmove_clock = undo->fullmove_clock;
+	p->en_passant_target = undo->en_passant_target;
+	p->white_kingsrc = undo->white_kingsrc;
+	p->black_kingsrc = undo->black_kingsrc;
+}
 
+void Game_alter_position(ChessGame *g, Move altering_move)
+{
+	PositionUndo undo;
+	Position_make_move(&g->current_pos, altering_move, &undo);
 }	
 
 
-ChessPiece Game_pieceat(ChessGame *g, int row, int col)
+ChessPiece Game_pieceat(const ChessGame *g, int row, int col)
 {
-	return g->current_pos->piece_locations[col + (8*row)];
+	return g->current_pos.piece_locations[col + (8*row)];
 }
 
 /* Helper function. Returns true (1) if [piece] is the same color as
@@ -538,64 +801,51 @@ int same_color(ChessPiece piece, char color)
 	return ((6 * color) <= piece) && ((6 + 6 * color) > piece);
 }
 
-/* Temporarily alters position to see if the king of the currently moving
- * player would be in check after the move with the given parameters is
- * played. If so, returns 1, else 0. */
-int in_check_after_move(ChessGame *g, int src, int dest, int ep)
+/* Returns 1 if the king of the currently moving player would be in
+ * check after the move with the given parameters is played, else 0.
+ * Works it out from the square sets as they'd be after the move, 
+ * without touching the position. */
+int in_check_after_move(const Position *p, int src, int dest, int ep)
 {
-	ChessPiece moving_piece = g->current_pos->piece_locations[src]; 
-	ChessPiece removed_piece = g->current_pos->piece_locations[dest];
-	int kingsrc = g->current_pos->to_move == WHITE_MOVE 
-				   ? g->current_pos->white_kingsrc 
-				   : g->current_pos->black_kingsrc;
-
-	/* Temporatily alter board! */
-	g->current_pos->piece_locations[dest] = moving_piece;
-	g->current_pos->piece_locations[src] = EMT;
-
-	/* Move kingsrc if king moves */
-	if (moving_piece == W_K)
-		g->current_pos->white_kingsrc = dest;
-	else if (moving_piece == B_K)
-		g->current_pos->black_kingsrc = dest;
-
+	PROF_BEGIN(PROF_IN_CHECK_AFTER_MOVE);
+	const int us = p->to_move;
+	int king = (us == WHITE_MOVE) ? p->white_kingsrc : p->black_kingsrc;
 	/* En passant can get you in/out of check too! Important */
-	ChessPiece ep_pawn;
-	if (ep){
-		ep_pawn = 
-			g->current_pos->piece_locations[g->current_pos->en_passant_target];	
-		g->current_pos->piece_locations[g->current_pos->en_passant_target] = EMT;
-	}
-
-	int in_check = Position_in_check(g->current_pos);
-
-	/* Swap the pieces back. */	
-	g->current_pos->piece_locations[dest] = removed_piece;
-	g->current_pos->piece_locations[src] = moving_piece;
-
-	if (ep)
-		g->current_pos->piece_locations[g->current_pos->en_passant_target]
-			= ep_pawn;
-
-	if (moving_piece == W_K)
-		g->current_pos->white_kingsrc = kingsrc;
-	else if (moving_piece == B_K)
-		g->current_pos->black_kingsrc = kingsrc;
-
+	const SquareSet captured = ep ? SQUARE_BIT(p->en_passant_target) 
+								  : SQUARE_BIT(dest);
+	const SquareSet occupied = 
+		((p->color_sets[0] | p->color_sets[1]) & ~SQUARE_BIT(src) & ~captured)
+		| SQUARE_BIT(dest);
+	int in_check;
+
+	if (king == src)
+		king = dest;
+	in_check = (attackers_to(p, king, occupied, 1 - us) & ~captured) != 0;
+
+	PROF_END(PROF_IN_CHECK_AFTER_MOVE);
 	return in_check;
 }
 
 /* Helper function that simply adds a move to [g]'s list of possible
- * moves, if they don't cause check. */
+ * moves, already knowing that it's legal. A full list is left as it is
+ * (see MAX_MOVES). */
+void append_move(ChessGame *g, int src, int dest, ChessPiece promo, int ep)
+{
+	if (g->num_possible_moves == MAX_MOVES)
+		return;
+	g->current_possible_moves[g->num_possible_moves].src = src;
+	g->current_possible_moves[g->num_possible_moves].dest = dest;
+	g->current_possible_moves[g->num_possible_moves].promoting_to = promo;
+	g->current_possible_moves[g->num_possible_moves].is_en_passant = ep;
+	g->num_possible_moves++;
+}
+
+/* Helper function that adds a move to [g]'s list of possible moves, if
+ * it doesn't cause check. */
 void add_move(ChessGame *g, int src, int dest, ChessPiece promo, int ep)
 {
-	if (!in_check_after_move(g, src, dest, ep)){
-		g->current_possible_moves[g->num_possible_moves].src = src;
-		g->current_possible_moves[g->num_possible_moves].dest = dest;
-		g->current_possible_moves[g->num_possible_moves].promoting_to = promo;
-		g->current_possible_moves[g->num_possible_moves].is_en_passant = ep;
-		g->num_possible_moves++;
-	}
+	if (!in_check_after_move(&g->current_pos, src, dest, ep))
+		append_move(g, src, dest, promo, ep);
 }
 
 
@@ -717,7 +967,7 @@ void add_pawn_moves(int xorigin, int yorigin, char piece_color, ChessGame *g)
 	}
 
 	/* En passant: this one can't promote */
-	const int ep_targ = g->current_pos->en_passant_target;
+	const int ep_targ = g->current_pos.en_passant_target;
 	if (ep_targ != -1){
 		const int ep_col = ep_targ % 8;
 		const int ep_row = (ep_targ - ep_col) / 8;
@@ -732,37 +982,60 @@ void add_pawn_moves(int xorigin, int yorigin, char piece_color, ChessGame *g)
 }
 
 
+/* Like add_if_valid, but for a step of the king, which can be settled
+ * with the attack maps: it can never step onto an attacked square, and
+ * since it's not in check (Game_find_all_legal_moves handles that with
+ * the evasion code) any other square is safe. */
+void add_king_step(int xsrc, int ysrc, int xinc, int yinc, ChessGame *g, 
+				   char piece_color)
+{
+	const int ydest = ysrc + yinc;
+	const int xdest = xsrc + xinc;
+	if (xdest < 0 || xdest > 7 || ydest < 0 || ydest > 7)
+		return;
+	if (same_color(Game_pieceat(g, ydest, xdest), piece_color) ||
+		Position_is_attacked(&g->current_pos, xdest, ydest))
+		return;
+
+	append_move(g, xsrc + (8*ysrc), xdest + (8*ydest), EMT, 0);
+}
+
+/* Only used out of check. */
 void add_king_moves(int xorigin, int yorigin, char piece_color, ChessGame *g)
 {
 	int color_index = (int)piece_color;
+	const int src = xorigin + (8 * yorigin);
 
 	/* Normal king moves */
-	add_if_valid(xorigin, yorigin,  1,  1, g, piece_color);	
-	add_if_valid(xorigin, yorigin,  1, -1, g, piece_color);	
-	add_if_valid(xorigin, yorigin, -1,  1, g, piece_color);	
-	add_if_valid(xorigin, yorigin, -1, -1, g, piece_color);	
-	add_if_valid(xorigin, yorigin,  1,  0, g, piece_color);	
-	add_if_valid(xorigin, yorigin,  0, -1, g, piece_color);	
-	add_if_valid(xorigin, yorigin, -1,  0, g, piece_color);	
-	add_if_valid(xorigin, yorigin,  0,  1, g, piece_color);	
-
-	/* Castling */
-	if (Game_pieceat(g, yorigin, xorigin + 1) == EMT &&
+	add_king_step(xorigin, yorigin,  1,  1, g, piece_color);
+	add_king_step(xorigin, yorigin,  1, -1, g, piece_color);
+	add_king_step(xorigin, yorigin, -1,  1, g, piece_color);
+	add_king_step(xorigin, yorigin, -1, -1, g, piece_color);
+	add_king_step(xorigin, yorigin,  1,  0, g, piece_color);
+	add_king_step(xorigin, yorigin,  0, -1, g, piece_color);
+	add_king_step(xorigin, yorigin, -1,  0, g, piece_color);
+	add_king_step(xorigin, yorigin,  0,  1, g, piece_color);
+
+	/* Castling. The squares the king crosses and lands on can't be
+	 * attacked, which is all lookups. Rights go first: only a king still
+	 * on its own square has any (Game_set_FEN makes sure of it), so the
+	 * squares next to it are on the board. */
+	if ((g->current_pos.castling_rights[color_index] == BOTH ||
+		 g->current_pos.castling_rights[color_index] == KINGSIDE) &&
+		Game_pieceat(g, yorigin, xorigin + 1) == EMT &&
 		Game_pieceat(g, yorigin, xorigin + 2) == EMT &&
-		!Position_is_attacked(g->current_pos, xorigin + 1, yorigin) && 
-		!Position_is_attacked(g->current_pos, xorigin + 2, yorigin) && 
-		(g->current_pos->castling_rights[color_index] == BOTH ||
-		 g->current_pos->castling_rights[color_index] == KINGSIDE))
-		add_if_valid(xorigin, yorigin, 2, 0, g, piece_color);
+		!Position_is_attacked(&g->current_pos, xorigin + 1, yorigin) && 
+		!Position_is_attacked(&g->current_pos, xorigin + 2, yorigin))
+		append_move(g, src, src + 2, EMT, 0);
 
-	if (Game_pieceat(g, yorigin, xorigin - 1) == EMT &&
+	if ((g->current_pos.castling_rights[color_index] == BOTH ||
+		 g->current_pos.castling_rights[color_index] == QUEENSIDE) &&
+		Game_pieceat(g, yorigin, xorigin - 1) == EMT &&
 		Game_pieceat(g, yorigin, xorigin - 2) == EMT &&
 		Game_pieceat(g, yorigin, xorigin - 3) == EMT &&
-		!Position_is_attacked(g->current_pos, xorigin - 1, yorigin) && 
-		!Position_is_attacked(g->current_pos, xorigin - 2, yorigin) && 
-		(g->current_pos->castling_rights[color_index] == BOTH ||
-		 g->current_pos->castling_rights[color_index] == QUEENSIDE))
-		add_if_valid(xorigin, yorigin, -2, 0, g, piece_color);
+		!Position_is_attacked(&g->current_pos, xorigin - 1, yorigin) && 
+		!Position_is_attacked(&g->current_pos, xorigin - 2, yorigin))
+		append_move(g, src, src - 2, EMT, 0);
 }
 
 
@@ -772,7 +1045,7 @@ void add_king_moves(int xorigin, int yorigin, char piece_color, ChessGame *g)
  * the array in [g].  */
 void add_legal_moves_single_piece(ChessGame *g, int row, int col){
 	ChessPiece moving_piece = Game_pieceat(g, row, col);
-	char moving_color = g->current_pos->to_move;
+	char moving_color = g->current_pos.to_move;
 
 	switch( moving_piece ){
 		case W_K:
@@ -800,34 +1073,19 @@ void add_legal_moves_single_piece(ChessGame *g, int row, int col){
 		case B_P:
 			add_pawn_moves(col, row, moving_color, g);
 			break;
-		default: 
-			printf("oh no. something is terribly wrong.\n");
+		default: /* Empty square, nothing to add */
+			break;
 	}
 }
 
-void Game_find_all_legal_moves(ChessGame *g)
+/* Helper function. Whether the game is over, given whether the side to
+ * move has a legal move. */
+GameCondition game_condition(const ChessGame *g, int has_move)
 {
-	g->num_possible_moves = 0;
-
-	/* Iterate through board */
-	int r, c;
-	for (r = 0; r < 8; r++)
-		for (c = 0; c < 8; c++)
-			if (same_color(Game_pieceat(g, r, c), g->current_pos->to_move))
-				add_legal_moves_single_piece(g, r, c);
-}
-
-
-GameCondition Game_advanceturn(ChessGame *g, Move m)
-{
-	Game_alter_position(g, m);
-	Game_find_all_legal_moves(g);
-
-	/* Check if game is over */
-	if (g->num_possible_moves == 0){
-		if (Position_in_check(g->current_pos)){
+	if (!has_move){
+		if (Position_in_check(&g->current_pos)){
 			/* That's checkmate! See who the winner is. */
-			if (g->current_pos->to_move == WHITE_MOVE)
+			if (g->current_pos.to_move == WHITE_MOVE)
 				return BLACK;
 			else
 				return WHITE;
@@ -837,19 +1095,46 @@ GameCondition Game_advanceturn(ChessGame *g, Move m)
 	}
 
 	/* Check 50 move rule */
-	if (g->current_pos->halfmove_clock >= 50)
+	if (g->current_pos.halfmove_clock >= 50)
 		return DRAW;
 
 	return PLAYING;
 }
 
+GameCondition Game_advanceturn(ChessGame *g, Move m)
+{
+	Game_alter_position(g, m);
+	Game_find_all_legal_moves(g);
+	return game_condition(g, g->num_possible_moves > 0);
+}
+
+GameCondition Game_advanceturn_lazy(ChessGame *g, Move m)
+{
+	Game_alter_position(g, m);
+	g->moves_pending = 1;
+	return game_condition(g, Game_has_legal_move(g));
+}
+
+GameCondition Game_condition(const ChessGame *g)
+{
+	return game_condition(g, g->moves_pending ? Game_has_legal_move(g)
+											  : g->num_possible_moves > 0);
+}
+
+void Game_ensure_moves(ChessGame *g)
+{
+	if (g->moves_pending)
+		Game_find_all_legal_moves(g);
+}
+
 
 GameCondition Game_advanceturn_index(ChessGame *g, int move_index)
 {
+	Game_ensure_moves(g);
 	return Game_advanceturn(g, g->current_possible_moves[move_index]);
 }
 
-Move index_move(ChessGame *g, int index)
+Move index_move(const ChessGame *g, int index)
 {
 	return g->current_possible_moves[index];
 }
@@ -858,152 +1143,1064 @@ int Game_get_legal(ChessGame *g, Move m)
 {
 	/* TODO: PROMOTION STUFF */
 	int i;
+	Game_ensure_moves(g);
 	for (i = 0; i < g->num_possible_moves; i++)
 		if (m.src == index_move(g, i).src && m.dest == index_move(g, i).dest)
 			return i;
 	return -1;
 }
 
-void Game_copy(ChessGame *src, ChessGame *target){
+void Game_copy(const ChessGame *src, ChessGame *target){
+	PROF_BEGIN(PROF_GAME_COPY);
 	target->num_possible_moves = src->num_possible_moves;
-	/* Copy moves */
-	int i;
-	for (i = 0; i < target->num_possible_moves; i++){
-		target->current_possible_moves[i].src = 
-						src->current_possible_moves[i].src;
-		target->current_possible_moves[i].dest = 
-						src->current_possible_moves[i].dest;
-		target->current_possible_moves[i].promoting_to = 
-						src->current_possible_moves[i].promoting_to;
-		target->current_possible_moves[i].is_en_passant = 
-						src->current_possible_moves[i].is_en_passant;
-		/* No need to copy title */
-	}
+	target->moves_pending = src->moves_pending;
+	/* Copy moves (titles come along too, which doesn't hurt) */
+	if (!src->moves_pending)
+		memcpy(target->current_possible_moves, src->current_possible_moves,
+			   src->num_possible_moves * sizeof(Move));
 
 	/* Copy position */
-	target->current_pos->to_move = src->current_pos->to_move;
-	target->current_pos->castling_rights[0]= src->current_pos->castling_rights[0];
-	target->current_pos->castling_rights[1]= src->current_pos->castling_rights[1];
-	target->current_pos->halfmove_clock = src->current_pos->halfmove_clock;
-	target->current_pos->fullmove_clock = src->current_pos->fullmove_clock;
-	target->current_pos->en_passant_target = src->current_pos->en_passant_target;
-	target->current_pos->black_kingsrc = src->current_pos->black_kingsrc;
-	target->current_pos->white_kingsrc = src->current_pos->white_kingsrc;
-	for (i = 0; i < 64; i++){
-		target->current_pos->piece_locations[i] = 
-						src->current_pos->piece_locations[i];
+	target->current_pos = src->current_pos;
+
+	PROF_END(PROF_GAME_COPY);
+}
+
+
+
+/********************************
+ *       LEGAL MOVE COUNTING    *	
+ * ******************************/
+
+/* Everything needed to tell which of the mover's pseudo-legal moves are
+ * legal without trying them out on the board. */
+typedef struct {
+	int king;
+	/* Enemy pieces giving check */
+	SquareSet checkers;
+	/* Squares a move of anything but the king has to land on: all of
+	 * them out of check, the checker and the squares between it and the
+	 * king in check, none in double check. */
+	SquareSet check_mask;
+	/* Mover's pieces pinned to its king, and for each direction out
+	 * from the king, the line a piece pinned that way can move along
+	 * (up to and including the pinner). */
+	SquareSet pinned;
+	SquareSet pin_lines[8];
+} LegalityInfo;
+
+/* Helper function. Squares strictly between [a] and [b] if they share
+ * a line, else none. */
+SquareSet squares_between(int a, int b)
+{
+	int dir;
+	for (dir = 0; dir < 8; dir++)
+		if (ray_masks[dir][a] & SQUARE_BIT(b))
+			return ray_masks[dir][a] & ~ray_masks[dir][b] & ~SQUARE_BIT(b);
+	return 0;
+}
+
+void find_legality_info(const Position *p, LegalityInfo *info)
+{
+	const int us = p->to_move;
+	const int them = 1 - us;
+	const SquareSet occupied = p->color_sets[0] | p->color_sets[1];
+	int dir;
+
+	info->king = (us == WHITE_MOVE) ? p->white_kingsrc : p->black_kingsrc;
+	info->checkers = attackers_to(p, info->king, occupied, them);
+
+	if (info->checkers == 0)
+		info->check_mask = ~(SquareSet)0;
+	else if ((info->checkers & (info->checkers - 1)) == 0)
+		info->check_mask = info->checkers 
+			| squares_between(info->king, SQUARESET_FIRST(info->checkers));
+	else
+		info->check_mask = 0;
+
+	/* Pins: look out from the king for one of our pieces with an enemy
+	 * slider right behind it. */
+	info->pinned = 0;
+	for (dir = 0; dir < 8; dir++){
+		const SquareSet ray = ray_through(info->king, dir, occupied);
+		SquareSet behind;
+		int blocker, pinner;
+
+		if ((ray & p->color_sets[us]) == 0)
+			continue;
+		blocker = SQUARESET_FIRST(ray & p->color_sets[us]);
+
+		behind = ray_through(blocker, dir, occupied);
+		if ((behind & p->color_sets[them]) == 0)
+			continue;
+		pinner = SQUARESET_FIRST(behind & p->color_sets[them]);
+
+		if (slides_along(p->piece_locations[pinner], dir)){
+			info->pinned |= SQUARE_BIT(blocker);
+			info->pin_lines[dir] = ray | behind;
+		}
 	}
 }
 
+/* Helper function. Line a pinned piece on [sq] may move along. */
+SquareSet pin_line(const LegalityInfo *info, int sq)
+{
+	int dir;
+	for (dir = 0; dir < 8; dir++)
+		if (ray_masks[dir][info->king] & SQUARE_BIT(sq))
+			return info->pin_lines[dir];
+	return 0;
+}
 
+/* Helper function. Squares the king can legally step to, castling
+ * included (same rules as add_king_moves). */
+SquareSet king_targets(const Position *p, const LegalityInfo *info)
+{
+	const int us = p->to_move;
+	const int them = 1 - us;
+	const int k = info->king;
+	const SquareSet occupied = p->color_sets[0] | p->color_sets[1];
+	SquareSet steps = king_attacks[k] & ~p->color_sets[us] 
+						& ~p->attacked_sets[them];
+	SquareSet targets = steps;
+
+	/* Not attacked now, but in check a slider could be attacking 
+	 * through the king's square */
+	if (info->checkers){
+		while (steps){
+			const int t = SQUARESET_FIRST(steps);
+			steps &= steps - 1;
+			if (attackers_to(p, t, occupied & ~SQUARE_BIT(k), them))
+				targets &= ~SQUARE_BIT(t);
+		}
+		return targets;
+	}
+
+	if ((p->castling_rights[us] & KINGSIDE) &&
+		p->piece_locations[k + 1] == EMT && p->piece_locations[k + 2] == EMT &&
+		!(p->attacked_sets[them] & (SQUARE_BIT(k + 1) | SQUARE_BIT(k + 2))))
+		targets |= SQUARE_BIT(k + 2);
+
+	if ((p->castling_rights[us] & QUEENSIDE) &&
+		p->piece_locations[k - 1] == EMT && p->piece_locations[k - 2] == EMT &&
+		p->piece_locations[k - 3] == EMT &&
+		!(p->attacked_sets[them] & (SQUARE_BIT(k - 1) | SQUARE_BIT(k - 2))))
+		targets |= SQUARE_BIT(k - 2);
+
+	return targets;
+}
 
-void Game_read_FEN(ChessGame *g, char *filename)
+/* Helper function. Squares the (non-king) piece on [sq] could move to
+ * if its own king didn't matter, en passant left out. Works for either
+ * side, whoever's turn it is. */
+SquareSet pseudo_targets(const Position *p, int sq)
 {
-	FILE *fp = fopen(filename, "r");
-	if (fp == NULL){
-		printf("File doesn't exist oh no\n");
+	const ChessPiece piece = p->piece_locations[sq];
+	const int color = piece / 6;
+	const SquareSet occupied = p->color_sets[0] | p->color_sets[1];
+	SquareSet targets = 0;
+	int dir;
+
+	switch (piece % 6){
+		case W_P: {
+			const int forward = (color == WHITE_MOVE) ? -8 : 8;
+			const int start_row = (color == WHITE_MOVE) ? 6 : 1;
+			if (p->piece_locations[sq + forward] == EMT){
+				targets |= SQUARE_BIT(sq + forward);
+				if (sq / 8 == start_row && 
+					p->piece_locations[sq + (2 * forward)] == EMT)
+					targets |= SQUARE_BIT(sq + (2 * forward));
+			}
+			targets |= pawn_attacks[color][sq] & p->color_sets[1 - color];
+			break;
+		}
+		case W_N:
+			targets = knight_attacks[sq];
+			break;
+		default:
+			for (dir = 0; dir < 8; dir++)
+				if (slides_along(piece, dir))
+					targets |= ray_through(sq, dir, occupied);
+	}
+
+	return targets & ~p->color_sets[color];
+}
+
+/* Helper function. Cuts [targets] of the mover's piece on [sq] down to
+ * the legal ones. */
+SquareSet legal_targets(const LegalityInfo *info, int sq, SquareSet targets)
+{
+	targets &= info->check_mask;
+	if (info->pinned & SQUARE_BIT(sq))
+		targets &= pin_line(info, sq);
+	return targets;
+}
+
+/* Helper function. Squares the (non-king) piece on [sq] can legally
+ * move to, en passant left out. */
+SquareSet piece_targets(const Position *p, const LegalityInfo *info, int sq)
+{
+	return legal_targets(info, sq, pseudo_targets(p, sq));
+}
+
+/* Helper function. True (1) if the pawn on [sq] can legally take en
+ * passant. Rare enough to just work out the board after the capture. */
+int en_passant_legal(const Position *p, const LegalityInfo *info, int sq)
+{
+	const int us = p->to_move;
+	const int captured = p->en_passant_target;
+	int dest;
+	SquareSet occupied;
+
+	if (captured == -1 || p->piece_locations[sq] % 6 != W_P || captured / 8 != sq / 8 ||
+		(captured % 8 - sq % 8 != 1 && captured % 8 - sq % 8 != -1))
+		return 0;
+
+	dest = captured + ((us == WHITE_MOVE) ? -8 : 8);
+	occupied = ((p->color_sets[0] | p->color_sets[1]) 
+				& ~SQUARE_BIT(sq) & ~SQUARE_BIT(captured)) | SQUARE_BIT(dest);
+	return (attackers_to(p, info->king, occupied, 1 - us) 
+			& ~SQUARE_BIT(captured)) == 0;
+}
+
+/* Helper function. Squares whose change can change where the (non-king)
+ * piece on [sq] can go: the squares it attacks, and for a pawn the
+ * squares it pushes to, blocked or not. */
+SquareSet piece_reach(const Position *p, int sq)
+{
+	const ChessPiece piece = p->piece_locations[sq];
+	SquareSet reach = attacks_from(p, piece, sq);
+	if (piece % 6 == W_P){
+		const int forward = (piece == W_P) ? -8 : 8;
+		const int start_row = (piece == W_P) ? 6 : 1;
+		reach |= SQUARE_BIT(sq + forward);
+		if (sq / 8 == start_row)
+			reach |= SQUARE_BIT(sq + (2 * forward));
+	}
+	return reach;
+}
+
+/* Helper function. Pseudo-legal targets of the (non-king) piece on 
+ * [sq], from [t] when it can be trusted: [t] was up to date before the
+ * squares in [changed] changed, so it's good for any piece that isn't 
+ * on one of them and doesn't reach one. Pawns are cheap enough to just 
+ * work out. */
+SquareSet tracked_targets(const Position *p, const MoveTracker *t, int sq,
+						  SquareSet changed)
+{
+	const ChessPiece piece = p->piece_locations[sq];
+	if (t == NULL || piece % 6 == W_P || 
+		((t->reach[sq] | SQUARE_BIT(sq)) & changed))
+		return pseudo_targets(p, sq);
+	return t->reach[sq] & ~p->color_sets[piece / 6];
+}
+
+/* Rows a pawn promotes on: row 0 for white, row 7 for black */
+#define PROMOTION_ROWS ((SquareSet)0xFF | ((SquareSet)0xFF << 56))
+
+/* Helper function. Number of legal moves of the piece on [sq], taking
+ * its pseudo-legal targets from tracked_targets. */
+int count_piece_moves(const Position *p, const LegalityInfo *info, int sq,
+					  const MoveTracker *t, SquareSet changed)
+{
+	SquareSet targets;
+	if (sq == info->king)
+		return SQUARESET_COUNT(king_targets(p, info));
+	if (info->check_mask == 0) /* Double check, only the king moves */
+		return 0;
+
+	targets = legal_targets(info, sq, tracked_targets(p, t, sq, changed));
+	if (p->piece_locations[sq] % 6 != W_P)
+		return SQUARESET_COUNT(targets);
+
+	/* Four moves for every promotion */
+	return SQUARESET_COUNT(targets) 
+		   + (3 * SQUARESET_COUNT(targets & PROMOTION_ROWS))
+		   + en_passant_legal(p, info, sq);
+}
+
+int Game_count_piece_moves(const ChessGame *g, int counts[64])
+{
+	const Position *p = &g->current_pos;
+	LegalityInfo info;
+	SquareSet movers = p->color_sets[(int)p->to_move];
+	int total = 0;
+
+	find_legality_info(p, &info);
+	memset(counts, 0, 64 * sizeof(int));
+	while (movers){
+		const int sq = SQUARESET_FIRST(movers);
+		movers &= movers - 1;
+		counts[sq] = count_piece_moves(p, &info, sq, NULL, 0);
+		total += counts[sq];
+	}
+	return total;
+}
+
+/* Helper function. Game_count_legal_moves for [p], with the pieces' 
+ * targets from tracked_targets. */
+int count_moves(const Position *p, const MoveTracker *t, SquareSet changed)
+{
+	LegalityInfo info;
+	SquareSet movers = p->color_sets[(int)p->to_move];
+	int total = 0;
+
+	find_legality_info(p, &info);
+	if (info.check_mask == 0) /* Double check */
+		movers = SQUARE_BIT(info.king);
+	while (movers){
+		const int sq = SQUARESET_FIRST(movers);
+		movers &= movers - 1;
+		total += count_piece_moves(p, &info, sq, t, changed);
+	}
+	return total;
+}
+
+int Game_count_legal_moves(const ChessGame *g)
+{
+	return count_moves(&g->current_pos, NULL, 0);
+}
+
+int Game_has_legal_move(const ChessGame *g)
+{
+	const Position *p = &g->current_pos;
+	LegalityInfo info;
+	SquareSet movers;
+
+	find_legality_info(p, &info);
+	if (king_targets(p, &info))
+		return 1;
+	if (info.check_mask == 0) /* Double check */
+		return 0;
+
+	movers = p->color_sets[(int)p->to_move] & ~SQUARE_BIT(info.king);
+	while (movers){
+		const int sq = SQUARESET_FIRST(movers);
+		movers &= movers - 1;
+		if (piece_targets(p, &info, sq) || en_passant_legal(p, &info, sq))
+			return 1;
+	}
+	return 0;
+}
+
+
+/********************************
+ *    MOVES FROM SQUARE SETS    *	
+ * ******************************/
+
+/* Directions in the order the generator walks them: diagonals then
+ * orthogonals for sliders (bishops use the first four, rooks the last
+ * four), and the king's own order for its steps. */
+const int slide_order[8] = { 4, 6, 5, 7, 0, 1, 2, 3 };
+const int king_order[8]  = { 4, 5, 6, 7, 0, 3, 1, 2 };
+
+/* Helper function. Appends a pawn move to [dest], as the four 
+ * promotions if it lands on the last rank. */
+void append_pawn_move(ChessGame *g, int src, int dest, int color)
+{
+	if (dest / 8 == 0 || dest / 8 == 7){
+		append_move(g, src, dest, W_Q + (6 * color), 0);
+		append_move(g, src, dest, W_N + (6 * color), 0);
+		append_move(g, src, dest, W_B + (6 * color), 0);
+		append_move(g, src, dest, W_R + (6 * color), 0);
+	}
+	else
+		append_move(g, src, dest, EMT, 0);
+}
+
+/* Helper function. Appends the moves of the mover's piece on [sq] with
+ * legal target squares [targets], in the same order 
+ * add_legal_moves_single_piece would find them. */
+void append_targets(ChessGame *g, const LegalityInfo *info, int sq, 
+					SquareSet targets)
+{
+	Position *p = &g->current_pos;
+	const ChessPiece piece = p->piece_locations[sq];
+	const int color = piece / 6;
+	int i, dest;
+
+	switch (piece % 6){
+		case W_K:
+			for (i = 0; i < 8; i++){
+				/* The first square of a ray is the step that way */
+				const SquareSet step = targets & king_attacks[sq] 
+									   & ray_masks[king_order[i]][sq];
+				if (step)
+					append_move(g, sq, SQUARESET_FIRST(step), EMT, 0);
+			}
+			/* Castling: two squares over, never a step */
+			if (sq % 8 < 6 && (targets & SQUARE_BIT(sq + 2)))
+				append_move(g, sq, sq + 2, EMT, 0);
+			if (sq % 8 > 1 && (targets & SQUARE_BIT(sq - 2)))
+				append_move(g, sq, sq - 2, EMT, 0);
+			break;
+		case W_N:
+			for (i = 0; i < 8; i++){
+				const int col = (sq % 8) + knight_cols[i];
+				const int row = (sq / 8) + knight_rows[i];
+				dest = col + (8 * row);
+				if (col >= 0 && col < 8 && row >= 0 && row < 8 &&
+					(targets & SQUARE_BIT(dest)))
+					append_move(g, sq, dest, EMT, 0);
+			}
+			break;
+		case W_P: {
+			const int forward = (color == WHITE_MOVE) ? -8 : 8;
+			const int start_row = (color == WHITE_MOVE) ? 6 : 1;
+			if (targets & SQUARE_BIT(sq + forward))
+				append_pawn_move(g, sq, sq + forward, color);
+			if (sq / 8 == start_row && 
+				(targets & SQUARE_BIT(sq + (2 * forward))))
+				append_move(g, sq, sq + (2 * forward), EMT, 0);
+			/* Captures, left then right */
+			if (sq % 8 > 0 && (targets & SQUARE_BIT(sq + forward - 1)))
+				append_pawn_move(g, sq, sq + forward - 1, color);
+			if (sq % 8 < 7 && (targets & SQUARE_BIT(sq + forward + 1)))
+				append_pawn_move(g, sq, sq + forward + 1, color);
+			if (en_passant_legal(p, info, sq))
+				append_move(g, sq, p->en_passant_target + forward, EMT, 1);
+			break;
+		}
+		default:
+			for (i = 0; i < 8; i++){
+				const int dir = slide_order[i];
+				const int step = dir_cols[dir] + (8 * dir_rows[dir]);
+				SquareSet line = targets & ray_masks[dir][sq];
+				if (!slides_along(piece, dir))
+					continue;
+				for (dest = sq + step; line; dest += step){
+					if (line & SQUARE_BIT(dest)){
+						append_move(g, sq, dest, EMT, 0);
+						line &= ~SQUARE_BIT(dest);
+					}
+				}
+			}
+	}
+}
+
+void MoveTracker_init(MoveTracker *t, const Position *p)
+{
+	SquareSet pieces = p->color_sets[0] | p->color_sets[1];
+	memset(t->reach, 0, sizeof(t->reach));
+	while (pieces){
+		const int sq = SQUARESET_FIRST(pieces);
+		pieces &= pieces - 1;
+		if (p->piece_locations[sq] % 6 != W_K)
+			t->reach[sq] = piece_reach(p, sq);
+	}
+}
+
+/* Helper function. The squares [undo]'s move changed. */
+SquareSet changed_squares(const PositionUndo *undo)
+{
+	SquareSet changed = 0;
+	int i;
+	for (i = 0; i < undo->num_changes; i++)
+		changed |= SQUARE_BIT(undo->changed_squares[i]);
+	return changed;
+}
+
+void MoveTracker_update(MoveTracker *t, const Position *p, 
+						const PositionUndo *undo)
+{
+	const SquareSet changed = changed_squares(undo);
+	/* A piece only needs redoing if it's on a changed square or reaches
+	 * one (a slider reaches up to and including its first blocker, so
+	 * anything past that can't matter to it) */
+	SquareSet pieces = (p->color_sets[0] | p->color_sets[1]) 
+					   & ~(p->piece_sets[W_K] | p->piece_sets[B_K]);
+	int i;
+
+	for (i = 0; i < undo->num_changes; i++)
+		t->reach[undo->changed_squares[i]] = 0;
+
+	while (pieces){
+		const int sq = SQUARESET_FIRST(pieces);
+		pieces &= pieces - 1;
+		if ((t->reach[sq] | SQUARE_BIT(sq)) & changed)
+			t->reach[sq] = piece_reach(p, sq);
+	}
+}
+
+int Game_count_replies(const ChessGame *g, const MoveTracker *t, Move m)
+{
+	Position child = g->current_pos;
+	PositionUndo undo;
+	Position_make_move(&child, m, &undo);
+	return count_moves(&child, t, changed_squares(&undo));
+}
+
+/* Helper function. Fills [g]'s move list from the square sets, taking
+ * the pieces' pseudo-legal targets from [t] if there is one (up to 
+ * date with [g]), else working them out fresh. */
+void find_moves_from_sets(ChessGame *g, MoveTracker *t)
+{
+	const Position *p = &g->current_pos;
+	LegalityInfo info;
+	SquareSet movers = p->color_sets[(int)p->to_move];
+
+	g->num_possible_moves = 0;
+	g->moves_pending = 0;
+	find_legality_info(p, &info);
+	/* Double check: only the king can move */
+	if (info.check_mask == 0)
+		movers = SQUARE_BIT(info.king);
+
+	while (movers){
+		const int sq = SQUARESET_FIRST(movers);
+		movers &= movers - 1;
+		if (sq == info.king)
+			append_targets(g, &info, sq, king_targets(p, &info));
+		else
+			append_targets(g, &info, sq, legal_targets(&info, sq, 
+						   tracked_targets(p, t, sq, 0)));
+	}
+}
+
+GameCondition Game_advanceturn_tracked(ChessGame *g, MoveTracker *t, Move m)
+{
+	PositionUndo undo;
+	Position_make_move(&g->current_pos, m, &undo);
+	MoveTracker_update(t, &g->current_pos, &undo);
+	find_moves_from_sets(g, t);
+	return game_condition(g, g->num_possible_moves > 0);
+}
+
+void Game_find_all_legal_moves(ChessGame *g)
+{
+	PROF_BEGIN(PROF_FIND_ALL_LEGAL_MOVES);
+	/* In check, only king moves, captures of the checker and blocks
+	 * can be legal (only king moves in double check). The check mask 
+	 * and pins give exactly those, so skip trying every move out. */
+	if (Position_in_check(&g->current_pos)){
+		find_moves_from_sets(g, NULL);
+		PROF_END(PROF_FIND_ALL_LEGAL_MOVES);
 		return;
 	}
 
-	ChessPiece char_to_piece_map[128];
-	char *pieces = "KQRNBPkqrnbp";
+	g->num_possible_moves = 0;
+	g->moves_pending = 0;
+
+	/* Iterate through the mover's pieces only */
+	SquareSet movers = g->current_pos.color_sets[(int)g->current_pos.to_move];
+	while (movers){
+		const int sq = SQUARESET_FIRST(movers);
+		movers &= movers - 1;
+		add_legal_moves_single_piece(g, sq / 8, sq % 8);
+	}
+
+	PROF_END(PROF_FIND_ALL_LEGAL_MOVES);
+}
+
+
+
+/* Helper function. Returns the piece for FEN letter [c], or EMT if it
+ * isn't one. */
+ChessPiece fen_char_to_piece(char c)
+{
+	const char *pieces = "KQRNBPkqrnbp";
 	int i;
 	for (i = 0; i < 12; i++)
-		char_to_piece_map[(int)pieces[i]] = i;
+		if (pieces[i] == c)
+			return i;
+	return EMT;
+}
 
-	/* Current letter */
-	int c;
+/* Longest number fen_read_number reads. The clocks go up to 65535. */
+#define FEN_NUMBER_DIGITS 6
 
-	/* Fill board */
-	for (i = 0; i < 64; i++){
-		/* Don't care about slash since FEN style
-		 * matches board order anyway. */
-		while ((c = getc(fp)) == '/');
+/* Helper function. Skips spaces, then reads an unsigned number into
+ * [number]. Returns a pointer past the number, or NULL if there is
+ * no number there (or it has more than FEN_NUMBER_DIGITS digits). */
+const char *fen_read_number(const char *s, int *number)
+{
+	int digits = 0;
+	while (*s == ' ')	s++;
+	if (*s < '0' || *s > '9')
+		return NULL;
+
+	*number = 0;
+	while (*s >= '0' && *s <= '9'){
+		if (++digits > FEN_NUMBER_DIGITS)
+			return NULL;
+		*number = (*number * 10) + (*s - '0');
+		s++;
+	}
+	return s;
+}
+
+/* Helper function. Whether the pieces on [pos]'s board could all be
+ * there in a game: no pawns on the first or last rank, and no more of
+ * a color's pieces than its 8 pawns could have promoted to. */
+int fen_pieces_possible(const Position *pos)
+{
+	/* Each kind's starting count, K Q R N B P */
+	const int start[6] = { 1, 1, 2, 2, 2, 8 };
+	int counts[12];
+	int sq, color, kind;
+
+	for (kind = 0; kind < 12; kind++)
+		counts[kind] = 0;
+	for (sq = 0; sq < 64; sq++){
+		const ChessPiece piece = pos->piece_locations[sq];
+		if (piece == EMT)
+			continue;
+		if (piece % 6 == W_P && (sq < 8 || sq >= 56))
+			return 0;
+		counts[piece]++;
+	}
 
-		/* Assuming valid board, c is either a number
-		 * (add that num of spaces) or a piece. */
-		if (c > '0' && c < '9'){
+	for (color = 0; color < 2; color++){
+		int promoted = 0;
+		for (kind = W_Q; kind < W_P; kind++)
+			if (counts[6 * color + kind] > start[kind])
+				promoted += counts[6 * color + kind] - start[kind];
+		if (counts[6 * color + W_P] + promoted > 8)
+			return 0;
+	}
+	return 1;
+}
+
+/* Helper function. Whether [pos]'s castling rights fit its board: a
+ * right needs its king and rook on their starting squares. */
+int fen_castling_possible(const Position *pos)
+{
+	int color;
+	for (color = 0; color < 2; color++){
+		/* Back rank of [color]: rank 1 (row 7) for white */
+		const int row = color == WHITE_MOVE ? 56 : 0;
+		const int rights = pos->castling_rights[color];
+		if (rights == NONE)
+			continue;
+		if (pos->piece_locations[row + 4] != W_K + (6 * color))
+			return 0;
+		if ((rights & KINGSIDE) && 
+			pos->piece_locations[row + 7] != W_R + (6 * color))
+			return 0;
+		if ((rights & QUEENSIDE) && 
+			pos->piece_locations[row] != W_R + (6 * color))
+			return 0;
+	}
+	return 1;
+}
+
+/* Helper function. Whether [pos]'s en passant target could have just
+ * double pushed: a pawn of the side not to move, with the two squares
+ * it came over empty. */
+int fen_en_passant_possible(const Position *pos)
+{
+	const int target = pos->en_passant_target;
+	/* One row back toward where the pawn started */
+	const int back = pos->to_move == WHITE_MOVE ? -8 : 8;
+	if (target < 0)
+		return 1;
+	return pos->piece_locations[target] == 
+		   (pos->to_move == WHITE_MOVE ? B_P : W_P) &&
+		   pos->piece_locations[target + back] == EMT &&
+		   pos->piece_locations[target + (2 * back)] == EMT;
+}
+
+FENStatus Game_set_FEN(ChessGame *g, const char *fen)
+{
+	/* Parse into a scratch position, so a bad string leaves
+	 * the game as it was. */
+	Position pos;
+	const char *s = fen;
+	int white_kings = 0;
+	int black_kings = 0;
+	int slashes = 0;
+	int halfmove_clock, fullmove_clock;
+	int i;
+
+	while (*s == ' ')	s++;
+
+	/* Fill board. FEN goes rank 8 to rank 1, which is the
+	 * same order as piece_locations. */
+	i = 0;
+	while (*s != ' '){
+		if (*s == '/'){
+			/* Slash must come exactly at the end of a rank, after
+			 * something's been put on it */
+			if (i != 8 * (slashes + 1) || i == 64)
+				return FEN_BAD_BOARD;
+			slashes++;
+		}
+		else if (*s >= '1' && *s <= '8'){
 			int j;
-			for (j = i; j < i + (c - '0'); j++)
-				g->current_pos->piece_locations[j] = EMT;
-			i = i + (c - '0') - 1;
+			/* Empty squares can't run over into the next rank */
+			if ((i % 8) + (*s - '0') > 8)
+				return FEN_BAD_BOARD;
+			for (j = 0; j < *s - '0'; j++)
+				pos.piece_locations[i++] = EMT;
 		}
 		else {
-			g->current_pos->piece_locations[i] = char_to_piece_map[(int)c];
-			if (c == 'K')
-				g->current_pos->white_kingsrc = i;
-			else if (c == 'k')
-				g->current_pos->black_kingsrc = i;
+			ChessPiece piece = fen_char_to_piece(*s);
+			if (piece == EMT || i >= 64)
+				return FEN_BAD_BOARD;
+			if (piece == W_K){
+				pos.white_kingsrc = i;
+				white_kings++;
+			}
+			else if (piece == B_K){
+				pos.black_kingsrc = i;
+				black_kings++;
+			}
+			pos.piece_locations[i++] = piece;
 		}
+
+		/* Ranks have to be full before the slash/space */
+		if (*(s + 1) == '/' && i % 8 != 0)
+			return FEN_BAD_BOARD;
+		s++;
+		if (*s == '\0')
+			return FEN_BAD_BOARD;
 	}
-	
+	if (i != 64 || slashes != 7 || white_kings != 1 || black_kings != 1 ||
+		!fen_pieces_possible(&pos))
+		return FEN_BAD_BOARD;
+
 	/* Who is to move: either w or b */
-	while((c = getc(fp)) == ' ');
-	if (c == 'w')	g->current_pos->to_move = WHITE_MOVE;
-	else			g->current_pos->to_move = BLACK_MOVE;
+	while (*s == ' ')	s++;
+	if (*s == 'w')		pos.to_move = WHITE_MOVE;
+	else if (*s == 'b')	pos.to_move = BLACK_MOVE;
+	else				return FEN_BAD_TO_MOVE;
+	s++;
+	if (*s != ' ')
+		return FEN_BAD_TO_MOVE;
+
+	/* Castling privileges */
+	pos.castling_rights[0] = NONE;
+	pos.castling_rights[1] = NONE;
+	while (*s == ' ')	s++;
+	if (*s == '-')
+		s++;
+	else {
+		while (*s != ' ' && *s != '\0'){
+			switch(*s){
+				case 'K':
+					pos.castling_rights[0] |= KINGSIDE;
+					break;
+				case 'Q':
+					pos.castling_rights[0] |= QUEENSIDE;
+					break;
+				case 'k':
+					pos.castling_rights[1] |= KINGSIDE;
+					break;
+				case 'q':
+					pos.castling_rights[1] |= QUEENSIDE;
+					break;
+				default:
+					return FEN_BAD_CASTLING;
+			}
+			s++;
+		}
+	}
+	if (*s != ' ')
+		return FEN_BAD_CASTLING;
+
+	/* En passant square. FEN gives the square behind the pawn that
+	 * was double pushed, but en_passant_target is where that pawn 
+	 * is standing now, so go one rank towards the pawn. */
+	pos.en_passant_target = -1;
+	while (*s == ' ')	s++;
+	if (*s == '-')
+		s++;
+	else {
+		const int col = *s - 'a';
+		const int rank = *(s + 1) - '0';
+		if (col < 0 || col > 7)
+			return FEN_BAD_EN_PASSANT;
+		if (rank == 3 && pos.to_move == BLACK_MOVE)
+			pos.en_passant_target = col + (8 * 4);
+		else if (rank == 6 && pos.to_move == WHITE_MOVE)
+			pos.en_passant_target = col + (8 * 3);
+		else
+			return FEN_BAD_EN_PASSANT;
+		s += 2;
+	}
+	if (*s != ' ' && *s != '\0' && *s != '\n' && *s != '\r')
+		return FEN_BAD_EN_PASSANT;
+
+	/* Clocks. EPD lines leave them off (and have operations like
+	 * "bm Nf3;" instead), so only read them if they're there. */
+	halfmove_clock = 0;
+	fullmove_clock = 1;
+	while (*s == ' ')	s++;
+	if (*s >= '0' && *s <= '9'){
+		s = fen_read_number(s, &halfmove_clock);
+		if (s != NULL)
+			s = fen_read_number(s, &fullmove_clock);
+		if (s == NULL || fullmove_clock < 1 || fullmove_clock > 65535 ||
+			halfmove_clock > 65535)
+			return FEN_BAD_CLOCKS;
+	}
+	pos.halfmove_clock = halfmove_clock;
+	pos.fullmove_clock = fullmove_clock;
+
+	if (!fen_castling_possible(&pos))
+		return FEN_BAD_CASTLING;
+	if (!fen_en_passant_possible(&pos))
+		return FEN_BAD_EN_PASSANT;
+
+	/* The side that just moved can't have left its king in check */
+	Position_refresh_sets(&pos);
+	if (pos.attack_counts[(int)pos.to_move][pos.to_move == WHITE_MOVE ?
+						  pos.black_kingsrc : pos.white_kingsrc] != 0)
+		return FEN_BAD_TO_MOVE;
+	g->current_pos = pos;
+	Game_find_all_legal_moves(g);
+	return FEN_OK;
+}
 
+void Game_get_FEN(const ChessGame *g, char *fen)
+{
+	const Position *pos = &g->current_pos;
+	const char *pieces = "KQRNBPkqrnbp";
+	int on_letter = 0;
+	int empties;
+	int r, c;
 
-	/* Default settings to castling/en passant */
-	g->current_pos->castling_rights[0] = NONE;
-	g->current_pos->castling_rights[1] = NONE;
-	g->current_pos->en_passant_target = -1;
+	/* Board */
+	for (r = 0; r < 8; r++){
+		empties = 0;
+		for (c = 0; c < 8; c++){
+			ChessPiece piece = pos->piece_locations[c + (8 * r)];
+			if (piece == EMT)
+				empties++;
+			else {
+				if (empties > 0)
+					fen[on_letter++] = empties + '0';
+				empties = 0;
+				fen[on_letter++] = pieces[piece];
+			}
+		}
+		if (empties > 0)
+			fen[on_letter++] = empties + '0';
+		if (r != 7)
+			fen[on_letter++] = '/';
+	}
 
-	/* Castling Privileges */
-	while((c = getc(fp)) == ' ');
-	while(c != ' '){
-		switch(c){
-			case '-':
-				break;
-			case 'K':
-				g->current_pos->castling_rights[0] += KINGSIDE;
-				break;
-			case 'Q':
-				g->current_pos->castling_rights[0] += QUEENSIDE;
-				break;
-			case 'k':
-				g->current_pos->castling_rights[1] += KINGSIDE;
-				break;
-			case 'q':
-				g->current_pos->castling_rights[1] += QUEENSIDE;
+	/* Who is to move */
+	fen[on_letter++] = ' ';
+	fen[on_letter++] = (pos->to_move == WHITE_MOVE) ? 'w' : 'b';
+
+	/* Castling privileges */
+	fen[on_letter++] = ' ';
+	if (pos->castling_rights[0] == NONE && pos->castling_rights[1] == NONE)
+		fen[on_letter++] = '-';
+	if (pos->castling_rights[0] & KINGSIDE)		fen[on_letter++] = 'K';
+	if (pos->castling_rights[0] & QUEENSIDE)	fen[on_letter++] = 'Q';
+	if (pos->castling_rights[1] & KINGSIDE)		fen[on_letter++] = 'k';
+	if (pos->castling_rights[1] & QUEENSIDE)	fen[on_letter++] = 'q';
+
+	/* En passant square, which is behind the pawn that just moved */
+	fen[on_letter++] = ' ';
+	if (pos->en_passant_target == -1)
+		fen[on_letter++] = '-';
+	else {
+		const int ep_col = pos->en_passant_target % 8;
+		const int ep_row = pos->en_passant_target / 8;
+		const int behind_row = (pos->to_move == WHITE_MOVE) 
+								? ep_row - 1 : ep_row + 1;
+		fen[on_letter++] = ep_col + 'a';
+		fen[on_letter++] = 8 + '0' - behind_row;
+	}
+
+	/* Clocks */
+	sprintf(&fen[on_letter], " %d %d", 
+			pos->halfmove_clock, pos->fullmove_clock);
+}
+
+FENStatus Game_read_FEN(ChessGame *g, const char *filename)
+{
+	FENReader *reader = FENReader_open(filename);
+	FENStatus status;
+	if (reader == NULL)
+		return FEN_NO_FILE;
+
+	status = FENReader_next(reader, g);
+	FENReader_close(reader);
+	return status;
+}
+
+
+
+/****************************
+ *        FEN READER        *
+ ***************************/
+
+/* Chunk of the file read at a time. Big enough that reading a
+ * position basically never waits on a read. */
+#define FEN_READER_BUFSIZE 65536
+/* Anything on a line past this is cut off. Plenty for FEN and the
+ * operations of most EPD lines. */
+#define FEN_READER_LINESIZE 256
+
+struct fen_reader_t {
+	FILE *fp;
+
+	char buffer[FEN_READER_BUFSIZE];
+	/* Next unread char in buffer, and how many chars are in it. */
+	int buffer_pos;
+	int buffer_len;
+
+	char line[FEN_READER_LINESIZE];
+	long line_number;
+};
+
+FENReader *FENReader_open(const char *filename)
+{
+	FENReader *reader;
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL)
+		return NULL;
+
+	reader = (FENReader *)malloc(sizeof(FENReader));
+	reader->fp = fp;
+	reader->buffer_pos = 0;
+	reader->buffer_len = 0;
+	reader->line_number = 0;
+	return reader;
+}
+
+void FENReader_close(FENReader *r)
+{
+	fclose(r->fp);
+	free(r);
+}
+
+long FENReader_line_number(FENReader *r)
+{
+	return r->line_number;
+}
+
+/* Helper function. Copies the next line of the file into r->line
+ * (without the newline). Returns 0 if the file is out of lines. */
+int fen_reader_getline(FENReader *r)
+{
+	int len = 0;
+	int got_any = 0;
+
+	for (;;){
+		char c;
+		if (r->buffer_pos == r->buffer_len){
+			r->buffer_len = fread(r->buffer, 1, FEN_READER_BUFSIZE, r->fp);
+			r->buffer_pos = 0;
+			if (r->buffer_len == 0)
 				break;
-			default:
-				printf("UH OH! FEN parsin issue\n");
 		}
-		c = getc(fp);
-	}
 
+		got_any = 1;
+		c = r->buffer[r->buffer_pos++];
+		if (c == '\n')
+			break;
+		if (c != '\r' && len < FEN_READER_LINESIZE - 1)
+			r->line[len++] = c;
+	}
 
+	r->line[len] = '\0';
+	if (got_any)
+		r->line_number++;
+	return got_any;
+}
 
-	/* En passant square */
-	while((c = getc(fp)) == ' ');
-	if (c != '-'){
-		int col = c - 'a';
-		c = getc(fp);
-		int row = c - '1';
-		g->current_pos->en_passant_target = col + (8 * row);
+FENStatus FENReader_next(FENReader *r, ChessGame *g)
+{
+	while (fen_reader_getline(r)){
+		const char *s = r->line;
+		while (*s == ' ' || *s == '\t')	s++;
+		if (*s != '\0' && *s != '#')
+			return Game_set_FEN(g, s);
 	}
+	return FEN_EOF;
+}
+
+
+
+/****************************
+ *          ARENA           *
+ ***************************/
+
+/* Chunk header, with the chunk's memory right after it. */
+typedef struct arena_chunk_t {
+	struct arena_chunk_t *next;
+	size_t size;
+	size_t used;
+} ArenaChunk;
+
+/* Keeps everything handed out 16-byte aligned */
+#define ARENA_ALIGN(n) (((n) + 15) & ~(size_t)15)
+#define ARENA_DEFAULT_CHUNK 65536
+
+struct arena_t {
+	/* Chunks in use, the one being handed out from first */
+	ArenaChunk *chunks;
+	/* Chunks given back by Arena_reset, ready to be used again */
+	ArenaChunk *spare_chunks;
+	size_t chunk_size;
+};
+
+Arena *Arena_create(size_t chunk_size)
+{
+	Arena *arena = (Arena *)malloc(sizeof(Arena));
+	arena->chunks = NULL;
+	arena->spare_chunks = NULL;
+	arena->chunk_size = (chunk_size > 0) ? chunk_size : ARENA_DEFAULT_CHUNK;
+	return arena;
+}
 
-	/* Halfmove clock */
-	g->current_pos->halfmove_clock = 0;
-	while((c = getc(fp)) == ' ');
-	while(c != ' '){
-		g->current_pos->halfmove_clock *= 10;
-		g->current_pos->halfmove_clock += c - '0';
-		c = getc(fp);
+/* Helper function. Frees every chunk in the list starting at [chunk]. */
+void free_chunks(ArenaChunk *chunk)
+{
+	while (chunk != NULL){
+		ArenaChunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
 	}
+}
+
+void Arena_destroy(Arena *arena)
+{
+	free_chunks(arena->chunks);
+	free_chunks(arena->spare_chunks);
+	free(arena);
+}
 
-	/* Fullmove clock */
-	g->current_pos->fullmove_clock = 0;
-	while((c = getc(fp)) == ' ');
-	while(c != ' ' && c != '\n' && c != EOF){
-		g->current_pos->fullmove_clock *= 10;
-		g->current_pos->fullmove_clock += c - '0';
-		c = getc(fp);
+void *Arena_alloc(Arena *arena, size_t size)
+{
+	const size_t header = ARENA_ALIGN(sizeof(ArenaChunk));
+	ArenaChunk *chunk = arena->chunks;
+	size = ARENA_ALIGN(size);
+
+	if (chunk == NULL || chunk->used + size > chunk->size){
+		/* Need a new chunk. Reuse a spare one if it's big enough,
+		 * otherwise make one (bigger than usual, if need be). */
+		if (arena->spare_chunks != NULL && arena->spare_chunks->size >= size){
+			chunk = arena->spare_chunks;
+			arena->spare_chunks = chunk->next;
+		}
+		else {
+			const size_t chunk_size = (size > arena->chunk_size) 
+									   ? size : arena->chunk_size;
+			chunk = (ArenaChunk *)malloc(header + chunk_size);
+			chunk->size = chunk_size;
+		}
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
 	}
 
-	fclose(fp);
+	chunk->used += size;
+	return (char *)chunk + header + chunk->used - size;
+}
 
-	Game_find_all_legal_moves(g);
+void Arena_reset(Arena *arena)
+{
+	while (arena->chunks != NULL){
+		ArenaChunk *chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		chunk->next = arena->spare_chunks;
+		arena->spare_chunks = chunk;
+	}
 }
 
 
@@ -1017,30 +2214,40 @@ Movie *Movie_create()
 	Movie *movie = (Movie*)malloc(sizeof(Movie));
 	movie->current_turn = 0;
 	movie->length = 0;
+	movie->arena = Arena_create(MOVIE_ARENA_CHUNK);
 
 	return movie;
 }
 
 void Movie_destroy(Movie *m)
 {
-	int i;
-	for (i = 0; i < m->length; i++)
-		Game_destroy(m->games[i]);
+	/* Games all live in the arena */
+	Arena_destroy(m->arena);
 	free(m);
 }
 
-int Movie_add(Movie *movie, ChessGame *game)
+int Movie_add(Movie *movie, const ChessGame *game)
 {
 	if (movie->length < MOVIE_CAPACITY){
-		movie->games[movie->length] = Game_create();
+		movie->games[movie->length] = 
+				(ChessGame *)Arena_alloc(movie->arena, sizeof(ChessGame));
 		Game_copy(game, movie->games[movie->length]);
 		movie->length++;
 		return 1;
 	}
-	printf("Movie capacity reached!\n");
+	/* Movie capacity reached! */
 	return 0;
 }
 
+int Movie_seek(Movie *movie, int turn, ChessGame *target)
+{
+	if (turn < 0 || turn >= movie->length)
+		return 0;
+	movie->current_turn = turn;
+	Game_copy(movie->games[turn], target);
+	return 1;
+}
+
 /* Helper function. Checks through [game]'s moves
  * and returns the index of the move that has the
  * same name as [movename]. If none, returns -1. */
@@ -1056,22 +2263,29 @@ int move_index_from_string(ChessGame *game, char *movename)
 }
 
 
-Movie *Movie_create_from_PGN(char *filename)
+Movie *Movie_create_from_PGN(const char *filename, PGNStatus *status)
 {
 	FILE *fp = fopen(filename, "r");
-	if (fp == NULL){
-		printf("File doesn't exist oh no\n");
-		return NULL;
-	}
-	ChessGame *game = Game_create();
-	Movie *movie    = Movie_create();
+	ChessGame game;
+	MoveTracker tracker;
+	Movie *movie;
 	int c = 0;
 	char current_word[100];
 	int is_move, word_index, move_index;
+	PGNStatus result = PGN_OK;
+
+	if (fp == NULL){
+		if (status != NULL)
+			*status = PGN_NO_FILE;
+		return NULL;
+	}
 
-	Movie_add(movie, game);
+	movie = Movie_create();
+	Game_init(&game);
+	MoveTracker_init(&tracker, &game.current_pos);
+	Movie_add(movie, &game);
 		
-	while (c != EOF)
+	while (c != EOF && result == PGN_OK)
 	{
 		is_move = 1;
 
@@ -1086,7 +2300,8 @@ Movie *Movie_create_from_PGN(char *filename)
 			if (word_index == 0 && c >= '1' && c <= '9')
 				is_move = 0;
 
-			current_word[word_index++] = c;
+			if (word_index < (int)sizeof(current_word) - 1)
+				current_word[word_index++] = c;
 			c = getc(fp);
 		}
 		current_word[word_index] = '\0';
@@ -1094,28 +2309,26 @@ Movie *Movie_create_from_PGN(char *filename)
 
 		if (is_move)
 		{
-			move_index = move_index_from_string(game, &current_word[0]);
+			move_index = move_index_from_string(&game, &current_word[0]);
 			if (move_index == -1){
-				printf("move index not found! Oh no.\n");
-				printf("The halfturn is: %d \n", movie->length);
-				printf("The move is: %s \n", current_word);
-				printf("\n\nHere is each of the available moves:\n");
-				int j;
-				for (j = 0; j < game->num_possible_moves; j++){
-					Move_set_shorttitle(&game->current_possible_moves[j], game);
-					printf("%s\n", game->current_possible_moves[j].title);
-				}
-				return NULL;
+				result = PGN_BAD_MOVE;
+				break;
 			}
 			movie->move_indices[movie->length - 1] = move_index;
-			Game_advanceturn_index(game, move_index);
-			Movie_add(movie, game);
+			Game_advanceturn_tracked(&game, &tracker, 
+									 game.current_possible_moves[move_index]);
+			if (!Movie_add(movie, &game))
+				result = PGN_TOO_LONG;
 		}
 	}
 
 	fclose(fp);
-
-	Game_destroy(game);
+	if (status != NULL)
+		*status = result;
+	if (result != PGN_OK){
+		Movie_destroy(movie);
+		return NULL;
+	}
 	return movie;
 }
 
@@ -1147,7 +2360,7 @@ int main(int argc, char **argv)
 		printf("Here are all possible moves:\n");
 		for (i = 0; i < game->num_possible_moves; i++){
 			temp_move = game->current_possible_moves[i];
-			Move_set_shorttitle(&temp_move, game->current_pos);
+			Move_set_shorttitle(&temp_move, game);
 			printf(" %d : %s \n", i, temp_move.title);
 		}
 
@@ -1,3 +1,16 @@
+#ifndef CHESS_H
+#define CHESS_H
+
+#include <stddef.h>
+
+/* Threads: nothing in here keeps hidden state between calls (the lookup
+ * tables are filled once, safely, and only read after that), so 
+ * different objects can be used from different threads freely. An 
+ * object nobody is changing -- a ChessGame or Position nobody is 
+ * advancing or setting, a Movie nobody is adding to -- can be read by 
+ * any number of threads at once through the functions taking it const.
+ * Arenas and FENReaders belong to one thread at a time. */
+
 #define WHITE_MOVE 0
 #define BLACK_MOVE 1
 
@@ -7,12 +20,17 @@
  * store pointers and just create a new Game for
  * each new move. */
 #define MOVIE_CAPACITY 600
+/* Movies get their games out of an arena, this many bytes at a time */
+#define MOVIE_ARENA_CHUNK (64 * sizeof(ChessGame))
+
+/* Most legal moves any position can have is 218, so this is always
+ * enough for positions Game_set_FEN or play can reach (the move
+ * generator also stops adding at MAX_MOVES, rather than overrun). */
+#define MAX_MOVES 256
 
-/* Looking it up, no real life game has ever had more than
- * 99 moves possible at once so I'd say this is a safe bet.
- * Composed games, however, can go up past 400 possible so
- * if needed expand this to like 450. */
-#define MAX_MOVES 100
+/* Longest FEN string Game_get_FEN can write, null terminator included.
+ * Board is at most 71 chars, the rest is well under 30. */
+#define FEN_MAX_LENGTH 100
 
 /* Simplifying enums */
 enum piece_t {      W_K, W_Q, W_R, W_N, W_B, W_P, /* White pieces */
@@ -24,36 +42,100 @@ typedef enum { NONE, QUEENSIDE, KINGSIDE, BOTH } CastlingRights;
 
 typedef enum { PLAYING, WHITE, BLACK, DRAW } GameCondition;
 
+/* Result of parsing FEN text. FEN_OK if the position was read, otherwise
+ * the field that was malformed or doesn't fit the board (the game is
+ * left untouched). FEN_EOF is only returned by FENReader_next once the
+ * file runs out of lines. */
+typedef enum { FEN_OK, FEN_BAD_BOARD, FEN_BAD_TO_MOVE, FEN_BAD_CASTLING,
+			   FEN_BAD_EN_PASSANT, FEN_BAD_CLOCKS, FEN_NO_FILE, 
+			   FEN_EOF } FENStatus;
+
+/* Result of reading a PGN file into a Movie: PGN_BAD_MOVE if a move 
+ * isn't legal (or isn't written the way Move_set_shorttitle would), 
+ * PGN_TOO_LONG if the game doesn't fit in MOVIE_CAPACITY positions. */
+typedef enum { PGN_OK, PGN_NO_FILE, PGN_BAD_MOVE, PGN_TOO_LONG } PGNStatus;
+
+/* SquareSet: one bit per square, bit i standing for piece_locations[i]
+ * (so bit 0 is a8 and bit 63 is h1). */
+typedef unsigned long long SquareSet;
+
+#define SQUARE_BIT(sq) ((SquareSet)1 << (sq))
+/* Lowest square in a non-empty set, and the number of squares in a set */
+#define SQUARESET_FIRST(set) __builtin_ctzll(set)
+#define SQUARESET_COUNT(set) __builtin_popcountll(set)
+
 /* STRUCTS */
 
 
 /* POSITION struct: holds info on... position, such as who is to
  * move and castling rights, etc. Has all info to start a game from
- * any particular position (except for 3-fold rep, for now). */
+ * any particular position (except for 3-fold rep, for now). 
+ *
+ * Laid out small, since it gets copied and probed a lot: a byte per
+ * square and per bit of state. The board and state take the first two
+ * cache lines along with the color and attack sets, which is all that
+ * move generation and check tests touch; the per-piece sets and the
+ * attack counts come after. */
 typedef struct chess_pos_t {
+	/* Size 64 array of every square and what piece occupies it
+	 * (and EMT if no piece does), a ChessPiece per byte. */
+	unsigned char piece_locations[64];
+
 	/* Who is to move (whose turn it is). Value is WHITE_MOVE if white, 
 	 * BLACK_MOVE if black. */
 	char to_move;
-	/* Castling rights for white and black */
-	CastlingRights castling_rights[2];
-	/* Number of moves since last capture or pawn push. For
-	 * 50-move rule */
-	int halfmove_clock;
-	/* Number of moves that have happened so far */
-	int fullmove_clock;
+	/* Castling rights for white and black, as CastlingRights */
+	unsigned char castling_rights[2];
 	/* Square where pawn was double pushed last, or -1 
 	 * if none. For en passant. */
-	int en_passant_target;
+	signed char en_passant_target;
 	/* Saving king positions for ease with checking check */
-	int white_kingsrc;
-	int black_kingsrc;
-	/* Size 64 array of every square and what piece occupies it
-	 * (and EMT if no piece does). */
-	ChessPiece piece_locations[64];
+	unsigned char white_kingsrc;
+	unsigned char black_kingsrc;
+	/* Number of moves since last capture or pawn push. For
+	 * 50-move rule */
+	unsigned short halfmove_clock;
+	/* Number of moves that have happened so far */
+	unsigned short fullmove_clock;
+
+	/* Where each color's pieces are, and where each kind of piece is.
+	 * Always kept in step with piece_locations, so change the board
+	 * through Position_put_piece. */
+	SquareSet color_sets[2];
+	/* Attack maps: the squares each color attacks (defended pieces
+	 * included), and how many of that color's pieces attack each square.
+	 * Updated a square at a time by Position_put_piece. */
+	SquareSet attacked_sets[2];
+	SquareSet piece_sets[12];
+	/* Zobrist key of just the pawns (which color's pawn is on which
+	 * square), kept in step like the sets, for pawn hash tables. 0
+	 * when there are no pawns. */
+	unsigned long long pawn_key;
+	unsigned char attack_counts[2][64];
 } Position;
 
 
 
+/* POSITIONUNDO struct: what Position_make_move changed, so that
+ * Position_unmake_move can take the move back. */
+typedef struct chess_pos_undo_t {
+	/* Squares the move changed, in order, and what was on them */
+	int num_changes;
+	unsigned char changed_squares[4];
+	unsigned char old_pieces[4];
+
+	/* Everything else, as it was before the move */
+	char to_move;
+	unsigned char castling_rights[2];
+	signed char en_passant_target;
+	unsigned char white_kingsrc;
+	unsigned char black_kingsrc;
+	unsigned short halfmove_clock;
+	unsigned short fullmove_clock;
+} PositionUndo;
+
+
+
 
 /* MOVE struct: describes a move, its source and destination on the
  * board, and promotion details. The piece that is moving is inferred
@@ -75,20 +157,42 @@ typedef struct chess_move_t {
 
 
 
-/* GAME struct: holds position and possible moves. */
+/* GAME struct: holds position and possible moves. Has no pointers, so
+ * it can live anywhere (stack, arena, inside other structs) and be
+ * copied as a block. */
 typedef struct chess_game_t {
-	Position *current_pos;
+	Position current_pos;
 	Move current_possible_moves[MAX_MOVES];
 	/* Needed since we will likely store less than
 	 * MAX_MOVES in the possible moves. */
 	int num_possible_moves;
+	/* Set when the moves above haven't been found for current_pos yet
+	 * (see Game_advanceturn_lazy). Game_ensure_moves fills them in. */
+	int moves_pending;
 } ChessGame;
 
+/* MOVETRACKER struct: for each piece on the board (kings aside), the
+ * squares whose change can change where it can move -- the squares it
+ * attacks, plus a pawn's push squares. Kept up to date move by move, so
+ * only pieces reaching a square a move changed need working out again,
+ * and the rest can be trusted as they were. Indexed like 
+ * piece_locations. */
+typedef struct move_tracker_t {
+	SquareSet reach[64];
+} MoveTracker;
+
+
+/* ARENA: hands out memory from big chunks, and takes all of it back at
+ * once with Arena_reset (which keeps the chunks for reuse) or 
+ * Arena_destroy. For bulk users that make lots of games at a time. */
+typedef struct arena_t Arena;
 
 /* MOVIE struct: contains a collection of ChessGames,
  * one for each half-move, in an arraylist-esque way. */
 typedef struct chess_movie_t {
+	/* Games are allocated out of [arena] */
 	ChessGame *games[MOVIE_CAPACITY];
+	Arena *arena;
 	int move_indices[MOVIE_CAPACITY];
 	int current_turn;
 	int length;
@@ -107,17 +211,36 @@ typedef struct chess_movie_t {
 /* Allocate new position in memory. For now: set beginning position
  * to beginning chess game position (it sounds sensible). */
 Position *Position_create();
+/* Same, but sets up a position that's already been allocated. */
+void Position_init(Position *p);
 
 /* Frees the position from the heap. */
 void Position_destroy(Position *p);
 
+/* Puts [piece] (or EMT) on square [sq], replacing whatever was there,
+ * and updates the square sets and attack maps to match. Only the pieces
+ * whose attacks go through [sq] are looked at. */
+void Position_put_piece(Position *p, int sq, ChessPiece piece);
+
+/* Rebuilds the square sets and attack maps from piece_locations, for
+ * when the board was filled in directly. */
+void Position_refresh_sets(Position *p);
+
 /* Returns true (1) if square at column [col], row [row] is attacked
- * by the opposite color piece, else false (0). */
-int Position_is_attacked(Position *p, int col, int row);
+ * by the opposite color piece, else false (0). Just a lookup in the
+ * attack maps. */
+int Position_is_attacked(const Position *p, int col, int row);
 
 /* Returns true (1) if the player to move is in check in this 
  * position, else false (0). */
-int Position_in_check(Position *p);
+int Position_in_check(const Position *p);
+
+/* Plays [move] on the position (no legality checks) and fills [undo]
+ * with what Position_unmake_move needs to take it back. Doesn't touch
+ * any list of legal moves, so it's the cheap way in and out of a 
+ * position. */
+void Position_make_move(Position *p, Move move, PositionUndo *undo);
+void Position_unmake_move(Position *p, PositionUndo *undo);
 
 
 
@@ -126,11 +249,13 @@ int Position_in_check(Position *p);
 /* Move functions */
 
 /* Set the "title" field of [move] given chess position [pos]. 
- * Short title means a short PGN title like "Nc3" or something. */
-void Move_set_shorttitle(Move *move, ChessGame *game);
+ * Short title means a short PGN title like "Nc3" or something. 
+ * [game]'s legal moves have to be found (not pending), they're used to
+ * tell apart two pieces that could both make the move. */
+void Move_set_shorttitle(Move *move, const ChessGame *game);
 
 /* Returns true (1) if move is a capture, else false (0) */
-int Move_is_capture(Move move, Position *pos);
+int Move_is_capture(Move move, const Position *pos);
 
 /* Returns 1 if move is kingside castle, 2 if move is queenside castle,
  * 0 if no castle. Assumes that move is with the king. */
@@ -146,6 +271,12 @@ int Move_castle_type(Move move);
 
 /* Creates a ChessGame on heap at default starting move. */
 ChessGame *Game_create();
+/* Same, but allocated out of [arena], so not to be Game_destroyed. */
+ChessGame *Game_create_in(Arena *arena);
+/* Sets up a ChessGame the caller already has storage for (like one on
+ * the stack) at the starting move. A game that's about to be filled by
+ * Game_copy doesn't need this. */
+void Game_init(ChessGame *g);
 /* Frees Game memory */
 void Game_destroy(ChessGame *g);
 
@@ -155,29 +286,117 @@ void Game_alter_position(ChessGame *g, Move altering_move);
 
 /* Function to grab piece at row and column without typing up a crazy
  * expression */
-ChessPiece Game_pieceat(ChessGame *g, int row, int col);
+ChessPiece Game_pieceat(const ChessGame *g, int row, int col);
 
 /* Finds all the legal moves in the game at the given position, and
  * stores them in the ChessGame's current_possible_moves array. */
 void Game_find_all_legal_moves(ChessGame *g);
 
+/* Counts the legal moves in the game's position without generating
+ * them (or touching current_possible_moves), using the square sets and
+ * attack maps. Matches what Game_find_all_legal_moves finds for any
+ * legal position. */
+int Game_count_legal_moves(const ChessGame *g);
+/* Same, but also fills [counts] with how many legal moves the piece on
+ * each square has (0 for squares without a piece of the mover's). */
+int Game_count_piece_moves(const ChessGame *g, int counts[64]);
+/* True (1) if the side to move has any legal move at all. Stops at the
+ * first one it finds. */
+int Game_has_legal_move(const ChessGame *g);
+/* Finds the legal moves if Game_advanceturn_lazy put that off. */
+void Game_ensure_moves(ChessGame *g);
+
 /* Returns the index of the legal move that is equal to [m], or
  * -1 if it does not exist (i.e. illegal move) */
 int Game_get_legal(ChessGame *g, Move m);
 
 /* Copies ChessGame [src] into [target]. */
-void Game_copy(ChessGame *src, ChessGame *target);
+void Game_copy(const ChessGame *src, ChessGame *target);
 
 /* Advances a turn in the game with requested move. Also refills legal
  * moves and returns if the game is over or not. */
 GameCondition Game_advanceturn(ChessGame *g, Move m);
 GameCondition Game_advanceturn_index(ChessGame *g, int move_index);
-
-/* Parse file with FEN data and edit game accordingly.
- * Precondition: file is in proper FEN form. If it's not then
- * there's no protection against it and the board will probs be
- * invalid or exhibit undefined behavior. */
-void Game_read_FEN(ChessGame *g, char *filename);
+/* Same as Game_advanceturn, but only checks that some legal move exists
+ * instead of finding them all. The move list is left pending: call
+ * Game_ensure_moves before reading current_possible_moves (
+ * Game_advanceturn_index and Game_get_legal do this themselves). */
+GameCondition Game_advanceturn_lazy(ChessGame *g, Move m);
+/* Whether the game is over in [g]'s position as it stands, the same
+ * way Game_advanceturn would say after moving into it. For positions
+ * that weren't reached by a move, e.g. ones just read from FEN. */
+GameCondition Game_condition(const ChessGame *g);
+
+/* Incremental mode, for walking forward through a game one move at a
+ * time. MoveTracker_init starts [t] off at [p]; MoveTracker_update 
+ * brings it up to date after Position_make_move, given the move's 
+ * [undo]. Game_advanceturn_tracked does both and refills the legal 
+ * moves from [t], in the same order as Game_find_all_legal_moves. */
+void MoveTracker_init(MoveTracker *t, const Position *p);
+void MoveTracker_update(MoveTracker *t, const Position *p, 
+						 const PositionUndo *undo);
+GameCondition Game_advanceturn_tracked(ChessGame *g, MoveTracker *t, Move m);
+/* Number of legal replies there would be to move [m] in [g], without
+ * changing [g]. [t] has to be up to date with [g]: pieces [m] doesn't 
+ * touch reuse what [t] has, so scoring every move of a position this 
+ * way shares most of the work between them. */
+int Game_count_replies(const ChessGame *g, const MoveTracker *t, Move m);
+
+/* Parse the first line of file [filename] as FEN and edit game
+ * accordingly. Returns FEN_NO_FILE if the file can't be opened, otherwise
+ * the same status as Game_set_FEN. */
+FENStatus Game_read_FEN(ChessGame *g, const char *filename);
+
+/* Sets the game to the position described by FEN string [fen] and
+ * refills the legal moves. The halfmove and fullmove clocks may be left
+ * off (EPD style), in which case they default to 0 and 1, and anything
+ * after them is ignored. On any status other than FEN_OK the game is
+ * not modified.
+ *
+ * Positions no game could reach are turned down too, so the move 
+ * generator never sees them: pawns on the first or last rank or more
+ * pieces than promotions could make (FEN_BAD_BOARD), the side not to
+ * move in check (FEN_BAD_TO_MOVE), castling rights without the king
+ * and rook at home (FEN_BAD_CASTLING), and an en passant square with
+ * no pawn that could have just double pushed (FEN_BAD_EN_PASSANT). */
+FENStatus Game_set_FEN(ChessGame *g, const char *fen);
+
+/* Writes the FEN string of the game's position into [fen], which must
+ * hold at least FEN_MAX_LENGTH chars. */
+void Game_get_FEN(const ChessGame *g, char *fen);
+
+
+
+/* FENReader: reads one FEN/EPD position per line out of a big file,
+ * through its own buffer, so bulk tools don't have to open a file per
+ * position. Blank lines and lines starting with '#' are skipped. */
+typedef struct fen_reader_t FENReader;
+
+/* Returns NULL if the file can't be opened. */
+FENReader *FENReader_open(const char *filename);
+void FENReader_close(FENReader *r);
+
+/* Reads the next line of the file into [g]. Returns FEN_EOF when there
+ * are no lines left, otherwise the status of Game_set_FEN on that line
+ * (so a bad line can be reported and skipped). */
+FENStatus FENReader_next(FENReader *r, ChessGame *g);
+
+/* Line number (starting at 1) of the line last read by FENReader_next. */
+long FENReader_line_number(FENReader *r);
+
+
+
+/* Arena Functions */
+
+/* [chunk_size] is how many bytes to grab from malloc at a time,
+ * or 0 for a default. */
+Arena *Arena_create(size_t chunk_size);
+void Arena_destroy(Arena *arena);
+/* Returns [size] bytes, 16-byte aligned. Never fails short of malloc
+ * failing. */
+void *Arena_alloc(Arena *arena, size_t size);
+/* Frees everything allocated out of the arena in one go. */
+void Arena_reset(Arena *arena);
 
 
 
@@ -188,15 +407,22 @@ void Movie_destroy(Movie *m);
 
 /* Adds a copy of [game] to the movie list.
  * Returns 1 if successful, else 0. */
-int Movie_add(Movie *movie, ChessGame *game);
+int Movie_add(Movie *movie, const ChessGame *game);
+
+/* Makes [turn] (0 for the start) the movie's current turn and copies
+ * its game into [target]. Every turn is stored, so nothing gets 
+ * replayed: it's the same cost for any turn. Returns 0 (and does 
+ * nothing) if the movie has no such turn. */
+int Movie_seek(Movie *movie, int turn, ChessGame *target);
 
 /* Parses the PGN file from [filename] and 
  * fills up a new movie object with its positions. 
  * Cannot include comments or before tags, for now,
  * so remove those if copy-pasting from online. Also
  * does not work (for now) with move annotations like
- * ! and ?. */
-Movie *Movie_create_from_PGN(char *filename);
+ * ! and ?. Returns NULL if it can't, with the reason in
+ * [status] (which can be NULL if the caller doesn't care). */
+Movie *Movie_create_from_PGN(const char *filename, PGNStatus *status);
 
 
 
@@ -209,3 +435,5 @@ Movie *Movie_create_from_PGN(char *filename);
 
 /* Converts to and from PGN-style square like "e4" */
 int pgn_to_rowcol(char *pgn);
+
+#endif
@@ -1,32 +1,102 @@
+#define _POSIX_C_SOURCE 199309L
 #include "chess_bot.h"
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-/* For some reason, rand() does... the same thing every time? >:( 
- * So here's some strange mix with rand and the unix time */
-int rando(){
-	/* "seed" rand */
-	srand(time(NULL));
-	return rand();
+/* Each bot has its own random numbers, from a PCG32 generator (see
+ * pcg-random.org): 64 bits of state, a permuted 32-bit output. Same seed,
+ * same numbers, on any machine. */
+#define PCG_MULTIPLIER 6364136223846793005ULL
+
+unsigned int ChessBot_random(ChessBot *bot)
+{
+	const unsigned long long old = bot->rng_state;
+	const unsigned int xorshifted = (unsigned int)(((old >> 18) ^ old) >> 27);
+	const unsigned int rot = (unsigned int)(old >> 59);
+
+	bot->rng_state = (old * PCG_MULTIPLIER) + bot->rng_inc;
+	return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+void ChessBot_seed(ChessBot *bot, unsigned long long seed)
+{
+	bot->seed = seed;
+	/* Each color gets its own stream, so two bots seeded alike still
+	 * play differently */
+	bot->rng_inc = ((unsigned long long)bot->color << 1) | 1;
+	bot->rng_state = 0;
+	ChessBot_random(bot);
+	bot->rng_state += seed;
+	ChessBot_random(bot);
 }
 
-ChessBot *ChessBot_create(ChessGame *game, BotAlgo algo, char color)
+ChessBot *ChessBot_create(ChessGame *game, BotAlgo algo, char color,
+						  unsigned long long seed)
 {
 	ChessBot *cb_local = (ChessBot *) malloc(sizeof(ChessBot));
 
 	cb_local->game = game;
 	cb_local->algo_type = algo;
 	cb_local->color = color;
+	ChessBot_seed(cb_local, seed);
+	ChessBot_set_search(cb_local, SEARCH_ALL, SEARCH_DEFAULT_DEPTH,
+						SEARCH_DEFAULT_TIME_MS);
+	cb_local->net = NULL;
+	cb_local->pawns = NULL;
+	cb_local->stop = 0;
 
 	return cb_local;
 }
 
 void ChessBot_destroy(ChessBot *bot)
 {
+	free(bot->pawns);
 	free(bot);
 }
 
+void ChessBot_set_search(ChessBot *bot, int features, int depth, 
+						 long time_ms)
+{
+	bot->search_features = features;
+	bot->search_depth = depth;
+	bot->search_time_ms = time_ms;
+	memset(&bot->last_search, 0, sizeof(SearchStats));
+}
+
+void ChessBot_set_net(ChessBot *bot, const NNUE *net)
+{
+	bot->net = net;
+}
+
+int ChessBot_search_features(const char *names)
+{
+	const char *feature_names[] = { "pvs", "aspiration", "null", "lmr", 
+									"futility" };
+	int features = 0;
+	int i, length;
+
+	while (*names){
+		length = strcspn(names, ",");
+		if (length == 3 && strncmp(names, "all", 3) == 0)
+			features |= SEARCH_ALL;
+		else if (!(length == 4 && strncmp(names, "none", 4) == 0)){
+			for (i = 0; i < 5; i++)
+				if ((int)strlen(feature_names[i]) == length &&
+					strncmp(names, feature_names[i], length) == 0)
+					break;
+			if (i == 5)
+				return -1;
+			features |= 1 << i;
+		}
+		names += length;
+		if (*names == ',')
+			names++;
+	}
+	return features;
+}
+
 Move ChessBot_find_next_move(ChessBot *bot)
 {
 	/* Will be finding index, and then indexing in the legal
@@ -35,55 +105,704 @@ Move ChessBot_find_next_move(ChessBot *bot)
 	
 	switch(bot->algo_type){
 		case RANDOM_MOVE:
-			move_index = rando() % (bot->game->num_possible_moves);
+			move_index = ChessBot_random(bot) % (bot->game->num_possible_moves);
 			break;
 		case MIN_OPPT_MOVES:
-			move_index = ChessBot_position_eval(bot, &min_oppt_moves_eval);
+			move_index = ChessBot_batch_eval(bot, &min_oppt_moves_batch);
+			break;
+		case ALPHA_BETA:
+			move_index = ChessBot_search(bot);
 			break;
 	}
 
 	return bot->game->current_possible_moves[move_index];
 }
 
-int ChessBot_position_eval(ChessBot *bot, int (*eval_game)(ChessGame *g))
+/* Helper function. Index of the best of the [n] scores, ties broken
+ * at random. */
+int pick_best(ChessBot *bot, const int *scores, int n)
 {
-	ChessGame *game_copy = Game_create();
-
 	long max_score = LONG_MIN;
 	int max_index = 0;
-	int current_score;
 
 	int i;
-	for (i = 0; i < bot->game->num_possible_moves; i++){
-		Game_copy(bot->game, game_copy);
-		Game_advanceturn_index(game_copy, i);
-
-		current_score = (*eval_game)(game_copy);
-
-		if (current_score > max_score){
-			max_score = current_score;
+	for (i = 0; i < n; i++){
+		if (scores[i] > max_score){
+			max_score = scores[i];
 			max_index = i;
 		}
-		else if (current_score == max_score){
+		else if (scores[i] == max_score){
 			/* Randomize if they are swapped or not.
 			 * Spices things up. */
-			const int swapped = rando() % 2;
+			const int swapped = ChessBot_random(bot) % 2;
 			if (swapped == 1){
-				max_score = current_score;
+				max_score = scores[i];
 				max_index = i;
 			}
 		}
 	}
 
-	Game_destroy(game_copy);
 	return max_index;
 }
 
+int ChessBot_position_eval(ChessBot *bot, int (*eval_game)(ChessGame *g))
+{
+	/* Scratch game for the children. Only the position gets copied in;
+	 * the move list is left pending, like Game_advanceturn_lazy. */
+	ChessGame game_copy;
+	int scores[MAX_MOVES];
+
+	int i;
+	for (i = 0; i < bot->game->num_possible_moves; i++){
+		game_copy.current_pos = bot->game->current_pos;
+		game_copy.moves_pending = 1;
+		Game_alter_position(&game_copy, bot->game->current_possible_moves[i]);
+
+		scores[i] = (*eval_game)(&game_copy);
+	}
+
+	return pick_best(bot, scores, bot->game->num_possible_moves);
+}
+
+int ChessBot_batch_eval(ChessBot *bot, BatchEval eval)
+{
+	int scores[MAX_MOVES];
+	(*eval)(bot->game, scores);
+	return pick_best(bot, scores, bot->game->num_possible_moves);
+}
+
 
 /* SPECIFIC BOTS */
 
 int min_oppt_moves_eval(ChessGame *g)
 {
-	return -1 * g->num_possible_moves;
+	return -1 * Game_count_legal_moves(g);
+}
+
+void min_oppt_moves_batch(const ChessGame *g, int *scores)
+{
+	/* Worked out once for all the children: where every piece reaches.
+	 * Each child only redoes the pieces its move touched. */
+	MoveTracker tracker;
+	int i;
+
+	MoveTracker_init(&tracker, &g->current_pos);
+	for (i = 0; i < g->num_possible_moves; i++)
+		scores[i] = -1 * Game_count_replies(g, &tracker, 
+											g->current_possible_moves[i]);
+}
+
+/* piece_values, pst, king_endgame_pst and the pawn structure terms */
+#include "eval_params.h"
+
+/* Non-pawn material (both sides) at or below which it's an endgame */
+#define ENDGAME_MATERIAL 1300
+
+/* Entries in a pawn hash table, a power of 2 */
+#define PAWN_TABLE_SIZE 8192
+
+/* The pawn structure for one pawn_key: its score for white, and the
+ * passed pawns */
+typedef struct pawn_entry_t {
+	unsigned long long key;
+	SquareSet passed[2];
+	int score;
+} PawnEntry;
+
+/* Indexed by the low bits of the key, newest entry kept. Starts out
+ * zeroed, which happens to be right for the key of no pawns at all. */
+struct pawn_table_t {
+	PawnEntry entries[PAWN_TABLE_SIZE];
+	long probes;
+	long hits;
+};
+
+/* Helper function. Score for white of pawn structure [ps]. */
+int pawn_structure_score(const PawnStructure *ps)
+{
+	int score[2] = { 0, 0 };
+	int color, rank;
+
+	for (color = 0; color < 2; color++){
+		score[color] = ps->doubled[color] * pawn_doubled
+					   + ps->isolated[color] * pawn_isolated
+					   + ps->backward[color] * pawn_backward;
+		for (rank = 0; rank < 8; rank++)
+			score[color] += ps->passed_by_rank[color][rank] 
+							* passed_pawn[rank];
+	}
+	return score[WHITE_MOVE] - score[BLACK_MOVE];
+}
+
+/* Helper function. [p]'s pawn structure, out of [table] if it's there
+ * and worked out (and kept there) if not. With no table, it's always
+ * worked out, into [scratch]. */
+const PawnEntry *probe_pawns(PawnTable *table, const Position *p,
+							 PawnEntry *scratch)
+{
+	PawnStructure ps;
+	PawnEntry *entry = scratch;
+
+	if (table != NULL){
+		entry = &table->entries[p->pawn_key & (PAWN_TABLE_SIZE - 1)];
+		table->probes++;
+		if (entry->key == p->pawn_key){
+			table->hits++;
+			return entry;
+		}
+	}
+
+	PawnStructure_find(&ps, p->piece_sets[W_P], p->piece_sets[B_P]);
+	entry->key = p->pawn_key;
+	entry->passed[WHITE_MOVE] = ps.passed[WHITE_MOVE];
+	entry->passed[BLACK_MOVE] = ps.passed[BLACK_MOVE];
+	entry->score = pawn_structure_score(&ps);
+	return entry;
+}
+
+/* Helper function. pst_eval, with the pawn structure out of [pawns]
+ * (NULL for none). */
+int pst_eval_with(const Position *p, PawnTable *pawns)
+{
+	PawnEntry scratch;
+	int score[2] = { 0, 0 };
+	int material = 0;
+	int pawn_score;
+	SquareSet pieces = p->color_sets[0] | p->color_sets[1];
+
+	while (pieces){
+		const int sq = SQUARESET_FIRST(pieces);
+		const ChessPiece piece = p->piece_locations[sq];
+		const int color = piece / 6;
+		pieces &= pieces - 1;
+
+		score[color] += piece_values[piece % 6] 
+					  + pst[piece % 6][color == WHITE_MOVE ? sq : sq ^ 56];
+		if (piece % 6 != W_P)
+			material += piece_values[piece % 6];
+	}
+
+	if (material <= ENDGAME_MATERIAL){
+		const int w_king = p->white_kingsrc;
+		const int b_king = p->black_kingsrc ^ 56;
+		score[0] += king_endgame_pst[w_king] - pst[W_K][w_king];
+		score[1] += king_endgame_pst[b_king] - pst[W_K][b_king];
+	}
+
+	pawn_score = probe_pawns(pawns, p, &scratch)->score;
+	score[0] += pawn_score;
+	return score[(int)p->to_move] - score[1 - p->to_move];
+}
+
+int pst_eval(const Position *p)
+{
+	return pst_eval_with(p, NULL);
 }
 
+
+
+/* SEARCH */
+
+#define MATE_SCORE 30000
+/* Scores past this are mates, some number of plies away */
+#define MATE_BOUND (MATE_SCORE - SEARCH_MAX_PLY)
+#define INFINITE_SCORE 32000
+
+/* Half-width of the first aspiration window. It doubles each time the
+ * score falls outside, and gives up past ASPIRATION_MAX. */
+#define ASPIRATION_WINDOW 50
+#define ASPIRATION_MAX 800
+/* Null move needs at least this much depth left */
+#define NULL_MOVE_DEPTH 3
+/* Late move reductions: only with this much depth left, and only after
+ * this many moves have been searched in full */
+#define LMR_DEPTH 3
+#define LMR_MOVES 3
+/* How far below alpha a quiet move at depth 1 (2) has to leave the 
+ * eval to be skipped */
+const int futility_margins[3] = { 0, 200, 500 };
+/* The clock is looked at every this many nodes (a power of 2) */
+#define CLOCK_NODES 1024
+
+/* Move ordering scores, highest first */
+#define ORDER_PV      (1 << 24)
+#define ORDER_CAPTURE (1 << 20)
+#define ORDER_KILLER  (1 << 19)
+/* History scores are kept under this (well below ORDER_KILLER, so they
+ * never sort ahead of killers or captures) by halving them all whenever
+ * one gets past it */
+#define HISTORY_MAX   (1 << 16)
+
+/* Everything one search works on. Big, so it lives on the heap. */
+typedef struct search_t {
+	int features;
+	/* One game per ply: the position there and its moves */
+	ChessGame games[SEARCH_MAX_PLY + 1];
+	/* The net to evaluate with (NULL for pst_eval), and its 
+	 * accumulators for each ply's position */
+	const NNUE *net;
+	NNUEAccumulator accs[SEARCH_MAX_PLY + 1];
+	/* The bot's pawn hash table */
+	PawnTable *pawns;
+
+	/* Best line found from each ply (pv[ply][ply] onward, up to 
+	 * pv_length[ply]), and the one from the last finished iteration,
+	 * which the next one tries first */
+	Move pv[SEARCH_MAX_PLY][SEARCH_MAX_PLY];
+	int pv_length[SEARCH_MAX_PLY];
+	Move prev_pv[SEARCH_MAX_PLY];
+	int prev_pv_length;
+
+	/* Quiet moves that caused cutoffs: two per ply, and how much by
+	 * mover and squares overall */
+	Move killers[SEARCH_MAX_PLY][2];
+	int history[2][64][64];
+
+	/* Depth of the iteration going on */
+	int root_depth;
+
+	long nodes;
+	double deadline;
+	/* The bot's stop flag */
+	volatile int *stop;
+	/* Set once the first iteration is done, after which running out
+	 * of time or being told to stop stops the search */
+	int can_stop;
+	int stopped;
+} Search;
+
+/* Helper function. Monotonic time in ms. */
+double search_clock_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e3) + (ts.tv_nsec / 1e6);
+}
+
+/* Helper function. Counts a node, and stops the search if it's out of
+ * time or was told to stop. Returns whether the search is stopped. */
+int search_tick(Search *s)
+{
+	s->nodes++;
+	if ((s->nodes & (CLOCK_NODES - 1)) == 0 && s->can_stop && 
+		(*s->stop || (s->deadline > 0 && search_clock_ms() > s->deadline)))
+		s->stopped = 1;
+	return s->stopped;
+}
+
+/* Helper function. Same move, title aside. */
+int same_move(Move a, Move b)
+{
+	return a.src == b.src && a.dest == b.dest && 
+		   a.promoting_to == b.promoting_to;
+}
+
+/* Helper function. True if [m] changes no material. */
+int is_quiet(Move m, const Position *p)
+{
+	return !Move_is_capture(m, p) && m.promoting_to == EMT;
+}
+
+/* Helper function. True if the position at [ply] already came up on
+ * the way here, since the last capture or pawn move. */
+int repeats(const Search *s, int ply)
+{
+	const Position *p = &s->games[ply].current_pos;
+	int i;
+	for (i = ply - 2; i >= 0 && i >= ply - p->halfmove_clock; i -= 2){
+		const Position *old = &s->games[i].current_pos;
+		if (old->to_move == p->to_move && 
+			memcmp(old->piece_locations, p->piece_locations, 64) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* Helper function. True if the side to move has something besides
+ * pawns and king: without that, zugzwang makes null moves unsafe. */
+int has_pieces(const Position *p)
+{
+	const int c = 6 * p->to_move;
+	return (p->piece_sets[W_Q + c] | p->piece_sets[W_R + c] | 
+			p->piece_sets[W_N + c] | p->piece_sets[W_B + c]) != 0;
+}
+
+/* Helper function. Fills [order] with how promising each of [g]'s 
+ * moves looks at [ply]: last iteration's best move, then captures
+ * (most valuable victim, then least valuable attacker), killers, and
+ * the rest by history. */
+void order_moves(const Search *s, const ChessGame *g, int ply, int *order)
+{
+	const Position *p = &g->current_pos;
+	int i;
+	for (i = 0; i < g->num_possible_moves; i++){
+		const Move m = g->current_possible_moves[i];
+		const int attacker = p->piece_locations[m.src] % 6;
+
+		if (ply < s->prev_pv_length && same_move(m, s->prev_pv[ply]))
+			order[i] = ORDER_PV;
+		else if (!is_quiet(m, p)){
+			const int victim = m.is_en_passant ? W_P :
+							   p->piece_locations[m.dest] % 6;
+			order[i] = ORDER_CAPTURE - piece_values[attacker] / 10;
+			if (p->piece_locations[m.dest] != EMT || m.is_en_passant)
+				order[i] += 8 * piece_values[victim];
+			if (m.promoting_to != EMT)
+				order[i] += 8 * piece_values[m.promoting_to % 6];
+		}
+		else if (same_move(m, s->killers[ply][0]))
+			order[i] = ORDER_KILLER + 1;
+		else if (same_move(m, s->killers[ply][1]))
+			order[i] = ORDER_KILLER;
+		else
+			order[i] = s->history[(int)p->to_move][m.src][m.dest];
+	}
+}
+
+/* Helper function. Swaps the most promising move from [i] on into
+ * place [i] and returns it. */
+Move next_move(ChessGame *g, int *order, int i)
+{
+	int best = i;
+	int j;
+	Move m;
+	for (j = i + 1; j < g->num_possible_moves; j++)
+		if (order[j] > order[best])
+			best = j;
+
+	m = g->current_possible_moves[best];
+	g->current_possible_moves[best] = g->current_possible_moves[i];
+	g->current_possible_moves[i] = m;
+	j = order[best];
+	order[best] = order[i];
+	order[i] = j;
+	return m;
+}
+
+/* Helper function. [m] was best at [ply]: puts it in front of the 
+ * line found after it. */
+void update_pv(Search *s, int ply, Move m)
+{
+	int i;
+	s->pv[ply][ply] = m;
+	for (i = ply + 1; i < s->pv_length[ply + 1]; i++)
+		s->pv[ply][i] = s->pv[ply + 1][i];
+	s->pv_length[ply] = s->pv_length[ply + 1] > ply + 1 ? 
+						s->pv_length[ply + 1] : ply + 1;
+}
+
+/* Helper function. The eval of the position at [ply]. */
+int evaluate(const Search *s, int ply)
+{
+	const Position *p = &s->games[ply].current_pos;
+	if (s->net != NULL)
+		return NNUE_evaluate(s->net, &s->accs[ply], p->to_move);
+	return pst_eval_with(p, s->pawns);
+}
+
+/* Helper function. Sets up the next ply's game with [m] played. */
+ChessGame *play_move(Search *s, int ply, Move m)
+{
+	ChessGame *child = &s->games[ply + 1];
+	PositionUndo undo;
+	child->current_pos = s->games[ply].current_pos;
+	Position_make_move(&child->current_pos, m, &undo);
+	if (s->net != NULL)
+		NNUE_update(s->net, &s->accs[ply], &child->current_pos, &undo,
+					&s->accs[ply + 1]);
+	return child;
+}
+
+/* Helper function. Quiescence search: only captures and promotions 
+ * (all moves when in check), so that the eval isn't taken in the 
+ * middle of an exchange. */
+int quiesce(Search *s, int ply, int alpha, int beta)
+{
+	ChessGame *g = &s->games[ply];
+	const Position *p = &g->current_pos;
+	const int in_check = Position_in_check(p);
+	int order[MAX_MOVES];
+	int best = -INFINITE_SCORE;
+	int score, i;
+
+	s->pv_length[ply] = ply;
+	if (search_tick(s))
+		return 0;
+	if (ply >= SEARCH_MAX_PLY - 1)
+		return evaluate(s, ply);
+
+	if (!in_check){
+		best = evaluate(s, ply);
+		if (best >= beta)
+			return best;
+		if (best > alpha)
+			alpha = best;
+	}
+
+	Game_find_all_legal_moves(g);
+	if (in_check && g->num_possible_moves == 0)
+		return -MATE_SCORE + ply;
+
+	order_moves(s, g, ply, order);
+	for (i = 0; i < g->num_possible_moves; i++){
+		const Move m = next_move(g, order, i);
+		if (!in_check && is_quiet(m, p))
+			continue;
+
+		play_move(s, ply, m);
+		score = -quiesce(s, ply + 1, -beta, -alpha);
+		if (s->stopped)
+			return 0;
+
+		if (score > best){
+			best = score;
+			if (score > alpha){
+				alpha = score;
+				if (score >= beta)
+					break;
+			}
+		}
+	}
+	return best;
+}
+
+/* Helper function. Adds [bonus] to the history score of [m] played by
+ * [side], halving every score if that takes it past HISTORY_MAX. */
+void add_history(Search *s, int side, Move m, int bonus)
+{
+	int *h = &s->history[0][0][0];
+	int i;
+
+	s->history[side][m.src][m.dest] += bonus;
+	if (s->history[side][m.src][m.dest] <= HISTORY_MAX)
+		return;
+	for (i = 0; i < 2 * 64 * 64; i++)
+		h[i] /= 2;
+}
+
+/* Helper function. Negamax alpha-beta from [ply], [depth] plies deep,
+ * with whichever SEARCH_ features are on. Fail-soft: the score can be
+ * outside [alpha, beta]. [null_ok] is 0 right after a null move, so
+ * there aren't two in a row. */
+int search_node(Search *s, int ply, int depth, int alpha, int beta, 
+				int null_ok)
+{
+	ChessGame *g = &s->games[ply];
+	const Position *p = &g->current_pos;
+	int order[MAX_MOVES];
+	int in_check, static_eval, futile;
+	PawnEntry scratch;
+	SquareSet passed;
+	int best = -INFINITE_SCORE;
+	int searched = 0;
+	int score, i;
+
+	if (depth <= 0)
+		return quiesce(s, ply, alpha, beta);
+
+	s->pv_length[ply] = ply;
+	if (search_tick(s))
+		return 0;
+	if (ply > 0 && (p->halfmove_clock >= 50 || repeats(s, ply)))
+		return 0;
+	if (ply >= SEARCH_MAX_PLY - 1)
+		return evaluate(s, ply);
+
+	Game_find_all_legal_moves(g);
+	in_check = Position_in_check(p);
+	if (g->num_possible_moves == 0)
+		return in_check ? -MATE_SCORE + ply : 0;
+	/* Look one further past checks, so they're never cut short (but
+	 * not forever, down lines of endless checks) */
+	if (in_check && ply < 2 * s->root_depth)
+		depth++;
+
+	static_eval = evaluate(s, ply);
+
+	/* Null move: if passing still leaves us at or above beta after a 
+	 * shallower search, a real move would too. */
+	if ((s->features & SEARCH_NULL_MOVE) && null_ok && ply > 0 && 
+		!in_check && depth >= NULL_MOVE_DEPTH && static_eval >= beta && 
+		has_pieces(p)){
+		const int reduction = depth > 6 ? 3 : 2;
+		ChessGame *child = &s->games[ply + 1];
+		child->current_pos = *p;
+		child->current_pos.to_move = 1 - p->to_move;
+		child->current_pos.en_passant_target = -1;
+		if (s->net != NULL)
+			s->accs[ply + 1] = s->accs[ply];
+
+		score = -search_node(s, ply + 1, depth - 1 - reduction, 
+							 -beta, -beta + 1, 0);
+		if (s->stopped)
+			return 0;
+		if (score >= beta)
+			return score >= MATE_BOUND ? beta : score;
+	}
+
+	/* Futility: this close to the leaves, a quiet move can't bring the
+	 * eval up by much */
+	futile = (s->features & SEARCH_FUTILITY) && ply > 0 && !in_check && 
+			 depth <= 2 && alpha > -MATE_BOUND && alpha < MATE_BOUND &&
+			 static_eval + futility_margins[depth] <= alpha;
+
+	/* Passed pawns aren't pushed any less deeply by LMR: the pawn hash
+	 * table has them, usually from the PST eval just now. The net
+	 * doesn't use the table, so with one they're reduced like any other
+	 * move rather than worked out here. */
+	passed = s->net == NULL ?
+			 probe_pawns(s->pawns, p, &scratch)->passed[(int)p->to_move] : 0;
+
+	order_moves(s, g, ply, order);
+	for (i = 0; i < g->num_possible_moves; i++){
+		const Move m = next_move(g, order, i);
+		const int quiet = is_quiet(m, p);
+		const int gives_check = 
+			Position_in_check(&play_move(s, ply, m)->current_pos);
+		int reduction = 0;
+
+		if (futile && quiet && !gives_check && searched > 0)
+			continue;
+
+		if ((s->features & SEARCH_LMR) && depth >= LMR_DEPTH && 
+			searched >= LMR_MOVES && quiet && !in_check && !gives_check &&
+			order[i] < ORDER_KILLER && !(passed & SQUARE_BIT(m.src)))
+			reduction = searched >= 2 * LMR_MOVES + 2 ? 2 : 1;
+
+		if (searched == 0)
+			score = -search_node(s, ply + 1, depth - 1, -beta, -alpha, 1);
+		else if (s->features & SEARCH_PVS){
+			/* Only prove this move isn't better than the best so far,
+			 * and search it properly if it turns out it is */
+			score = -search_node(s, ply + 1, depth - 1 - reduction, 
+								 -alpha - 1, -alpha, 1);
+			if (score > alpha && reduction)
+				score = -search_node(s, ply + 1, depth - 1, 
+									 -alpha - 1, -alpha, 1);
+			if (score > alpha && score < beta)
+				score = -search_node(s, ply + 1, depth - 1, 
+									 -beta, -alpha, 1);
+		}
+		else {
+			score = alpha + 1;
+			if (reduction)
+				score = -search_node(s, ply + 1, depth - 1 - reduction, 
+									 -alpha - 1, -alpha, 1);
+			if (score > alpha)
+				score = -search_node(s, ply + 1, depth - 1, 
+									 -beta, -alpha, 1);
+		}
+		searched++;
+		if (s->stopped)
+			return 0;
+
+		if (score > best){
+			best = score;
+			if (score > alpha){
+				alpha = score;
+				update_pv(s, ply, m);
+				if (score >= beta){
+					if (quiet){
+						if (!same_move(m, s->killers[ply][0])){
+							s->killers[ply][1] = s->killers[ply][0];
+							s->killers[ply][0] = m;
+						}
+						add_history(s, p->to_move, m, depth * depth);
+					}
+					break;
+				}
+			}
+		}
+	}
+	return best;
+}
+
+/* Helper function. One iteration at [depth], with an aspiration window
+ * around [guess] if that's on. */
+int search_iteration(Search *s, int depth, int guess)
+{
+	int delta = ASPIRATION_WINDOW;
+	int alpha = -INFINITE_SCORE;
+	int beta = INFINITE_SCORE;
+	int score;
+
+	if ((s->features & SEARCH_ASPIRATION) && depth > 1){
+		alpha = guess - delta;
+		beta = guess + delta;
+	}
+
+	for (;;){
+		s->root_depth = depth;
+		score = search_node(s, 0, depth, alpha, beta, 0);
+		if (s->stopped || (score > alpha && score < beta))
+			return score;
+
+		/* Fell outside: widen that side and go again */
+		delta *= 2;
+		if (score <= alpha)
+			alpha = delta > ASPIRATION_MAX ? -INFINITE_SCORE : score - delta;
+		else
+			beta = delta > ASPIRATION_MAX ? INFINITE_SCORE : score + delta;
+	}
+}
+
+int ChessBot_search(ChessBot *bot)
+{
+	Search *s = (Search *) malloc(sizeof(Search));
+	int best_index = 0;
+	int score = 0;
+	int depth, i;
+
+	memset(s->killers, 0, sizeof(s->killers));
+	memset(s->history, 0, sizeof(s->history));
+	s->features = bot->search_features;
+	s->prev_pv_length = 0;
+	s->nodes = 0;
+	s->stop = &bot->stop;
+	s->can_stop = 0;
+	s->stopped = 0;
+	s->deadline = bot->search_time_ms > 0 ? 
+				  search_clock_ms() + bot->search_time_ms : 0;
+	Game_copy(bot->game, &s->games[0]);
+	s->net = bot->net;
+	if (s->net != NULL)
+		NNUE_refresh(s->net, &s->games[0].current_pos, &s->accs[0]);
+	/* Without memory for the table, pawns are just worked out every
+	 * time */
+	if (bot->pawns == NULL)
+		bot->pawns = (PawnTable *) calloc(1, sizeof(PawnTable));
+	if (bot->pawns != NULL)
+		bot->pawns->probes = bot->pawns->hits = 0;
+	s->pawns = bot->pawns;
+
+	memset(&bot->last_search, 0, sizeof(SearchStats));
+	for (depth = 1; depth <= bot->search_depth; depth++){
+		score = search_iteration(s, depth, score);
+		if (s->stopped)
+			break;
+
+		for (i = 0; i < s->pv_length[0]; i++)
+			s->prev_pv[i] = s->pv[0][i];
+		s->prev_pv_length = s->pv_length[0];
+		s->can_stop = 1;
+		bot->last_search.depth = depth;
+		bot->last_search.score = score;
+
+		/* No point looking deeper once there's a forced mate */
+		if (score >= MATE_BOUND || score <= -MATE_BOUND)
+			break;
+	}
+	bot->last_search.nodes = s->nodes;
+	if (bot->pawns != NULL){
+		bot->last_search.pawn_probes = bot->pawns->probes;
+		bot->last_search.pawn_hits = bot->pawns->hits;
+	}
+
+	for (i = 0; i < bot->game->num_possible_moves; i++)
+		if (s->prev_pv_length > 0 && 
+			same_move(bot->game->current_possible_moves[i], s->prev_pv[0]))
+			best_index = i;
+
+	free(s);
+	return best_index;
+}
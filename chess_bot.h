@@ -1,6 +1,43 @@
 #include "chess.h"
+#include "nnue.h"
+#include "pawns.h"
 
-typedef enum { RANDOM_MOVE, MIN_OPPT_MOVES } BotAlgo;
+typedef enum { RANDOM_MOVE, MIN_OPPT_MOVES, ALPHA_BETA } BotAlgo;
+
+/* Features of the ALPHA_BETA search that can be switched on and off
+ * separately, as bits of ChessBot.search_features. Plain alpha-beta 
+ * with iterative deepening and a captures-only quiescence search is 
+ * always there. */
+#define SEARCH_PVS        1  /* Zero-window searches after the first move */
+#define SEARCH_ASPIRATION 2  /* Root window around the last iteration */
+#define SEARCH_NULL_MOVE  4  /* Null-move pruning */
+#define SEARCH_LMR        8  /* Late move reductions */
+#define SEARCH_FUTILITY  16  /* Futility pruning at depths 1 and 2 */
+#define SEARCH_ALL       31
+
+/* Deepest the search can go, extensions and quiescence included */
+#define SEARCH_MAX_PLY 64
+/* Deepest iteration ALPHA_BETA bots start out allowed */
+#define SEARCH_DEFAULT_DEPTH 32
+/* Thinking time ALPHA_BETA bots start out with, per move */
+#define SEARCH_DEFAULT_TIME_MS 1000
+
+/* What the last search did */
+typedef struct search_stats_t {
+	/* Positions looked at, quiescence included */
+	long nodes;
+	/* Deepest iteration finished, and its score in centipawns for the
+	 * bot (past +-29000 is a mate) */
+	int depth;
+	int score;
+	/* Pawn structure lookups in the bot's pawn hash table, and how many
+	 * found their pawns already there */
+	long pawn_probes;
+	long pawn_hits;
+} SearchStats;
+
+/* A bot's pawn hash table (see chess_bot.c) */
+typedef struct pawn_table_t PawnTable;
 
 /* General structure for all simple/greedy chess algo bots. */
 typedef struct chessbot_t
@@ -14,12 +51,61 @@ typedef struct chessbot_t
 	/* If it's playing as black or white */
 	char color;
 
+	/* The bot's own random numbers (see ChessBot_random), and the seed
+	 * they started from, so a game can be played again exactly */
+	unsigned long long rng_state;
+	unsigned long long rng_inc;
+	unsigned long long seed;
+
+	/* ALPHA_BETA only: which SEARCH_ features it uses, how deep it can
+	 * go and how long it can think per move (0 for no limit), and what
+	 * it did last time it moved */
+	int search_features;
+	int search_depth;
+	long search_time_ms;
+	SearchStats last_search;
+	/* What ALPHA_BETA evaluates positions with: pst_eval if NULL. Not
+	 * destroyed with the bot, and can be shared between bots. */
+	const NNUE *net;
+	/* Pawn structure already worked out, by pawn_key. Made on the
+	 * bot's first search and kept from search to search, since the
+	 * pawns hardly change from one move to the next. */
+	PawnTable *pawns;
+
+	/* Can be set from another thread while the bot is searching, to 
+	 * make it stop early and move with what it's found so far (it 
+	 * always finishes the first iteration). Whoever sets it clears it
+	 * before the next search. */
+	volatile int stop;
+
 } ChessBot;
 
 	
-ChessBot *ChessBot_create(ChessGame *game, BotAlgo algo, char color);
+/* A bot only touches its own state and its game, so bots with 
+ * different games can play in different threads. All of its random
+ * choices come from [seed]: the same seed and the same game give the
+ * same moves. */
+ChessBot *ChessBot_create(ChessGame *game, BotAlgo algo, char color,
+						  unsigned long long seed);
 void ChessBot_destroy(ChessBot *bot);
 
+/* Sets how an ALPHA_BETA bot searches (see ChessBot's fields). */
+void ChessBot_set_search(ChessBot *bot, int features, int depth, 
+						 long time_ms);
+/* Has an ALPHA_BETA bot evaluate with [net] instead of pst_eval (NULL
+ * to go back). The net's accumulators are carried along the search
+ * move by move. */
+void ChessBot_set_net(ChessBot *bot, const NNUE *net);
+/* SEARCH_ bits for a comma-separated list of feature names: "pvs", 
+ * "aspiration", "null", "lmr", "futility", or "all" or "none". Returns
+ * -1 if a name isn't one of those. */
+int ChessBot_search_features(const char *names);
+
+/* Starts the bot's random numbers over from [seed]. */
+void ChessBot_seed(ChessBot *bot, unsigned long long seed);
+/* Next random number from the bot's own generator, 0 to 2^32 - 1. */
+unsigned int ChessBot_random(ChessBot *bot);
+
 
 /* Calculates next move based on whatever algorithm the bot has and
  * whatever its inner position is. 
@@ -28,11 +114,37 @@ Move ChessBot_find_next_move(ChessBot *bot);
 
 /* Applies the position evaluation function [eval_game] to the current position
  * in the ChessBot by making copies for each possible move and seeing which
- * evals the highest. Returns the index of the highest-evalling move. */
+ * evals the highest. Returns the index of the highest-evalling move.
+ * The copies only get the position moved forward, with their legal moves
+ * pending: [eval_game] should call Game_count_legal_moves, or
+ * Game_ensure_moves if it needs the moves themselves. */
 int ChessBot_position_eval(ChessBot *bot, int (*eval_game)(ChessGame *g));
 
+/* Batched evaluator: given a game with its legal moves found, writes the
+ * score for playing move i into [scores][i], for every move at once. 
+ * It gets the whole list so that it can share work between the 
+ * children, e.g. working out the parent's pieces once (see 
+ * Game_count_replies) instead of from scratch for every child. */
+typedef void (*BatchEval)(const ChessGame *g, int *scores);
+
+/* Same as ChessBot_position_eval, but with a batched evaluator, which
+ * is called once. Returns the index of the highest-scoring move. */
+int ChessBot_batch_eval(ChessBot *bot, BatchEval eval);
+
+/* Searches the bot's position with iterative deepening, deeper each 
+ * time until it reaches search_depth, runs out of search_time_ms or is
+ * told to stop (the first iteration always finishes). Returns the index of the best
+ * move of the deepest finished iteration, and fills last_search. */
+int ChessBot_search(ChessBot *bot);
+
 
 
 
 /* Evals for simpler bots */
 int min_oppt_moves_eval(ChessGame *g);
+/* Same eval as min_oppt_moves_eval, batched */
+void min_oppt_moves_batch(const ChessGame *g, int *scores);
+/* Material, piece-square tables and pawn structure, in centipawns for
+ * the side to move. What ALPHA_BETA searches with (through its pawn 
+ * hash table, see ChessBot.pawns). */
+int pst_eval(const Position *p);
@@ -0,0 +1,151 @@
+#include "chess_prof.h"
+
+#ifdef CHESS_PROFILE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *counter_names[PROF_NUM_COUNTERS] = {
+	"Game_find_all_legal_moves", "in_check_after_move", 
+	"Position_is_attacked", "Game_copy", "Move_set_shorttitle"
+};
+
+/* One per thread. Never freed, so counts of finished threads still
+ * show up in the totals. */
+typedef struct prof_table_t {
+	unsigned long long calls[PROF_NUM_COUNTERS];
+	unsigned long long cycles[PROF_NUM_COUNTERS];
+	struct prof_table_t *next;
+} ProfTable;
+
+static __thread ProfTable *local_table = NULL;
+
+static ProfTable *all_tables = NULL;
+static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Dumps totals wherever the environment says to. Registered with
+ * atexit when the first table is made. */
+static void dump_at_exit()
+{
+	const char *format = getenv("CHESS_PROF_FORMAT");
+	const char *filename = getenv("CHESS_PROF_OUT");
+	const int as_json = format != NULL && strcmp(format, "json") == 0;
+	FILE *out = stderr;
+
+	if (filename != NULL && (out = fopen(filename, "w")) == NULL)
+		out = stderr;
+
+	Prof_dump(out, as_json);
+
+	if (out != stderr)
+		fclose(out);
+}
+
+/* Makes this thread's table and adds it to the list of all of them. */
+static ProfTable *make_local_table()
+{
+	ProfTable *table = (ProfTable *)calloc(1, sizeof(ProfTable));
+
+	pthread_mutex_lock(&tables_lock);
+	if (all_tables == NULL)
+		atexit(dump_at_exit);
+	table->next = all_tables;
+	all_tables = table;
+	pthread_mutex_unlock(&tables_lock);
+
+	local_table = table;
+	return table;
+}
+
+static unsigned long long read_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return (unsigned long long)clock();
+#endif
+}
+
+unsigned long long Prof_begin(ProfCounter counter)
+{
+	ProfTable *table = local_table;
+	if (table == NULL)
+		table = make_local_table();
+
+	table->calls[counter]++;
+#ifdef CHESS_PROFILE_CYCLES
+	return read_cycles();
+#else
+	return 0;
+#endif
+}
+
+void Prof_end(ProfCounter counter, unsigned long long start)
+{
+	local_table->cycles[counter] += read_cycles() - start;
+}
+
+void Prof_dump(FILE *out, int as_json)
+{
+	unsigned long long calls[PROF_NUM_COUNTERS];
+	unsigned long long cycles[PROF_NUM_COUNTERS];
+	ProfTable *table;
+	int threads = 0;
+	int i;
+
+	memset(calls, 0, sizeof(calls));
+	memset(cycles, 0, sizeof(cycles));
+
+	pthread_mutex_lock(&tables_lock);
+	for (table = all_tables; table != NULL; table = table->next){
+		for (i = 0; i < PROF_NUM_COUNTERS; i++){
+			calls[i] += table->calls[i];
+			cycles[i] += table->cycles[i];
+		}
+		threads++;
+	}
+	pthread_mutex_unlock(&tables_lock);
+
+	if (as_json){
+		fprintf(out, "{\"threads\": %d, \"counters\": {", threads);
+		for (i = 0; i < PROF_NUM_COUNTERS; i++)
+			fprintf(out, "%s\"%s\": {\"calls\": %llu, \"cycles\": %llu}",
+					i == 0 ? "" : ", ", counter_names[i], calls[i], cycles[i]);
+		fprintf(out, "}}\n");
+		return;
+	}
+
+	fprintf(out, "%-28s %14s %16s %12s\n", 
+			"function", "calls", "cycles", "cycles/call");
+	for (i = 0; i < PROF_NUM_COUNTERS; i++)
+		fprintf(out, "%-28s %14llu %16llu %12.1f\n", counter_names[i], 
+				calls[i], cycles[i],
+				calls[i] == 0 ? 0.0 : (double)cycles[i] / calls[i]);
+	fprintf(out, "(%d thread%s)\n", threads, threads == 1 ? "" : "s");
+}
+
+void Prof_reset()
+{
+	ProfTable *table;
+
+	pthread_mutex_lock(&tables_lock);
+	for (table = all_tables; table != NULL; table = table->next){
+		memset(table->calls, 0, sizeof(table->calls));
+		memset(table->cycles, 0, sizeof(table->cycles));
+	}
+	pthread_mutex_unlock(&tables_lock);
+}
+
+#else
+
+void Prof_dump(FILE *out, int as_json)
+{
+}
+
+void Prof_reset()
+{
+}
+
+#endif
@@ -0,0 +1,48 @@
+/* Hot-path instrumentation for the chess core.
+ *
+ * Build with -DCHESS_PROFILE (and -pthread) to count calls of the
+ * functions below, and also with -DCHESS_PROFILE_CYCLES to time them in
+ * CPU cycles (rdtsc on x86, clock() elsewhere). Each thread counts into
+ * its own table; Prof_dump sums every table that has ever been used.
+ * The totals are dumped to stderr at exit, as a table, or as JSON if
+ * CHESS_PROF_FORMAT=json is set in the environment (CHESS_PROF_OUT=file
+ * sends them to a file instead).
+ *
+ * Without CHESS_PROFILE every macro here compiles to nothing. */
+#include <stdio.h>
+
+typedef enum { PROF_FIND_ALL_LEGAL_MOVES, PROF_IN_CHECK_AFTER_MOVE,
+			   PROF_IS_ATTACKED, PROF_GAME_COPY, PROF_SET_SHORTTITLE,
+			   PROF_NUM_COUNTERS } ProfCounter;
+
+#ifdef CHESS_PROFILE
+
+/* Count a call to [counter]. PROF_BEGIN has to go with the declarations
+ * at the top of a block; PROF_END goes before every return after it. */
+#ifdef CHESS_PROFILE_CYCLES
+#define PROF_BEGIN(counter) \
+		unsigned long long prof_start_##counter = Prof_begin(counter)
+#define PROF_END(counter)	Prof_end(counter, prof_start_##counter)
+#else
+#define PROF_BEGIN(counter) 	Prof_begin(counter)
+#define PROF_END(counter)
+#endif
+
+unsigned long long Prof_begin(ProfCounter counter);
+void Prof_end(ProfCounter counter, unsigned long long start);
+
+#else
+
+#define PROF_BEGIN(counter)
+#define PROF_END(counter)
+
+#endif
+
+/* Writes summed counters (and cycles, if timed) of all threads to [out],
+ * as a table or as JSON if [as_json]. Counters of threads that are still
+ * running are read as they are, so may be slightly behind. Does nothing
+ * without CHESS_PROFILE. */
+void Prof_dump(FILE *out, int as_json);
+
+/* Zeroes every thread's counters. */
+void Prof_reset();
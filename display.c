@@ -1,7 +1,11 @@
 #include <SDL2/SDL.h>
 #include "../../my_API/sdl/sdl_util.h"
 #include "chess_bot.h"
+#include "board_draw.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define WIN_W 1408
 #define WIN_H 960
@@ -10,14 +14,8 @@
 #define BOARD_Y 50
 #define SQUARE_SIDELEN 80
 
-#define DARK_SQ_COLOR 0x592A0AFF
-#define LIGHT_SQ_COLOR 0xFFC6A1FF
 #define SELECT_SQ_COLOR 0x4A9CB0FF
 
-#define PIECES_PIC "pics/pieces.png"
-#define PIECES_COLS 6
-#define PIECES_FRAME_SIDELEN 128
-
 #define FONT_PIC "pics/tom_vii_font.png"
 #define FONT_HEIGHT 17
 #define FONT_WIDTH 11
@@ -32,10 +30,41 @@
 #define MOVES_Y BOARD_Y - 30
 #define MOVES_X BOARD_X + (8 * SQUARE_SIDELEN) + 10
 
-#define MOVES_STRLEN 2048
-
+/* The move list: the longest a line's text can be, how tall a line is
+ * on screen, and how many fit. Scrolling moves it this many lines. */
+#define MOVE_LINE_LEN 64
+#define MOVES_LINE_H FONTSIZE_H
+#define MOVES_VISIBLE_LINES ((WIN_H - (MOVES_Y)) / MOVES_LINE_H)
+#define MOVES_SCROLL_STEP 3
+/* Lines the move list starts out with room for */
+#define MOVE_LINES_START 32
+
+#define THINKING_X BOARD_X
+#define THINKING_Y BOARD_Y + (8 * SQUARE_SIDELEN) + 10
+
+/* Slider under the board for going through a movie (where the bot's
+ * "Thinking..." would be, but the bot doesn't play in movies) */
+#define SLIDER_X BOARD_X
+#define SLIDER_Y BOARD_Y + (8 * SQUARE_SIDELEN) + 10
+#define SLIDER_W (8 * SQUARE_SIDELEN)
+#define SLIDER_H 24
+#define SLIDER_KNOB_W 12
+#define SLIDER_COLOR 0xA0A0A0FF
+
+/* Behind the last move played, in the move list */
+#define HIGHLIGHT_COLOR 0xFFE680FF
+
+#define MOVES_TEX_W (WIN_W - (MOVES_X))
+
+/* Frames are at least this many ms apart while animating (less often 
+ * if vsync holds them back), and an animation takes as long as this 
+ * many of them, however long drawing them actually takes */
 #define FRAME_DELAY 16
 #define MAX_ANIMATION_FRAMES 20
+#define ANIMATION_MS (MAX_ANIMATION_FRAMES * FRAME_DELAY)
+
+/* In UI_container's [shown], for squares that have to be drawn again */
+#define SHOWN_NOTHING 0xFF
 
 /*  Info for moving pieces around the board,
  *  i.e. "animating" them. */
@@ -43,11 +72,36 @@ typedef struct {
 	int active;
 	int src;
 	int dest;
-	int frame;
+	/* SDL_GetTicks when it began */
+	Uint32 start;
 	int drawx;
 	int drawy;
 } PieceAnimator;
 
+/* A line of the move list */
+typedef struct {
+	char text[MOVE_LINE_LEN];
+	int length;
+	/* Goes up every time the text changes */
+	int version;
+} MoveLine;
+
+/* Where a ply's move is in the move list: its line, and which chars
+ * of the line are its title */
+typedef struct {
+	int line;
+	int start;
+	int length;
+} MoveSpot;
+
+/* A texture with one line of the move list drawn into it, as it was
+ * at [version]. [line] is -1 if it has nothing yet. */
+typedef struct {
+	SDL_Texture *tex;
+	int line;
+	int version;
+} LineSlot;
+
 /* All necessary variables for UI go here */
 typedef struct {
 	WinRend winrend;	
@@ -55,10 +109,38 @@ typedef struct {
 	int draw_board;
 	int draw_moves;
 
-	Sprite *pieces_spr;
+	SDL_Texture *pieces_tex;
 	Font *font;
 
+	/* The board as last drawn, kept in a texture so that a frame only 
+	 * has to draw the squares that changed. [shown] is the piece drawn
+	 * on each square (EMT for none, or if it's being animated) and 
+	 * [shown_selected] the square drawn highlighted, or -1. NULL if the
+	 * renderer can't draw to textures, and then it's all drawn every 
+	 * frame. */
+	SDL_Texture *board_tex;
+	unsigned char shown[64];
+	int shown_selected;
+	/* The move list, as long as the game needs. Only the lines on 
+	 * screen get drawn, each into a texture of its own, and only again
+	 * once it changes: line i goes in slot i % MOVES_VISIBLE_LINES, so
+	 * scrolling by a line just draws the one new one. [scroll] is the
+	 * top line shown. */
+	MoveLine *lines;
+	int num_lines;
+	int lines_capacity;
+	LineSlot slots[MOVES_VISIBLE_LINES];
+	int scroll;
+	/* Where each ply's move is, and the ply highlighted (-1 for none) */
+	MoveSpot *spots;
+	int num_spots;
+	int spots_capacity;
+	int highlighted;
+
 	ChessGame *game;
+	/* The game only ever moves forward, so its moves are kept up to
+	 * date incrementally */
+	MoveTracker tracker;
 
 	/* Should both be -1 if nothing on board
 	 * is selected */
@@ -73,10 +155,6 @@ typedef struct {
 
 	PieceAnimator anim;
 
-	/* For writing the moves played on the screen */
-	char moves_str[MOVES_STRLEN];
-	int str_position;
-
 	GameCondition game_status;
 	/* True if game is over and all moves have been
 	 * written, else false. */
@@ -87,33 +165,47 @@ typedef struct {
 	/* True if bot is playing, false if 2 humans are playing or
 	 * if we are watching a movie. */
 	int bot_playing;
+	/* The bot thinks on its own thread, so the window keeps going. 
+	 * While it is ([bot_thinking]), nothing touches the game but to 
+	 * read it. It leaves its move in [bot_move] and pushes a 
+	 * [bot_event] when it's done. */
+	int bot_thinking;
+	SDL_Thread *bot_thread;
+	Move bot_move;
+	Uint32 bot_event;
 
 	/* Movie of game */
 	Movie *movie;
 	/* Whether movie is being played from
 	 * file (1) or not (0). */
 	int is_file_movie;
+	/* Whether the movie plays on by itself, and whether the slider is 
+	 * being dragged */
+	int movie_playing;
+	int scrubbing;
+	/* How the movie's game ended */
+	GameCondition movie_result;
 
 } UI_container;
 
 
-void anim_update(UI_container *ui)
+/* Puts the animated piece where it should be at [now], and ends the
+ * animation once it's there. */
+void anim_update(UI_container *ui, Uint32 now)
 {
 	const int src_x  = ((ui->anim.src % 8 ) * SQUARE_SIDELEN) + BOARD_X;
 	const int src_y  = ((ui->anim.src / 8 ) * SQUARE_SIDELEN) + BOARD_Y;
 	const int dest_x = ((ui->anim.dest % 8) * SQUARE_SIDELEN) + BOARD_X;
 	const int dest_y = ((ui->anim.dest / 8) * SQUARE_SIDELEN) + BOARD_Y;
 
-	const int x_inc = (dest_x - src_x) / MAX_ANIMATION_FRAMES;
-	const int y_inc = (dest_y - src_y) / MAX_ANIMATION_FRAMES;
-	
-	ui->anim.drawx = src_x + (x_inc * ui->anim.frame);
-	ui->anim.drawy = src_y + (y_inc * ui->anim.frame);
-
-	if (ui->anim.frame >= MAX_ANIMATION_FRAMES)
+	Uint32 elapsed = now - ui->anim.start;
+	if (elapsed >= ANIMATION_MS){
+		elapsed = ANIMATION_MS;
 		ui->anim.active = 0;
-	else
-		ui->anim.frame++;
+	}
+	
+	ui->anim.drawx = src_x + (((dest_x - src_x) * (int)elapsed) / ANIMATION_MS);
+	ui->anim.drawy = src_y + (((dest_y - src_y) * (int)elapsed) / ANIMATION_MS);
 }
 
 void anim_begin(UI_container *ui, int src, int dest)
@@ -121,122 +213,450 @@ void anim_begin(UI_container *ui, int src, int dest)
 	ui->anim.active = 1;
 	ui->anim.src = src;
 	ui->anim.dest = dest;
-	ui->anim.frame = 0;
-	anim_update(ui);
+	ui->anim.start = SDL_GetTicks();
+	anim_update(ui, ui->anim.start);
 }
 
-int is_anim(UI_container *ui, int row, int col)
+/* Draws square [sq] at [x], [y] with [piece] (or EMT) on it. */
+void draw_square(UI_container *ui, int sq, ChessPiece piece, int selected,
+				 int x, int y)
 {
-	const int dest_row = ui->anim.dest / 8;
-	const int dest_col = ui->anim.dest % 8;
-	return row == dest_row && col == dest_col;
+	Board_draw_square(ui->winrend.rend, ui->pieces_tex, piece, 
+					  selected ? SELECT_SQ_COLOR : Board_square_color(sq),
+					  x, y, SQUARE_SIDELEN);
 }
 
-void draw(UI_container *ui)
+/* Brings the board texture up to date with the game, the selection and
+ * the animation, drawing only the squares that changed. Without the 
+ * texture, draws the whole board straight to the window. */
+void board_refresh(UI_container *ui)
+{
+	const int selected = ui->row_selected < 0 ? -1 
+						 : ui->col_selected + (8 * ui->row_selected);
+	int drawing = 0;
+	int sq;
+
+	for (sq = 0; sq < 64; sq++){
+		/* Piece, as long as it's not being animated */
+		ChessPiece piece = Game_pieceat(ui->game, sq / 8, sq % 8);
+		if (ui->anim.active && sq == ui->anim.dest)
+			piece = EMT;
+
+		if (ui->board_tex == NULL){
+			draw_square(ui, sq, piece, sq == selected, 
+						((sq % 8) * SQUARE_SIDELEN) + BOARD_X,
+						((sq / 8) * SQUARE_SIDELEN) + BOARD_Y);
+			continue;
+		}
+		if (ui->shown[sq] == piece && 
+			(sq == selected) == (sq == ui->shown_selected))
+			continue;
+
+		if (!drawing){
+			SDL_SetRenderTarget(ui->winrend.rend, ui->board_tex);
+			drawing = 1;
+		}
+		draw_square(ui, sq, piece, sq == selected, 
+					(sq % 8) * SQUARE_SIDELEN, (sq / 8) * SQUARE_SIDELEN);
+		ui->shown[sq] = piece;
+	}
+	ui->shown_selected = selected;
+
+	if (drawing)
+		SDL_SetRenderTarget(ui->winrend.rend, NULL);
+}
+
+/* Draws line [line] of the move list at [x], [y], with the highlight
+ * if it's on it. */
+void moves_draw_line(UI_container *ui, int line, int x, int y)
+{
+	if (ui->highlighted >= 0 && ui->spots[ui->highlighted].line == line){
+		const MoveSpot *spot = &ui->spots[ui->highlighted];
+		SDLUTIL_fillrect(&(ui->winrend), x + (spot->start * FSPACE), y, 
+						 spot->length * FSPACE, MOVES_LINE_H, HIGHLIGHT_COLOR);
+	}
+	Font_draw_string(ui->font, ui->lines[line].text, x, y, FSPACE);
+}
+
+/* Draws the lines of the move list that are on screen, into their
+ * textures if they have them and only if they changed. */
+void moves_draw(UI_container *ui)
+{
+	int line;
+	for (line = ui->scroll; line < ui->num_lines && 
+						   line < ui->scroll + MOVES_VISIBLE_LINES; line++){
+		LineSlot *slot = &ui->slots[line % MOVES_VISIBLE_LINES];
+		SDL_Rect line_rect;
+		line_rect.x = MOVES_X;
+		line_rect.y = MOVES_Y + ((line - ui->scroll) * MOVES_LINE_H);
+		line_rect.w = MOVES_TEX_W;
+		line_rect.h = MOVES_LINE_H;
+
+		if (slot->tex == NULL){
+			moves_draw_line(ui, line, line_rect.x, line_rect.y);
+			continue;
+		}
+		if (slot->line != line || slot->version != ui->lines[line].version){
+			SDL_SetRenderTarget(ui->winrend.rend, slot->tex);
+			SDL_SetRenderDrawColor(ui->winrend.rend, 0xFF, 0xFF, 0xFF, 0xFF);
+			SDL_RenderClear(ui->winrend.rend);
+			moves_draw_line(ui, line, 0, 0);
+			SDL_SetRenderTarget(ui->winrend.rend, NULL);
+			slot->line = line;
+			slot->version = ui->lines[line].version;
+		}
+		SDL_RenderCopy(ui->winrend.rend, slot->tex, NULL, &line_rect);
+	}
+}
+
+/* Scrolls the move list [by] lines (up if negative), as far as it 
+ * goes. */
+void moves_scroll(UI_container *ui, int by)
+{
+	const int bottom = ui->num_lines > MOVES_VISIBLE_LINES ? 
+					   ui->num_lines - MOVES_VISIBLE_LINES : 0;
+	ui->scroll += by;
+	if (ui->scroll > bottom)
+		ui->scroll = bottom;
+	if (ui->scroll < 0)
+		ui->scroll = 0;
+}
+
+/* Helper function. Doubles the room in [array] of [size]-byte items, 
+ * which has room for [*capacity] now (or none). Returns the new array,
+ * or NULL if there's no memory (and then [array] is left as it was). */
+void *grow_array(void *array, int *capacity, size_t size)
+{
+	const int new_capacity = *capacity > 0 ? 2 * *capacity : MOVE_LINES_START;
+	void *grown = realloc(array, new_capacity * size);
+	if (grown != NULL)
+		*capacity = new_capacity;
+	return grown;
+}
+
+/* Highlights ply [ply]'s move in the move list (none if -1), and 
+ * scrolls to it if it's out of view. */
+void moves_highlight(UI_container *ui, int ply)
+{
+	int line;
+	if (ui->highlighted >= 0)
+		ui->lines[ui->spots[ui->highlighted].line].version++;
+
+	ui->highlighted = ply < ui->num_spots ? ply : -1;
+	if (ui->highlighted < 0)
+		return;
+
+	line = ui->spots[ply].line;
+	ui->lines[line].version++;
+	if (line < ui->scroll)
+		moves_scroll(ui, line - ui->scroll);
+	else if (line >= ui->scroll + MOVES_VISIBLE_LINES)
+		moves_scroll(ui, line - ui->scroll - MOVES_VISIBLE_LINES + 1);
+}
+
+/* Starts a new line in the move list, making room for it if needed.
+ * If the last line was on screen, scrolls down to keep it that way. 
+ * Returns 0 if there's no memory for it. */
+int moves_new_line(UI_container *ui)
+{
+	const int following = ui->scroll + MOVES_VISIBLE_LINES >= ui->num_lines;
+
+	if (ui->num_lines == ui->lines_capacity){
+		MoveLine *lines = (MoveLine *) grow_array(ui->lines, 
+									&ui->lines_capacity, sizeof(MoveLine));
+		if (lines == NULL)
+			return 0;
+		ui->lines = lines;
+	}
+
+	ui->lines[ui->num_lines].text[0] = '\0';
+	ui->lines[ui->num_lines].length = 0;
+	ui->lines[ui->num_lines].version = 0;
+	ui->num_lines++;
+	if (following)
+		moves_scroll(ui, ui->num_lines);
+	return 1;
+}
+
+/* Adds [text] to the end of the move list's last line (as much of it
+ * as fits). */
+void moves_append(UI_container *ui, const char *text)
 {
-	SDL_Delay(FRAME_DELAY);
+	MoveLine *line;
+	if (ui->num_lines == 0 && !moves_new_line(ui))
+		return;
+
+	line = &ui->lines[ui->num_lines - 1];
+	while (*text != '\0' && line->length < MOVE_LINE_LEN - 1)
+		line->text[line->length++] = *text++;
+	line->text[line->length] = '\0';
+	line->version++;
+}
+
+/* Makes the board and move list textures be drawn over from scratch,
+ * for when they're new or their contents were lost. */
+void UI_forget_textures(UI_container *ui)
+{
+	int i;
+	memset(ui->shown, SHOWN_NOTHING, sizeof(ui->shown));
+	ui->shown_selected = -1;
+	for (i = 0; i < MOVES_VISIBLE_LINES; i++)
+		ui->slots[i].line = -1;
+}
 
+void draw(UI_container *ui)
+{
 	if (ui->draw_board)
 	{
-		unsigned long color;
-		int is_light;
-		int r, c;
-		for (c = 0; c < 8; c++){
-			for (r = 0; r < 8; r++){
-				const int square_x = c * SQUARE_SIDELEN + BOARD_X;
-				const int square_y = r * SQUARE_SIDELEN + BOARD_Y;
-				/* Draw board square */
-				is_light = (c % 2) == (r % 2);
-				color = is_light ? LIGHT_SQ_COLOR : DARK_SQ_COLOR;
-
-				if (ui->row_selected == r && ui->col_selected == c)	
-					color = SELECT_SQ_COLOR;
-
-				SDLUTIL_fillrect(&(ui->winrend), 
-								 square_x, square_y,
-								 SQUARE_SIDELEN, SQUARE_SIDELEN, color);
-				/* Draw piece, as long as it's not being animated */ 
-				const ChessPiece piece = Game_pieceat(ui->game, r, c);
-				if (piece != EMT && !(ui->anim.active && is_anim(ui, r, c)))
-						Sprite_drawat(ui->pieces_spr, square_x, square_y, piece);
-			}
+		board_refresh(ui);
+		if (ui->board_tex != NULL){
+			SDL_Rect board_rect;
+			board_rect.x = BOARD_X;
+			board_rect.y = BOARD_Y;
+			board_rect.w = board_rect.h = 8 * SQUARE_SIDELEN;
+			SDL_RenderCopy(ui->winrend.rend, ui->board_tex, NULL, &board_rect);
 		}
 		/* Draw animated piece */
 		if (ui->anim.active){
 			const ChessPiece piece = Game_pieceat(ui->game,
 												  ui->anim.dest / 8,
 												  ui->anim.dest % 8);
-			Sprite_drawat(ui->pieces_spr, ui->anim.drawx, ui->anim.drawy, piece);
+			Board_draw_piece(ui->winrend.rend, ui->pieces_tex, piece, 
+							 ui->anim.drawx, ui->anim.drawy, SQUARE_SIDELEN);
 		}
 	}
 	
 	if (ui->draw_moves)
 	{
 		/* DRAW MOVES */
-		Font_draw_string(ui->font, ui->moves_str, MOVES_X, MOVES_Y, FSPACE);
+		moves_draw(ui);
+	}
+
+	if (ui->bot_thinking)
+		Font_draw_string(ui->font, "Thinking...", THINKING_X, THINKING_Y, 
+						 FSPACE);
+
+	/* Movie slider, with the knob at the current turn */
+	if (ui->is_file_movie && ui->movie->length > 1){
+		const int knob_x = SLIDER_X + (((SLIDER_W - SLIDER_KNOB_W) 
+							* ui->movie->current_turn) / (ui->movie->length - 1));
+		SDLUTIL_fillrect(&(ui->winrend), SLIDER_X, SLIDER_Y + (SLIDER_H / 2) - 2,
+						 SLIDER_W, 4, SLIDER_COLOR);
+		SDLUTIL_fillrect(&(ui->winrend), knob_x, SLIDER_Y, 
+						 SLIDER_KNOB_W, SLIDER_H, SELECT_SQ_COLOR);
 	}
 }
 
 
 
 
-/* Write move string to UI's move-containing big string */
-void UI_write_move(UI_container *ui, Move move)
+/* Write [move], played in [game], to the end of the UI's move list,
+ * and highlight it */
+void UI_write_move(UI_container *ui, const ChessGame *game, Move move)
 {
+	char text[MOVE_LINE_LEN];
+	char *end = text;
+	MoveSpot *spot;
+
 	/* Set move title */
-	Move_set_shorttitle(&move, ui->game);
-	
-	int pos = ui->str_position;
+	Move_set_shorttitle(&move, game);
+
+	if (ui->num_spots == ui->spots_capacity){
+		MoveSpot *spots = (MoveSpot *) grow_array(ui->spots, 
+									&ui->spots_capacity, sizeof(MoveSpot));
+		if (spots == NULL)
+			return;
+		ui->spots = spots;
+	}
 
 	/* Add move num if necessary */
-	if (ui->game->current_pos->to_move == WHITE_MOVE){
-		int move_num = ui->game->current_pos->fullmove_clock;
+	if (game->current_pos.to_move == WHITE_MOVE){
+		const int move_num = game->current_pos.fullmove_clock;
 
-		if ((move_num % MAX_MOVES_PER_LINE) == 1)
-			ui->moves_str[pos++] = '\n';
+		if ((move_num % MAX_MOVES_PER_LINE) == 1 && !moves_new_line(ui))
+			return;
 
-		/* Assume game has no more than 1000 moves */
-		if (move_num >= 100){
-			ui->moves_str[pos++] = (move_num / 100) + '0';
-			move_num = move_num % 100;
-		}
-		if (move_num >= 10){
-			ui->moves_str[pos++] = (move_num / 10) + '0';
-			move_num = move_num % 10;
-		}
-		ui->moves_str[pos++] = move_num + '0';
-		ui->moves_str[pos++] = '.';
+		sprintf(end, "%d.", move_num);
+		end += strlen(end);
 	}
-
-	/* Copy m's title into string. String should always
-	 * end with a null terminator per Move_set_shorttitle. */
-	int i;
-	for (i = 0; move.title[i] != '\0'; i++)
-		ui->moves_str[pos++] = move.title[i];
-
-	ui->moves_str[pos++] = ' ';
-	ui->moves_str[pos] = '\0';
-	ui->str_position = pos;
+	if (ui->num_lines == 0 && !moves_new_line(ui))
+		return;
+
+	spot = &ui->spots[ui->num_spots++];
+	spot->line = ui->num_lines - 1;
+	spot->start = ui->lines[spot->line].length + (end - text);
+	/* Move_set_shorttitle always null terminates the title */
+	spot->length = strlen(move.title);
+
+	sprintf(end, "%s ", move.title);
+	moves_append(ui, text);
+	moves_highlight(ui, ui->num_spots - 1);
 }
 
 /* Append score of game to the end */
 void UI_write_endscore(UI_container *ui)
 {
-	const int MAX_SCORE_LEN = 8;
-	char score[MAX_SCORE_LEN];
-
 	if (ui->game_status == WHITE)
-		strcpy(score, "1-0");
+		moves_append(ui, "1-0");
 	else if (ui->game_status == BLACK)
-		strcpy(score, "0-1");
+		moves_append(ui, "0-1");
 	else
-		strcpy(score, "1/2-1/2");
+		moves_append(ui, "1/2-1/2");
+}
 
-	int pos = ui->str_position;
-	int i;
-	for (i = 0; score[i] != '\0'; i++)
-		ui->moves_str[pos++] = score[i];
-	ui->moves_str[pos] = '\0';
+
+/* Runs on the bot's thread. */
+int bot_think(void *data)
+{
+	UI_container *ui = (UI_container *)data;
+	SDL_Event event;
+
+	ui->bot_move = ChessBot_find_next_move(ui->bot);
+
+	memset(&event, 0, sizeof(event));
+	event.type = ui->bot_event;
+	SDL_PushEvent(&event);
+	return 0;
+}
+
+/* Starts the bot thinking about its move. */
+void bot_begin(UI_container *ui)
+{
+	ui->bot->stop = 0;
+	ui->bot_thinking = 1;
+	ui->bot_thread = SDL_CreateThread(bot_think, "bot", ui);
+	if (ui->bot_thread == NULL){
+		/* No thread, think here instead */
+		printf("Couldn't start bot thread (%s).\n", SDL_GetError());
+		bot_think(ui);
+	}
+}
+
+/* Takes the bot's move once its bot_event comes in, and plays it. */
+void bot_finish(UI_container *ui)
+{
+	if (ui->bot_thread != NULL)
+		SDL_WaitThread(ui->bot_thread, NULL);
+	ui->bot_thread = NULL;
+	ui->bot_thinking = 0;
+
+	UI_write_move(ui, ui->game, ui->bot_move);
+	ui->game_status = Game_advanceturn_tracked(ui->game, &ui->tracker, 
+											   ui->bot_move);
+	/* Animation */
+	anim_begin(ui, ui->bot_move.src, ui->bot_move.dest);
+}
+
+/* Stops the bot if it's thinking, throwing its move away. */
+void bot_cancel(UI_container *ui)
+{
+	if (ui->bot_thread == NULL)
+		return;
+	ui->bot->stop = 1;
+	SDL_WaitThread(ui->bot_thread, NULL);
+	ui->bot_thread = NULL;
+	ui->bot_thinking = 0;
+}
+
+
+/* How the movie's game ended: in mate or stalemate, or else the 
+ * players must have agreed to a draw. */
+GameCondition movie_result(const Movie *movie)
+{
+	const ChessGame *last = movie->games[movie->length - 1];
+	if (last->num_possible_moves == 0 && Position_in_check(&last->current_pos))
+		return last->current_pos.to_move == WHITE_MOVE ? BLACK : WHITE;
+	return DRAW;
+}
+
+/* Shows the movie at [turn] (or as close as it has), straight from its
+ * stored games. */
+void movie_seek(UI_container *ui, int turn)
+{
+	if (turn > ui->movie->length - 1)
+		turn = ui->movie->length - 1;
+	if (turn < 0)
+		turn = 0;
+
+	Movie_seek(ui->movie, turn, ui->game);
+	MoveTracker_init(&ui->tracker, &ui->game->current_pos);
+	ui->anim.active = 0;
+	ui->row_selected = -1;
+	ui->col_selected = -1;
+	ui->game_status = (turn == ui->movie->length - 1) ? ui->movie_result 
+													  : PLAYING;
+	moves_highlight(ui, turn - 1);
+}
+
+/* Plays the movie's next move, animated. Stops it playing at the end. */
+void movie_step(UI_container *ui)
+{
+	const int turn = ui->movie->current_turn;
+	const ChessGame *game = ui->movie->games[turn];
+	Move move;
+
+	if (turn >= ui->movie->length - 1){
+		ui->movie_playing = 0;
+		return;
+	}
+	move = game->current_possible_moves[ui->movie->move_indices[turn]];
+	movie_seek(ui, turn + 1);
+	anim_begin(ui, move.src, move.dest);
+	if (turn + 1 == ui->movie->length - 1)
+		ui->movie_playing = 0;
+}
+
+/* Seeks to the turn at [x] on the slider. */
+void movie_scrub(UI_container *ui, int x)
+{
+	const int last = ui->movie->length - 1;
+	ui->movie_playing = 0;
+	movie_seek(ui, (((x - SLIDER_X) * last) + (SLIDER_W / 2)) / SLIDER_W);
+}
+
+/* Writes the whole movie into the move list, and starts it from the 
+ * beginning. */
+void movie_begin(UI_container *ui)
+{
+	int turn;
+	for (turn = 0; turn < ui->movie->length - 1; turn++){
+		const ChessGame *game = ui->movie->games[turn];
+		UI_write_move(ui, game, 
+				game->current_possible_moves[ui->movie->move_indices[turn]]);
+	}
+	ui->movie_result = movie_result(ui->movie);
+	ui->game_status = ui->movie_result;
+	UI_write_endscore(ui);
+	ui->end_status_written = 1;
+
+	ui->movie_playing = 1;
+	movie_seek(ui, 0);
+}
+
+/* Movie keys: left and right step back and forward, home and end jump
+ * to the ends, space plays and pauses. */
+void movie_key(UI_container *ui, int key)
+{
+	const int turn = ui->movie->current_turn;
+	int to;
+
+	if (key == SDLK_SPACE){
+		ui->movie_playing = !ui->movie_playing;
+		return;
+	}
+	if (key == SDLK_LEFT)
+		to = turn - 1;
+	else if (key == SDLK_RIGHT)
+		to = turn + 1;
+	else if (key == SDLK_HOME)
+		to = 0;
+	else if (key == SDLK_END)
+		to = ui->movie->length - 1;
+	else
+		return;
+
+	ui->movie_playing = 0;
+	movie_seek(ui, to);
 }
 
 
@@ -244,19 +664,72 @@ void loop(UI_container *ui)
 {
 	int ui_dirty = 1;
 	int move_selection = 0;
+	/* When the next animation frame is due */
+	Uint32 next_frame = 0;
 	SDL_MouseButtonEvent *mouse_ev;
 	
 	for (;;){
 		if (!ui->anim.active){
 			SDL_Event event;
-			if (SDL_WaitEvent(&event)){
+			/* Don't wait for input while a movie is playing itself */
+			const int got_event = (ui->is_file_movie && ui->movie_playing &&
+								   ui->game_status == PLAYING) ?
+								  SDL_PollEvent(&event) : SDL_WaitEvent(&event);
+			if (got_event){
+				if (event.type == ui->bot_event && ui->bot_thinking){
+					bot_finish(ui);
+					ui_dirty = 1;
+				}
 				switch(event.type){
 					case SDL_QUIT:
 						return;
+					case SDL_WINDOWEVENT:
+						ui_dirty = 1;
+						break;
+					case SDL_RENDER_TARGETS_RESET:
+						UI_forget_textures(ui);
+						ui_dirty = 1;
+						break;
+					case SDL_MOUSEWHEEL:
+						moves_scroll(ui, -MOVES_SCROLL_STEP * event.wheel.y);
+						ui_dirty = 1;
+						break;
+					case SDL_KEYDOWN:
+						/* Escape hurries the bot: it moves with the best
+						 * it's found so far */
+						if (event.key.keysym.sym == SDLK_ESCAPE && 
+							ui->bot_thinking)
+							ui->bot->stop = 1;
+						else if (event.key.keysym.sym == SDLK_PAGEUP)
+							moves_scroll(ui, -MOVES_VISIBLE_LINES);
+						else if (event.key.keysym.sym == SDLK_PAGEDOWN)
+							moves_scroll(ui, MOVES_VISIBLE_LINES);
+						else if (ui->is_file_movie)
+							movie_key(ui, event.key.keysym.sym);
+						ui_dirty = 1;
+						break;
+					case SDL_MOUSEMOTION:
+						if (ui->scrubbing){
+							movie_scrub(ui, event.motion.x);
+							ui_dirty = 1;
+						}
+						break;
+					case SDL_MOUSEBUTTONUP:
+						ui->scrubbing = 0;
+						break;
 					case SDL_MOUSEBUTTONDOWN:
 						mouse_ev = (SDL_MouseButtonEvent*)&event;
+						/* Check if it's on the movie slider */
+						if (ui->is_file_movie 
+						 && mouse_ev->x >= SLIDER_X 
+						 && mouse_ev->x < SLIDER_X + SLIDER_W
+						 && mouse_ev->y >= SLIDER_Y 
+						 && mouse_ev->y < SLIDER_Y + SLIDER_H){
+							ui->scrubbing = 1;
+							movie_scrub(ui, mouse_ev->x);
+						}
 						/* Check that click is in board bounds */
-						if (mouse_ev->x >= BOARD_X 
+						else if (mouse_ev->x >= BOARD_X 
 						 && mouse_ev->x < BOARD_X + SQUARE_SIDELEN * 8
 						 && mouse_ev->y >= BOARD_Y 
 						 && mouse_ev->y < BOARD_Y + SQUARE_SIDELEN * 8){
@@ -278,7 +751,7 @@ void loop(UI_container *ui)
 			/* Manage move */
 			if (move_selection && 
 				(!ui->bot_playing ||
-				 ui->game->current_pos->to_move != ui->bot->color)
+				 ui->game->current_pos.to_move != ui->bot->color)
 				&& !ui->is_file_movie ){
 
 				if (ui->move.src == -1)
@@ -290,11 +763,12 @@ void loop(UI_container *ui)
 					
 					int legal_ind = Game_get_legal(ui->game, ui->move);
 					if (legal_ind != -1){
-						UI_write_move(
-								ui,ui->game->current_possible_moves[legal_ind]);
+						UI_write_move(ui, ui->game,
+								ui->game->current_possible_moves[legal_ind]);
 
-						ui->game_status = 
-							Game_advanceturn_index(ui->game, legal_ind);
+						ui->game_status = Game_advanceturn_tracked(ui->game, 
+							&ui->tracker, 
+							ui->game->current_possible_moves[legal_ind]);
 
 						/* Animation */
 						anim_begin(ui, ui->move.src, ui->move.dest);
@@ -323,38 +797,31 @@ void loop(UI_container *ui)
 				 * should be done here. */
 			}
 			else if (ui->is_file_movie){
-				/* Keep on scrolling thru movie */
-				int movie_movind =
-							 ui->movie->move_indices[ui->movie->current_turn];
-				Move movie_move = ui->game->current_possible_moves[movie_movind];
-				
-				UI_write_move(ui, movie_move);
-				ui->game_status = Game_advanceturn(ui->game, movie_move);
-				anim_begin(ui, movie_move.src, movie_move.dest);
-
-				/* If players agreed to draw in this position, then update
-				 * game status as such. */
-				if (ui->movie->current_turn == ui->movie->length - 2 &&
-					ui->game_status == PLAYING)
-					ui->game_status = DRAW;
-
-				ui->movie->current_turn++;
+				/* Keep on scrolling thru movie, unless it's paused */
+				if (ui->movie_playing){
+					movie_step(ui);
+					ui_dirty = 1;
+				}
 			}
-			else if (ui->bot_playing && 
-					 ui->game->current_pos->to_move == ui->bot->color
+			else if (ui->bot_playing && !ui->bot_thinking &&
+					 ui->game->current_pos.to_move == ui->bot->color
 					 ){
-				/* Bot move! */
-				Move bot_move = ChessBot_find_next_move(ui->bot);
-				UI_write_move(ui, bot_move);
-				ui->game_status = Game_advanceturn(ui->game, bot_move);
-
-				/* Animation */
-				anim_begin(ui, bot_move.src, bot_move.dest);
-
+				/* Bot move! It comes back as a bot_event. */
+				bot_begin(ui);
+				ui_dirty = 1;
 			}
 		}
 		else{
-			anim_update(ui);
+			/* Wait out what's left of the frame (nothing, if drawing or
+			 * vsync took that long already) */
+			Uint32 now = SDL_GetTicks();
+			if ((Sint32)(next_frame - now) > 0){
+				SDL_Delay(next_frame - now);
+				now = next_frame;
+			}
+			next_frame = now + FRAME_DELAY;
+
+			anim_update(ui, now);
 			ui_dirty = 1;
 		}
 
@@ -372,14 +839,14 @@ void loop(UI_container *ui)
  * Make sure this is after SDLUTIL_begin is called. */
 void UI_assign_defaults(UI_container *ui)
 {
+	int i;
+
 	ui->draw_board = 1;
 	ui->draw_moves = 1;
 
-	ui->pieces_spr = Sprite_create_from_picture(
-						PIECES_PIC, 0, 0, PIECES_COLS, 
-						PIECES_FRAME_SIDELEN, 
-						PIECES_FRAME_SIDELEN, ui->winrend.rend);
-	Sprite_resize(ui->pieces_spr, SQUARE_SIDELEN, SQUARE_SIDELEN);
+	ui->pieces_tex = Board_load_pieces(ui->winrend.rend);
+	if (ui->pieces_tex == NULL)
+		printf("Couldn't load %s (%s).\n", PIECES_PIC, SDL_GetError());
 
 	ui->font = Font_create(
 						FONT_PIC, strlen(FONTCHARS), FONT_HEIGHT, FONT_WIDTH,
@@ -393,17 +860,39 @@ void UI_assign_defaults(UI_container *ui)
 	ui->move.dest = -1;
 	ui->move.promoting_to = EMT;
 
-	ui->str_position= 0;
-	ui->moves_str[0] = '\0';
+	ui->lines = NULL;
+	ui->num_lines = 0;
+	ui->lines_capacity = 0;
+	ui->scroll = 0;
+	ui->spots = NULL;
+	ui->num_spots = 0;
+	ui->spots_capacity = 0;
+	ui->highlighted = -1;
+
+	ui->movie_playing = 0;
+	ui->scrubbing = 0;
 
 	ui->game_status = PLAYING;
 
 	ui->anim.active = 0;
-	ui->anim.frame = 0;
+	ui->anim.start = 0;
 	ui->anim.src = ui->anim.dest = 0;
 	ui->anim.drawx = ui->anim.drawy = 0;
 
 	ui->end_status_written = 0;
+
+	ui->bot_thinking = 0;
+	ui->bot_thread = NULL;
+	ui->bot_event = SDL_RegisterEvents(1);
+
+	ui->board_tex = SDL_CreateTexture(ui->winrend.rend, 
+						SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
+						8 * SQUARE_SIDELEN, 8 * SQUARE_SIDELEN);
+	for (i = 0; i < MOVES_VISIBLE_LINES; i++)
+		ui->slots[i].tex = SDL_CreateTexture(ui->winrend.rend, 
+						SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
+						MOVES_TEX_W, MOVES_LINE_H);
+	UI_forget_textures(ui);
 }
 
 #define BOT_ALGO MIN_OPPT_MOVES
@@ -415,25 +904,34 @@ void UI_assign_defaults(UI_container *ui)
 int main(int argc, char **argv)
 {
 	UI_container ui;
+	int i;
 
 	/* TODO: let user set things with argv? */
 
 	ui.game = Game_create();
 	
 	/* BOT */
-	ui.bot = ChessBot_create(ui.game, BOT_ALGO, BLACK_MOVE);
+	ui.bot = ChessBot_create(ui.game, BOT_ALGO, BLACK_MOVE, 
+							 (unsigned long long)time(NULL));
+	printf("Bot seed: %llu\n", ui.bot->seed);
 	ui.bot_playing = 1;
 
 	/* FEN, if wanted */
 	if (STARTING_FROM_FEN)
-		Game_read_FEN(ui.game, FENFILE);
+		if (Game_read_FEN(ui.game, FENFILE) != FEN_OK)
+			printf("Couldn't read FEN. Starting from the beginning.\n");
+	MoveTracker_init(&ui.tracker, &ui.game->current_pos);
 
 	/* Movie */
 	ui.is_file_movie = LOAD_MOVIE;	
 	if (LOAD_MOVIE){
-		ui.movie = Movie_create_from_PGN(MOVIEFILE);
+		PGNStatus pgn_status;
+		ui.movie = Movie_create_from_PGN(MOVIEFILE, &pgn_status);
 		if (ui.movie == NULL){
-			printf("Something went wrong. Not initializing movie.\n");
+			printf("Couldn't read %s (%s). Not initializing movie.\n", 
+				   MOVIEFILE, pgn_status == PGN_NO_FILE ? "no such file" 
+						    : pgn_status == PGN_BAD_MOVE ? "bad move" 
+							: "too long");
 			ui.is_file_movie = 0;
 			ui.movie = Movie_create();
 		}
@@ -444,13 +942,24 @@ int main(int argc, char **argv)
 
 	SDLUTIL_begin(SDL_INIT_VIDEO, &(ui.winrend), WIN_W, WIN_H, "chess");
 	UI_assign_defaults(&ui);
+	if (ui.is_file_movie)
+		movie_begin(&ui);
 
 	loop(&ui);
+	bot_cancel(&ui);
 
 	/* Destroy */
 	ChessBot_destroy(ui.bot);
 	Game_destroy(ui.game);
-	Sprite_destroy(ui.pieces_spr);
+	if (ui.board_tex != NULL)
+		SDL_DestroyTexture(ui.board_tex);
+	for (i = 0; i < MOVES_VISIBLE_LINES; i++)
+		if (ui.slots[i].tex != NULL)
+			SDL_DestroyTexture(ui.slots[i].tex);
+	free(ui.lines);
+	free(ui.spots);
+	if (ui.pieces_tex != NULL)
+		SDL_DestroyTexture(ui.pieces_tex);
 	Movie_destroy(ui.movie);
 	Font_destroy(ui.font);
 	SDLUTIL_end(&(ui.winrend));
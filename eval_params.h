@@ -0,0 +1,83 @@
+/* Parameters of pst_eval, which chess_bot.c includes this for. Written
+ * by texeltune (see texel_tune.c), which fits them to played games:
+ * regenerate rather than edit by hand, or keep the layout. */
+
+/* Piece values, indexed by ChessPiece % 6 */
+const int piece_values[6] = { 0, 900, 500, 320, 330, 100 };
+
+/* Piece-square tables, from white's side: index 0 is a8, like 
+ * piece_locations. Black looks its squares up flipped (sq ^ 56). */
+const int pst[6][64] = {
+	/* King, middlegame */
+	{ -30,-40,-40,-50,-50,-40,-40,-30,
+	  -30,-40,-40,-50,-50,-40,-40,-30,
+	  -30,-40,-40,-50,-50,-40,-40,-30,
+	  -30,-40,-40,-50,-50,-40,-40,-30,
+	  -20,-30,-30,-40,-40,-30,-30,-20,
+	  -10,-20,-20,-20,-20,-20,-20,-10,
+	   20, 20,  0,  0,  0,  0, 20, 20,
+	   20, 30, 10,  0,  0, 10, 30, 20 },
+	/* Queen */
+	{ -20,-10,-10, -5, -5,-10,-10,-20,
+	  -10,  0,  0,  0,  0,  0,  0,-10,
+	  -10,  0,  5,  5,  5,  5,  0,-10,
+	   -5,  0,  5,  5,  5,  5,  0, -5,
+	    0,  0,  5,  5,  5,  5,  0, -5,
+	  -10,  5,  5,  5,  5,  5,  0,-10,
+	  -10,  0,  5,  0,  0,  0,  0,-10,
+	  -20,-10,-10, -5, -5,-10,-10,-20 },
+	/* Rook */
+	{   0,  0,  0,  0,  0,  0,  0,  0,
+	    5, 10, 10, 10, 10, 10, 10,  5,
+	   -5,  0,  0,  0,  0,  0,  0, -5,
+	   -5,  0,  0,  0,  0,  0,  0, -5,
+	   -5,  0,  0,  0,  0,  0,  0, -5,
+	   -5,  0,  0,  0,  0,  0,  0, -5,
+	   -5,  0,  0,  0,  0,  0,  0, -5,
+	    0,  0,  0,  5,  5,  0,  0,  0 },
+	/* Knight */
+	{ -50,-40,-30,-30,-30,-30,-40,-50,
+	  -40,-20,  0,  0,  0,  0,-20,-40,
+	  -30,  0, 10, 15, 15, 10,  0,-30,
+	  -30,  5, 15, 20, 20, 15,  5,-30,
+	  -30,  0, 15, 20, 20, 15,  0,-30,
+	  -30,  5, 10, 15, 15, 10,  5,-30,
+	  -40,-20,  0,  5,  5,  0,-20,-40,
+	  -50,-40,-30,-30,-30,-30,-40,-50 },
+	/* Bishop */
+	{ -20,-10,-10,-10,-10,-10,-10,-20,
+	  -10,  0,  0,  0,  0,  0,  0,-10,
+	  -10,  0,  5, 10, 10,  5,  0,-10,
+	  -10,  5,  5, 10, 10,  5,  5,-10,
+	  -10,  0, 10, 10, 10, 10,  0,-10,
+	  -10, 10, 10, 10, 10, 10, 10,-10,
+	  -10,  5,  0,  0,  0,  0,  5,-10,
+	  -20,-10,-10,-10,-10,-10,-10,-20 },
+	/* Pawn */
+	{   0,  0,  0,  0,  0,  0,  0,  0,
+	   50, 50, 50, 50, 50, 50, 50, 50,
+	   10, 10, 20, 30, 30, 20, 10, 10,
+	    5,  5, 10, 25, 25, 10,  5,  5,
+	    0,  0,  0, 20, 20,  0,  0,  0,
+	    5, -5,-10,  0,  0,-10, -5,  5,
+	    5, 10, 10,-20,-20, 10, 10,  5,
+	    0,  0,  0,  0,  0,  0,  0,  0 }
+};
+
+/* Kings walk to the middle once the queens and most pieces are gone */
+const int king_endgame_pst[64] = {
+	-50,-40,-30,-20,-20,-30,-40,-50,
+	-30,-20,-10,  0,  0,-10,-20,-30,
+	-30,-10, 20, 30, 30, 20,-10,-30,
+	-30,-10, 30, 40, 40, 30,-10,-30,
+	-30,-10, 30, 40, 40, 30,-10,-30,
+	-30,-10, 20, 30, 30, 20,-10,-30,
+	-30,-30,  0,  0,  0,  0,-30,-30,
+	-50,-30,-30,-30,-30,-30,-30,-50 };
+
+/* Pawn structure (see pawns.h), per pawn: doubled, isolated and
+ * backward, and passed by rank from its own side */
+const int pawn_doubled = -10;
+const int pawn_isolated = -15;
+const int pawn_backward = -8;
+const int passed_pawn[8] = { 0, 5, 10, 20, 35, 60, 100, 0 };
@@ -0,0 +1,926 @@
+/* A server hosting lots of games at once, for clients to play on and
+ * ask bot moves of over a Unix socket. See game_server.h for what it
+ * speaks.
+ *
+ * One thread runs an epoll loop over every connection and answers the
+ * quick requests itself. Bot moves are searched by a pool of worker
+ * threads, which hand them back to the loop through an eventfd. Only
+ * the loop thread ever touches a session, so sessions need no locks: a
+ * worker gets a copy of the position, and the session is marked as
+ * thinking until the move comes back.
+ *
+ * An idle session is just its Position and a few bytes of bookkeeping
+ * (see the stats request). Its legal moves aren't kept, they're found
+ * again whenever a request needs them, which is far cheaper than
+ * anything else about a request.
+ *
+ * Usage: gameserver [-j workers] [-S socket_path] [-m max_bot_ms] */
+#define _GNU_SOURCE
+#include "chess_bot.h"
+#include "game_server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 256
+#define MAX_EVENTS 256
+/* Thinking time for bot requests that don't give one, and the most a
+ * request can ask for unless -m says otherwise */
+#define DEFAULT_BOT_MS 100
+#define DEFAULT_MAX_BOT_MS 10000
+/* Longest reply: a tag, then MAX_MOVES moves of up to 5 characters */
+#define REPLY_MAX (SERVER_TAG_MAX + 16 + (6 * MAX_MOVES))
+/* Most a connection's unsent replies can come to. Past CONN_OUT_PAUSE
+ * its requests aren't read until the client reads some replies, and a
+ * connection reaching CONN_OUT_MAX anyway, bots answering one that
+ * never reads, is closed. */
+#define CONN_OUT_PAUSE (1 << 16)
+#define CONN_OUT_MAX (1 << 20)
+
+/* Session ids have the session's slot in the session table in their low
+ * SLOT_BITS bits, and above them the slot's generation, which goes up
+ * every time the slot is freed so that an old id can't reach the game
+ * that took its place. */
+#define SLOT_BITS 20
+#define MAX_SESSIONS (1 << SLOT_BITS)
+
+typedef enum { SESSION_FREE, SESSION_IDLE, SESSION_THINKING,
+			   SESSION_ORPHANED } SessionState;
+
+/* One game. ORPHANED ones lost their connection while a worker was
+ * searching for them, and are freed when it's done. */
+typedef struct session_t {
+	Position pos;
+	/* As GameCondition and SessionState, a byte each */
+	unsigned char condition;
+	unsigned char state;
+	unsigned short generation;
+	/* The connection (by fd) the session belongs to, and the slots of
+	 * the sessions before and after it in that connection's list (-1 at
+	 * the ends). Free slots are chained through [next]. */
+	int owner;
+	int prev;
+	int next;
+} Session;
+
+typedef struct conn_t {
+	int fd;
+	/* What's been read but isn't a whole line yet */
+	char in[SERVER_LINE_MAX];
+	int in_length;
+	/* Replies not sent yet, from [out_sent] up to [out_length] */
+	char *out;
+	size_t out_sent;
+	size_t out_length;
+	size_t out_capacity;
+	/* Set when a reply didn't fit in CONN_OUT_MAX, or memory for it
+	 * couldn't be had, so the connection gets closed */
+	int overflowed;
+	/* What epoll is watching the socket for */
+	unsigned int events;
+	/* First of the connection's sessions, -1 if none */
+	int first_session;
+} Conn;
+
+/* A bot move to search for, [move] being filled in by the worker */
+typedef struct bot_job_t {
+	Position pos;
+	int slot;
+	long ms;
+	char tag[SERVER_TAG_MAX + 1];
+	Move move;
+	struct bot_job_t *next;
+} BotJob;
+
+typedef struct job_queue_t {
+	BotJob *head;
+	BotJob *tail;
+} JobQueue;
+
+typedef struct server_t {
+	int epoll_fd;
+	int listen_fd;
+	/* Workers write here when they've put a job in [done] */
+	int wake_fd;
+
+	/* Connections, by fd */
+	Conn **conns;
+	int conns_capacity;
+
+	Session *sessions;
+	int num_slots;
+	int slots_capacity;
+	/* Free slots, chained through Session.next, -1 if none */
+	int free_slot;
+	int num_sessions;
+	int num_thinking;
+	long max_bot_ms;
+
+	/* Guards everything below */
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	JobQueue todo;
+	JobQueue done;
+	int quitting;
+} Server;
+
+/* A worker thread, with its own bot and game to search in */
+typedef struct worker_t {
+	Server *server;
+	ChessBot *bot;
+	ChessGame *game;
+	pthread_t thread;
+	int started;
+} Worker;
+
+/* Set by SIGINT and SIGTERM */
+static volatile sig_atomic_t quit_signal = 0;
+
+void on_quit_signal(int sig)
+{
+	(void)sig;
+	quit_signal = 1;
+}
+
+
+/* JOBS */
+
+void queue_push(JobQueue *q, BotJob *job)
+{
+	job->next = NULL;
+	if (q->tail != NULL)
+		q->tail->next = job;
+	else
+		q->head = job;
+	q->tail = job;
+}
+
+/* Helper function. Takes every job out of [q], returning the first. */
+BotJob *queue_take_all(JobQueue *q)
+{
+	BotJob *jobs = q->head;
+	q->head = q->tail = NULL;
+	return jobs;
+}
+
+void *bot_worker(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	Server *s = w->server;
+	const unsigned long long one = 1;
+	BotJob *job;
+
+	for (;;){
+		pthread_mutex_lock(&s->lock);
+		while (s->todo.head == NULL && !s->quitting)
+			pthread_cond_wait(&s->work, &s->lock);
+		if (s->quitting){
+			pthread_mutex_unlock(&s->lock);
+			return NULL;
+		}
+		job = s->todo.head;
+		s->todo.head = job->next;
+		if (s->todo.head == NULL)
+			s->todo.tail = NULL;
+		pthread_mutex_unlock(&s->lock);
+
+		w->game->current_pos = job->pos;
+		Game_find_all_legal_moves(w->game);
+		w->bot->color = job->pos.to_move;
+		ChessBot_set_search(w->bot, SEARCH_ALL, SEARCH_DEFAULT_DEPTH,
+							job->ms);
+		job->move = ChessBot_find_next_move(w->bot);
+
+		pthread_mutex_lock(&s->lock);
+		queue_push(&s->done, job);
+		pthread_mutex_unlock(&s->lock);
+		while (write(s->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+			;
+	}
+}
+
+
+/* MOVES AND GAMES */
+
+/* Helper function. Writes [m] as e.g. e2e4 or e7e8q into [text], which
+ * has room for 6 characters. */
+void move_to_text(Move m, char *text)
+{
+	text[0] = 'a' + (m.src % 8);
+	text[1] = '8' - (m.src / 8);
+	text[2] = 'a' + (m.dest % 8);
+	text[3] = '8' - (m.dest / 8);
+	text[4] = '\0';
+	if (m.promoting_to >= 0 && m.promoting_to < EMT){
+		text[4] = "kqrnbp"[m.promoting_to % 6];
+		text[5] = '\0';
+	}
+}
+
+/* Helper function. Index of the legal move written as [text] in [g],
+ * whose moves have to be found, or -1 if there isn't one. */
+int move_from_text(const ChessGame *g, const char *text)
+{
+	char written[6];
+	int i;
+
+	if (strlen(text) < 4 || strlen(text) > 5)
+		return -1;
+	for (i = 0; i < g->num_possible_moves; i++){
+		move_to_text(g->current_possible_moves[i], written);
+		if (strcmp(written, text) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* Helper function. Sets up [g] at [session]'s position, its legal moves
+ * not found yet. */
+void session_game(const Session *session, ChessGame *g)
+{
+	g->current_pos = session->pos;
+	g->num_possible_moves = 0;
+	g->moves_pending = 1;
+}
+
+const char *condition_name(GameCondition condition)
+{
+	switch (condition){
+		case WHITE:
+			return "white";
+		case BLACK:
+			return "black";
+		case DRAW:
+			return "draw";
+		default:
+			return "playing";
+	}
+}
+
+
+/* CONNECTIONS */
+
+/* Helper function. Adds a line to [c]'s unsent replies. */
+void reply(Conn *c, const char *tag, const char *format, ...)
+{
+	char line[REPLY_MAX];
+	va_list args;
+	int length = snprintf(line, sizeof(line), "%s ", tag);
+
+	va_start(args, format);
+	length += vsnprintf(line + length, sizeof(line) - length - 1, format,
+						args);
+	va_end(args);
+	if (length > (int)sizeof(line) - 2)
+		length = sizeof(line) - 2;
+	line[length++] = '\n';
+
+	if (c->out_length + length > c->out_capacity && c->out_sent > 0){
+		c->out_length -= c->out_sent;
+		memmove(c->out, c->out + c->out_sent, c->out_length);
+		c->out_sent = 0;
+	}
+	if (c->out_length + length > c->out_capacity){
+		size_t capacity = 2 * (c->out_length + length);
+		char *out;
+
+		if (capacity > CONN_OUT_MAX)
+			capacity = CONN_OUT_MAX;
+		if (c->overflowed || c->out_length + length > capacity ||
+			(out = (char *) realloc(c->out, capacity)) == NULL){
+			c->overflowed = 1;
+			return;
+		}
+		c->out = out;
+		c->out_capacity = capacity;
+	}
+	memcpy(c->out + c->out_length, line, length);
+	c->out_length += length;
+}
+
+void watch(Server *s, int fd, unsigned int events, int op)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	epoll_ctl(s->epoll_fd, op, fd, &ev);
+}
+
+int set_nonblocking(int fd)
+{
+	const int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+void session_free(Server *s, int slot);
+void conn_close(Server *s, Conn *c)
+{
+	int slot = c->first_session;
+
+	/* Sessions being searched for get freed when their move is back */
+	while (slot >= 0){
+		Session *session = &s->sessions[slot];
+		const int next = session->next;
+		session->owner = session->prev = session->next = -1;
+		if (session->state == SESSION_THINKING)
+			session->state = SESSION_ORPHANED;
+		else
+			session_free(s, slot);
+		slot = next;
+	}
+
+	epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	s->conns[c->fd] = NULL;
+	free(c->out);
+	free(c);
+}
+
+/* Sends as much of [c]'s replies as the socket takes, and has epoll
+ * watch for it to take more if that wasn't all, and for more requests
+ * unless there are CONN_OUT_PAUSE bytes of replies still to go. Returns
+ * 0 if the connection had to be closed. */
+int conn_flush(Server *s, Conn *c)
+{
+	unsigned int events;
+
+	if (c->overflowed){
+		conn_close(s, c);
+		return 0;
+	}
+	while (c->out_sent < c->out_length){
+		const ssize_t sent = send(c->fd, c->out + c->out_sent,
+								  c->out_length - c->out_sent,
+								  MSG_NOSIGNAL);
+		if (sent < 0){
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			conn_close(s, c);
+			return 0;
+		}
+		c->out_sent += sent;
+	}
+	if (c->out_sent == c->out_length)
+		c->out_sent = c->out_length = 0;
+
+	events = c->out_length - c->out_sent < CONN_OUT_PAUSE ? EPOLLIN : 0;
+	if (c->out_length > 0)
+		events |= EPOLLOUT;
+	if (c->events != events){
+		c->events = events;
+		watch(s, c->fd, events, EPOLL_CTL_MOD);
+	}
+	return 1;
+}
+
+void accept_conns(Server *s)
+{
+	int fd;
+
+	while ((fd = accept(s->listen_fd, NULL, NULL)) >= 0){
+		Conn *c;
+
+		if (!set_nonblocking(fd)){
+			close(fd);
+			continue;
+		}
+		if (fd >= s->conns_capacity){
+			const int old_capacity = s->conns_capacity;
+			s->conns_capacity = 2 * fd;
+			s->conns = (Conn **) realloc(s->conns,
+									s->conns_capacity * sizeof(Conn *));
+			memset(s->conns + old_capacity, 0,
+				   (s->conns_capacity - old_capacity) * sizeof(Conn *));
+		}
+
+		c = (Conn *) malloc(sizeof(Conn));
+		memset(c, 0, sizeof(Conn));
+		c->fd = fd;
+		c->first_session = -1;
+		c->events = EPOLLIN;
+		s->conns[fd] = c;
+		watch(s, fd, EPOLLIN, EPOLL_CTL_ADD);
+	}
+}
+
+
+/* SESSIONS */
+
+unsigned long session_id(const Server *s, int slot)
+{
+	return ((unsigned long)s->sessions[slot].generation << SLOT_BITS)
+		   | slot;
+}
+
+/* Helper function. A new idle session belonging to [c], or -1 if there
+ * are MAX_SESSIONS already. */
+int session_open(Server *s, Conn *c, const ChessGame *g)
+{
+	Session *session;
+	int slot = s->free_slot;
+
+	if (slot >= 0)
+		s->free_slot = s->sessions[slot].next;
+	else {
+		if (s->num_slots == MAX_SESSIONS)
+			return -1;
+		if (s->num_slots == s->slots_capacity){
+			s->slots_capacity *= 2;
+			s->sessions = (Session *) realloc(s->sessions,
+									s->slots_capacity * sizeof(Session));
+		}
+		slot = s->num_slots++;
+		s->sessions[slot].generation = 0;
+	}
+
+	session = &s->sessions[slot];
+	session->pos = g->current_pos;
+	session->condition = Game_condition(g);
+	session->state = SESSION_IDLE;
+	session->owner = c->fd;
+	session->prev = -1;
+	session->next = c->first_session;
+	if (session->next >= 0)
+		s->sessions[session->next].prev = slot;
+	c->first_session = slot;
+	s->num_sessions++;
+	return slot;
+}
+
+void session_free(Server *s, int slot)
+{
+	Session *session = &s->sessions[slot];
+
+	if (session->owner >= 0){
+		if (session->prev >= 0)
+			s->sessions[session->prev].next = session->next;
+		else
+			s->conns[session->owner]->first_session = session->next;
+		if (session->next >= 0)
+			s->sessions[session->next].prev = session->prev;
+	}
+
+	session->state = SESSION_FREE;
+	session->generation++;
+	session->owner = -1;
+	session->next = s->free_slot;
+	s->free_slot = slot;
+	s->num_sessions--;
+}
+
+/* Helper function. The slot of [c]'s session with id [text], or -1
+ * (after replying why) if there isn't one. */
+int session_lookup(Server *s, Conn *c, const char *tag, const char *text)
+{
+	unsigned long id;
+	char extra;
+	int slot;
+
+	if (text == NULL || sscanf(text, "%lu%c", &id, &extra) != 1){
+		reply(c, tag, "err bad session id");
+		return -1;
+	}
+	slot = (int)(id & (MAX_SESSIONS - 1));
+	if (slot >= s->num_slots || session_id(s, slot) != id ||
+		s->sessions[slot].owner != c->fd){
+		reply(c, tag, "err no such session");
+		return -1;
+	}
+	return slot;
+}
+
+/* Helper function. The next space-separated word of [*rest], moving
+ * [*rest] past it, or NULL if there are no more. */
+char *next_word(char **rest)
+{
+	char *word = *rest;
+
+	while (*word == ' ')
+		word++;
+	if (*word == '\0')
+		return NULL;
+	*rest = word + strcspn(word, " ");
+	if (**rest != '\0')
+		*(*rest)++ = '\0';
+	return word;
+}
+
+
+/* REQUESTS */
+
+void request_new(Server *s, Conn *c, const char *tag, char *fen)
+{
+	ChessGame game;
+	int slot;
+
+	while (*fen == ' ')
+		fen++;
+	if (*fen == '\0')
+		Game_init(&game);
+	else if (Game_set_FEN(&game, fen) != FEN_OK){
+		reply(c, tag, "err bad fen");
+		return;
+	}
+
+	slot = session_open(s, c, &game);
+	if (slot < 0)
+		reply(c, tag, "err too many sessions");
+	else
+		reply(c, tag, "ok %lu", session_id(s, slot));
+}
+
+void request_move(Server *s, Conn *c, const char *tag, int slot,
+				  const char *text)
+{
+	Session *session = &s->sessions[slot];
+	ChessGame game;
+	int index;
+
+	if (session->state == SESSION_THINKING){
+		reply(c, tag, "err bot is thinking");
+		return;
+	}
+	if (session->condition != PLAYING){
+		reply(c, tag, "err game over");
+		return;
+	}
+
+	session_game(session, &game);
+	Game_ensure_moves(&game);
+	index = text == NULL ? -1 : move_from_text(&game, text);
+	if (index < 0){
+		reply(c, tag, "err illegal move");
+		return;
+	}
+	session->condition = Game_advanceturn_index(&game, index);
+	session->pos = game.current_pos;
+	reply(c, tag, "ok %s", condition_name(session->condition));
+}
+
+void request_bot(Server *s, Conn *c, const char *tag, int slot,
+				 const char *ms_text)
+{
+	Session *session = &s->sessions[slot];
+	long ms = DEFAULT_BOT_MS;
+	BotJob *job;
+
+	if (ms_text != NULL && (sscanf(ms_text, "%ld", &ms) != 1 || ms < 1)){
+		reply(c, tag, "err bad time");
+		return;
+	}
+	if (session->state == SESSION_THINKING){
+		reply(c, tag, "err bot is thinking");
+		return;
+	}
+	if (session->condition != PLAYING){
+		reply(c, tag, "err game over");
+		return;
+	}
+
+	job = (BotJob *) malloc(sizeof(BotJob));
+	job->pos = session->pos;
+	job->slot = slot;
+	job->ms = ms < s->max_bot_ms ? ms : s->max_bot_ms;
+	strcpy(job->tag, tag);
+	session->state = SESSION_THINKING;
+	s->num_thinking++;
+
+	pthread_mutex_lock(&s->lock);
+	queue_push(&s->todo, job);
+	pthread_cond_signal(&s->work);
+	pthread_mutex_unlock(&s->lock);
+}
+
+void request_moves(Server *s, Conn *c, const char *tag, int slot)
+{
+	char list[6 * MAX_MOVES + 1];
+	ChessGame game;
+	int length = 0;
+	int i;
+
+	session_game(&s->sessions[slot], &game);
+	Game_ensure_moves(&game);
+	list[0] = '\0';
+	for (i = 0; i < game.num_possible_moves; i++){
+		list[length++] = ' ';
+		move_to_text(game.current_possible_moves[i], list + length);
+		length += strlen(list + length);
+	}
+	reply(c, tag, "ok%s", list);
+}
+
+void request_fen(Server *s, Conn *c, const char *tag, int slot)
+{
+	char fen[FEN_MAX_LENGTH];
+	ChessGame game;
+
+	session_game(&s->sessions[slot], &game);
+	Game_get_FEN(&game, fen);
+	reply(c, tag, "ok %s", fen);
+}
+
+void handle_request(Server *s, Conn *c, char *line)
+{
+	char *tag = next_word(&line);
+	char *command = next_word(&line);
+	char *id_text;
+	int slot;
+
+	if (tag == NULL)
+		return;
+	if (strlen(tag) > SERVER_TAG_MAX){
+		tag[SERVER_TAG_MAX] = '\0';
+		reply(c, tag, "err tag too long");
+		return;
+	}
+	if (command == NULL){
+		reply(c, tag, "err no command");
+		return;
+	}
+
+	if (strcmp(command, "new") == 0){
+		request_new(s, c, tag, line);
+		return;
+	}
+	if (strcmp(command, "stats") == 0){
+		reply(c, tag, "ok sessions %d thinking %d session_bytes %lu",
+			  s->num_sessions, s->num_thinking,
+			  (unsigned long)sizeof(Session));
+		return;
+	}
+
+	id_text = next_word(&line);
+	if (strcmp(command, "move") != 0 && strcmp(command, "bot") != 0 &&
+		strcmp(command, "moves") != 0 && strcmp(command, "fen") != 0 &&
+		strcmp(command, "close") != 0){
+		reply(c, tag, "err unknown command");
+		return;
+	}
+	if ((slot = session_lookup(s, c, tag, id_text)) < 0)
+		return;
+
+	if (strcmp(command, "move") == 0)
+		request_move(s, c, tag, slot, next_word(&line));
+	else if (strcmp(command, "bot") == 0)
+		request_bot(s, c, tag, slot, next_word(&line));
+	else if (strcmp(command, "moves") == 0)
+		request_moves(s, c, tag, slot);
+	else if (strcmp(command, "fen") == 0)
+		request_fen(s, c, tag, slot);
+	else if (s->sessions[slot].state == SESSION_THINKING)
+		reply(c, tag, "err bot is thinking");
+	else {
+		session_free(s, slot);
+		reply(c, tag, "ok");
+	}
+}
+
+/* Reads what [c] sent and answers every whole line of it. Returns 0 if
+ * the connection had to be closed. */
+int conn_read(Server *s, Conn *c)
+{
+	char *line, *newline;
+	ssize_t got;
+
+	got = recv(c->fd, c->in + c->in_length,
+			   SERVER_LINE_MAX - c->in_length, 0);
+	if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+					errno == EINTR))
+		return 1;
+	if (got <= 0){
+		conn_close(s, c);
+		return 0;
+	}
+	c->in_length += got;
+
+	line = c->in;
+	while ((newline = memchr(line, '\n', c->in + c->in_length - line))
+		   != NULL){
+		*newline = '\0';
+		if (newline > line && newline[-1] == '\r')
+			newline[-1] = '\0';
+		handle_request(s, c, line);
+		line = newline + 1;
+	}
+	c->in_length -= line - c->in;
+	memmove(c->in, line, c->in_length);
+
+	/* A full buffer without a newline can't ever become a request */
+	if (c->in_length == SERVER_LINE_MAX){
+		conn_close(s, c);
+		return 0;
+	}
+	return conn_flush(s, c);
+}
+
+/* Plays the moves workers have found, and replies with them */
+void finish_jobs(Server *s)
+{
+	unsigned long long count;
+	BotJob *job, *next;
+
+	while (read(s->wake_fd, &count, sizeof(count)) < 0 && errno == EINTR)
+		;
+	pthread_mutex_lock(&s->lock);
+	job = queue_take_all(&s->done);
+	pthread_mutex_unlock(&s->lock);
+
+	for (; job != NULL; job = next){
+		Session *session = &s->sessions[job->slot];
+		next = job->next;
+		s->num_thinking--;
+
+		if (session->state == SESSION_ORPHANED)
+			session_free(s, job->slot);
+		else {
+			Conn *c = s->conns[session->owner];
+			char text[6];
+			ChessGame game;
+
+			session_game(session, &game);
+			session->condition = Game_advanceturn(&game, job->move);
+			session->pos = game.current_pos;
+			session->state = SESSION_IDLE;
+			move_to_text(job->move, text);
+			reply(c, job->tag, "ok %s %s", text,
+				  condition_name(session->condition));
+			conn_flush(s, c);
+		}
+		free(job);
+	}
+}
+
+
+/* SERVER */
+
+int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(fd, SOMAXCONN) < 0 || !set_nonblocking(fd)){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void serve(Server *s)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int n, i;
+
+	while (!quit_signal){
+		n = epoll_wait(s->epoll_fd, events, MAX_EVENTS, -1);
+		if (n < 0){
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return;
+		}
+
+		for (i = 0; i < n; i++){
+			const int fd = events[i].data.fd;
+			Conn *c;
+
+			if (fd == s->listen_fd)
+				accept_conns(s);
+			else if (fd == s->wake_fd)
+				finish_jobs(s);
+			/* Closed earlier in this batch, or the fd was reused by a
+			 * connection accepted since, which a stray read won't hurt */
+			else if ((c = s->conns[fd]) != NULL){
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+					if (!conn_read(s, c))
+						continue;
+				}
+				if (events[i].events & EPOLLOUT)
+					conn_flush(s, c);
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Server server;
+	Worker workers[MAX_WORKERS];
+	const char *path = SERVER_DEFAULT_SOCKET;
+	int num_workers = DEFAULT_WORKERS;
+	BotJob *job, *next;
+	int i;
+
+	memset(&server, 0, sizeof(server));
+	server.max_bot_ms = DEFAULT_MAX_BOT_MS;
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			num_workers = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+			path = argv[++i];
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			server.max_bot_ms = atol(argv[++i]);
+		else
+			break;
+	}
+	if (i < argc || num_workers < 1 || num_workers > MAX_WORKERS ||
+		server.max_bot_ms < 1){
+		fprintf(stderr, "usage: %s [-j workers] [-S socket_path]"
+				" [-m max_bot_ms]\n", argv[0]);
+		return 2;
+	}
+
+	server.listen_fd = listen_on(path);
+	server.wake_fd = eventfd(0, EFD_NONBLOCK);
+	server.epoll_fd = epoll_create1(0);
+	if (server.listen_fd < 0 || server.wake_fd < 0 || server.epoll_fd < 0){
+		fprintf(stderr, "couldn't listen on %s: %s\n", path,
+				strerror(errno));
+		return 1;
+	}
+	watch(&server, server.listen_fd, EPOLLIN, EPOLL_CTL_ADD);
+	watch(&server, server.wake_fd, EPOLLIN, EPOLL_CTL_ADD);
+
+	server.conns_capacity = 64;
+	server.conns = (Conn **) calloc(server.conns_capacity, sizeof(Conn *));
+	server.slots_capacity = 1024;
+	server.sessions = (Session *) malloc(server.slots_capacity
+										 * sizeof(Session));
+	server.free_slot = -1;
+	pthread_mutex_init(&server.lock, NULL);
+	pthread_cond_init(&server.work, NULL);
+
+	signal(SIGINT, on_quit_signal);
+	signal(SIGTERM, on_quit_signal);
+
+	for (i = 0; i < num_workers; i++){
+		workers[i].server = &server;
+		workers[i].game = Game_create();
+		workers[i].bot = ChessBot_create(workers[i].game, ALPHA_BETA,
+										 WHITE_MOVE, i);
+		workers[i].started = pthread_create(&workers[i].thread, NULL,
+											bot_worker, &workers[i]) == 0;
+	}
+	printf("Listening on %s with %d workers\n", path, num_workers);
+	fflush(stdout);
+
+	serve(&server);
+
+	/* Stop searches early rather than wait out their time */
+	pthread_mutex_lock(&server.lock);
+	server.quitting = 1;
+	for (i = 0; i < num_workers; i++)
+		workers[i].bot->stop = 1;
+	pthread_cond_broadcast(&server.work);
+	pthread_mutex_unlock(&server.lock);
+	for (i = 0; i < num_workers; i++){
+		if (workers[i].started)
+			pthread_join(workers[i].thread, NULL);
+		ChessBot_destroy(workers[i].bot);
+		Game_destroy(workers[i].game);
+	}
+
+	for (job = queue_take_all(&server.todo); job != NULL; job = next){
+		next = job->next;
+		free(job);
+	}
+	for (job = queue_take_all(&server.done); job != NULL; job = next){
+		next = job->next;
+		free(job);
+	}
+	for (i = 0; i < server.conns_capacity; i++)
+		if (server.conns[i] != NULL)
+			conn_close(&server, server.conns[i]);
+	free(server.conns);
+	free(server.sessions);
+	close(server.epoll_fd);
+	close(server.wake_fd);
+	close(server.listen_fd);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef GAME_SERVER_H
+#define GAME_SERVER_H
+
+/* The protocol gameserver speaks, shared with serverload.
+ *
+ * Clients connect to a Unix stream socket and send one request per
+ * line. Every request starts with a tag of the client's choosing, which
+ * the reply starts with too, since replies to bot requests come back
+ * whenever the bot is done rather than in order:
+ *
+ *   <tag> new [fen]           -> <tag> ok <id>
+ *   <tag> move <id> <move>    -> <tag> ok <condition>
+ *   <tag> bot <id> [ms]       -> <tag> ok <move> <condition>
+ *   <tag> moves <id>          -> <tag> ok [move ...]
+ *   <tag> fen <id>            -> <tag> ok <fen>
+ *   <tag> close <id>          -> <tag> ok
+ *   <tag> stats               -> <tag> ok sessions <n> thinking <n>
+ *                                       session_bytes <n>
+ *
+ * or <tag> err <reason> if a request can't be done. A new game starts
+ * from the usual position unless given a FEN. Moves are written as
+ * source and destination square, plus the piece promoted to if any
+ * (e2e4, e7e8q), and conditions as playing, white, black or draw (who
+ * won, if it's over). A session belongs to the connection that made it,
+ * and is closed along with it. */
+
+#define SERVER_DEFAULT_SOCKET "/tmp/chess_server.sock"
+
+/* Longest request line, newline included. A FEN is at most
+ * FEN_MAX_LENGTH, so this leaves plenty for the rest. */
+#define SERVER_LINE_MAX 256
+/* Longest tag */
+#define SERVER_TAG_MAX 32
+
+#endif
@@ -0,0 +1,553 @@
+#include "nnue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NNUE_X86
+#include <immintrin.h>
+#endif
+
+#define NNUE_INPUTS (2 * NNUE_HIDDEN)
+/* Most pieces there can be on the board, kings aside */
+#define MAX_FEATURES 30
+/* Clipped activations go up to this */
+#define CLIP_MAX 127
+
+
+/* KERNELS */
+
+/* The hot loops, once per kernel. Every version gives the same results
+ * bit for bit: the int16 sums wrap the same way, and the int8 products
+ * can't saturate (_mm_maddubs_epi16 adds pairs of activation x weight,
+ * at most 2 x 127 x 128, which fits in 16 bits). */
+typedef struct nnue_kernels_t {
+	/* [to] = [from] + the [num_add] rows in [add] - the [num_sub] rows
+	 * in [sub], NNUE_HIDDEN values each */
+	void (*rows)(short *to, const short *from, const short *const *add,
+				 int num_add, const short *const *sub, int num_sub);
+	/* [out] = [in] clipped to 0-CLIP_MAX, for NNUE_HIDDEN values */
+	void (*clip)(const short *in, unsigned char *out);
+	/* [sums][o] = [biases][o] + row [o] of [weights] dot [in], for
+	 * [num_out] rows of [num_in] (a multiple of 32) weights */
+	void (*affine)(const unsigned char *in, int num_in,
+				   const signed char *weights, const int *biases,
+				   int num_out, int *sums);
+} NNUEKernels;
+
+void rows_scalar(short *to, const short *from, const short *const *add,
+				 int num_add, const short *const *sub, int num_sub)
+{
+	int i, j;
+	for (i = 0; i < NNUE_HIDDEN; i++){
+		int v = from[i];
+		for (j = 0; j < num_add; j++)
+			v += add[j][i];
+		for (j = 0; j < num_sub; j++)
+			v -= sub[j][i];
+		to[i] = (short)v;
+	}
+}
+
+void clip_scalar(const short *in, unsigned char *out)
+{
+	int i;
+	for (i = 0; i < NNUE_HIDDEN; i++)
+		out[i] = in[i] < 0 ? 0 : (in[i] > CLIP_MAX ? CLIP_MAX : in[i]);
+}
+
+void affine_scalar(const unsigned char *in, int num_in,
+				   const signed char *weights, const int *biases,
+				   int num_out, int *sums)
+{
+	int o, i;
+	for (o = 0; o < num_out; o++){
+		const signed char *row = weights + (o * num_in);
+		int sum = biases[o];
+		for (i = 0; i < num_in; i++)
+			sum += in[i] * row[i];
+		sums[o] = sum;
+	}
+}
+
+#ifdef NNUE_X86
+
+#define AVX2 __attribute__((target("avx2")))
+#define SSE41 __attribute__((target("sse4.1")))
+
+AVX2 void rows_avx2(short *to, const short *from, const short *const *add,
+					int num_add, const short *const *sub, int num_sub)
+{
+	/* The whole accumulator fits in registers */
+	__m256i v[NNUE_HIDDEN / 16];
+	int i, j;
+
+	for (i = 0; i < NNUE_HIDDEN / 16; i++)
+		v[i] = _mm256_loadu_si256((const __m256i *)from + i);
+	for (j = 0; j < num_add; j++)
+		for (i = 0; i < NNUE_HIDDEN / 16; i++)
+			v[i] = _mm256_add_epi16(v[i],
+						_mm256_loadu_si256((const __m256i *)add[j] + i));
+	for (j = 0; j < num_sub; j++)
+		for (i = 0; i < NNUE_HIDDEN / 16; i++)
+			v[i] = _mm256_sub_epi16(v[i],
+						_mm256_loadu_si256((const __m256i *)sub[j] + i));
+	for (i = 0; i < NNUE_HIDDEN / 16; i++)
+		_mm256_storeu_si256((__m256i *)to + i, v[i]);
+}
+
+AVX2 void clip_avx2(const short *in, unsigned char *out)
+{
+	const __m256i max = _mm256_set1_epi8(CLIP_MAX);
+	int i;
+	for (i = 0; i < NNUE_HIDDEN / 32; i++){
+		const __m256i a = _mm256_loadu_si256((const __m256i *)in + (2 * i));
+		const __m256i b =
+			_mm256_loadu_si256((const __m256i *)in + (2 * i) + 1);
+		/* packus works within 128-bit lanes, so put the quarters back
+		 * in order after */
+		__m256i packed = _mm256_permute4x64_epi64(
+							_mm256_packus_epi16(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i *)out + i,
+							_mm256_min_epu8(packed, max));
+	}
+}
+
+AVX2 void affine_avx2(const unsigned char *in, int num_in,
+					  const signed char *weights, const int *biases,
+					  int num_out, int *sums)
+{
+	const __m256i ones = _mm256_set1_epi16(1);
+	int o, i;
+	for (o = 0; o < num_out; o++){
+		const signed char *row = weights + (o * num_in);
+		__m256i sum = _mm256_setzero_si256();
+		__m128i half;
+		for (i = 0; i < num_in; i += 32){
+			const __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+			const __m256i w = _mm256_loadu_si256((const __m256i *)(row + i));
+			sum = _mm256_add_epi32(sum, _mm256_madd_epi16(
+									_mm256_maddubs_epi16(x, w), ones));
+		}
+		half = _mm_add_epi32(_mm256_castsi256_si128(sum),
+							 _mm256_extracti128_si256(sum, 1));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+		sums[o] = biases[o] + _mm_cvtsi128_si32(half);
+	}
+}
+
+SSE41 void rows_sse41(short *to, const short *from,
+					  const short *const *add, int num_add,
+					  const short *const *sub, int num_sub)
+{
+	__m128i v[NNUE_HIDDEN / 8];
+	int i, j;
+
+	for (i = 0; i < NNUE_HIDDEN / 8; i++)
+		v[i] = _mm_loadu_si128((const __m128i *)from + i);
+	for (j = 0; j < num_add; j++)
+		for (i = 0; i < NNUE_HIDDEN / 8; i++)
+			v[i] = _mm_add_epi16(v[i],
+						_mm_loadu_si128((const __m128i *)add[j] + i));
+	for (j = 0; j < num_sub; j++)
+		for (i = 0; i < NNUE_HIDDEN / 8; i++)
+			v[i] = _mm_sub_epi16(v[i],
+						_mm_loadu_si128((const __m128i *)sub[j] + i));
+	for (i = 0; i < NNUE_HIDDEN / 8; i++)
+		_mm_storeu_si128((__m128i *)to + i, v[i]);
+}
+
+SSE41 void clip_sse41(const short *in, unsigned char *out)
+{
+	const __m128i max = _mm_set1_epi8(CLIP_MAX);
+	int i;
+	for (i = 0; i < NNUE_HIDDEN / 16; i++){
+		const __m128i a = _mm_loadu_si128((const __m128i *)in + (2 * i));
+		const __m128i b =
+			_mm_loadu_si128((const __m128i *)in + (2 * i) + 1);
+		_mm_storeu_si128((__m128i *)out + i,
+						 _mm_min_epu8(_mm_packus_epi16(a, b), max));
+	}
+}
+
+SSE41 void affine_sse41(const unsigned char *in, int num_in,
+						const signed char *weights, const int *biases,
+						int num_out, int *sums)
+{
+	const __m128i ones = _mm_set1_epi16(1);
+	int o, i;
+	for (o = 0; o < num_out; o++){
+		const signed char *row = weights + (o * num_in);
+		__m128i sum = _mm_setzero_si128();
+		for (i = 0; i < num_in; i += 16){
+			const __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+			const __m128i w = _mm_loadu_si128((const __m128i *)(row + i));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(
+									_mm_maddubs_epi16(x, w), ones));
+		}
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+		sums[o] = biases[o] + _mm_cvtsi128_si32(sum);
+	}
+}
+
+const NNUEKernels kernels[3] = {
+	{ rows_scalar, clip_scalar, affine_scalar },
+	{ rows_sse41, clip_sse41, affine_sse41 },
+	{ rows_avx2, clip_avx2, affine_avx2 }
+};
+
+#else
+
+const NNUEKernels kernels[3] = {
+	{ rows_scalar, clip_scalar, affine_scalar },
+	{ rows_scalar, clip_scalar, affine_scalar },
+	{ rows_scalar, clip_scalar, affine_scalar }
+};
+
+#endif
+
+NNUEKernel NNUE_best_kernel()
+{
+#ifdef NNUE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return NNUE_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return NNUE_SSE41;
+#endif
+	return NNUE_SCALAR;
+}
+
+const char *NNUE_kernel_name(NNUEKernel kernel)
+{
+	switch (kernel){
+		case NNUE_AVX2:
+			return "avx2";
+		case NNUE_SSE41:
+			return "sse4.1";
+		default:
+			return "scalar";
+	}
+}
+
+
+
+/* ACCUMULATORS */
+
+/* Helper function. Index of the feature for [piece] on [sq], from
+ * [side]'s point of view with its king on [king]. */
+int feature_index(int side, int king, ChessPiece piece, int sq)
+{
+	const int flip = side == WHITE_MOVE ? 0 : 56;
+	const int theirs = piece / 6 == side ? 0 : 5;
+	return ((((king ^ flip) * 10) + theirs + (piece % 6) - 1) * 64)
+		   + (sq ^ flip);
+}
+
+/* Helper function. Sums [side]'s half of [acc] from scratch. */
+void refresh_side(const NNUE *net, const Position *p, int side,
+				  NNUEAccumulator *acc)
+{
+	const short *add[MAX_FEATURES];
+	const int king = side == WHITE_MOVE ? p->white_kingsrc
+										: p->black_kingsrc;
+	SquareSet pieces = (p->color_sets[0] | p->color_sets[1])
+					   & ~(p->piece_sets[W_K] | p->piece_sets[B_K]);
+	int num_add = 0;
+
+	while (pieces && num_add < MAX_FEATURES){
+		const int sq = SQUARESET_FIRST(pieces);
+		pieces &= pieces - 1;
+		add[num_add++] = net->ft_weights[feature_index(side, king,
+										p->piece_locations[sq], sq)];
+	}
+	kernels[net->kernel].rows(acc->values[side], net->ft_biases, add,
+							  num_add, NULL, 0);
+}
+
+void NNUE_refresh(const NNUE *net, const Position *p, NNUEAccumulator *acc)
+{
+	refresh_side(net, p, WHITE_MOVE, acc);
+	refresh_side(net, p, BLACK_MOVE, acc);
+}
+
+void NNUE_update(const NNUE *net, const NNUEAccumulator *parent,
+				 const Position *p, const PositionUndo *undo,
+				 NNUEAccumulator *acc)
+{
+	int side, i;
+
+	for (side = 0; side < 2; side++){
+		const short *add[4];
+		const short *sub[4];
+		int num_add = 0;
+		int num_sub = 0;
+		const int king = side == WHITE_MOVE ? p->white_kingsrc
+											: p->black_kingsrc;
+		const int old_king = side == WHITE_MOVE ? undo->white_kingsrc
+												: undo->black_kingsrc;
+
+		/* Every feature of this side hangs off where its king is */
+		if (king != old_king){
+			refresh_side(net, p, side, acc);
+			continue;
+		}
+
+		for (i = 0; i < undo->num_changes; i++){
+			const int sq = undo->changed_squares[i];
+			const ChessPiece old_piece = undo->old_pieces[i];
+			const ChessPiece new_piece = p->piece_locations[sq];
+			if (old_piece != EMT && old_piece % 6 != W_K)
+				sub[num_sub++] = net->ft_weights[feature_index(side, king,
+															old_piece, sq)];
+			if (new_piece != EMT && new_piece % 6 != W_K)
+				add[num_add++] = net->ft_weights[feature_index(side, king,
+															new_piece, sq)];
+		}
+		kernels[net->kernel].rows(acc->values[side], parent->values[side],
+								  add, num_add, sub, num_sub);
+	}
+}
+
+
+
+/* EVAL */
+
+/* Helper function. Clips each of [n] layer sums into [out], shifted
+ * down by NNUE_WEIGHT_SHIFT first. */
+void clip_sums(const int *sums, int n, unsigned char *out)
+{
+	int i;
+	for (i = 0; i < n; i++){
+		const int v = sums[i] <= 0 ? 0 : sums[i] >> NNUE_WEIGHT_SHIFT;
+		out[i] = v > CLIP_MAX ? CLIP_MAX : v;
+	}
+}
+
+int NNUE_evaluate(const NNUE *net, const NNUEAccumulator *acc, int to_move)
+{
+	const NNUEKernels *k = &kernels[net->kernel];
+	unsigned char input[NNUE_INPUTS];
+	unsigned char hidden1[NNUE_L1];
+	unsigned char hidden2[NNUE_L2];
+	int sums[NNUE_L1 > NNUE_L2 ? NNUE_L1 : NNUE_L2];
+	int out;
+
+	k->clip(acc->values[to_move], input);
+	k->clip(acc->values[1 - to_move], input + NNUE_HIDDEN);
+
+	k->affine(input, NNUE_INPUTS, &net->l1_weights[0][0], net->l1_biases,
+			  NNUE_L1, sums);
+	clip_sums(sums, NNUE_L1, hidden1);
+	k->affine(hidden1, NNUE_L1, &net->l2_weights[0][0], net->l2_biases,
+			  NNUE_L2, sums);
+	clip_sums(sums, NNUE_L2, hidden2);
+	k->affine(hidden2, NNUE_L2, net->out_weights, &net->out_bias, 1, &out);
+
+	return out / NNUE_OUTPUT_SCALE;
+}
+
+int NNUE_eval(const NNUE *net, const Position *p)
+{
+	NNUEAccumulator acc;
+	NNUE_refresh(net, p, &acc);
+	return NNUE_evaluate(net, &acc, p->to_move);
+}
+
+
+
+/* WEIGHTS */
+
+/* One array of a net as it is in a weight file: [count] numbers of
+ * [bytes] bytes each */
+typedef struct nnue_field_t {
+	void *data;
+	long count;
+	int bytes;
+} NNUEField;
+
+#define NUM_FIELDS 8
+
+/* Helper function. [net]'s arrays, in weight file order. */
+void net_fields(const NNUE *net, NNUEField *fields)
+{
+	NNUE *n = (NNUE *)net;
+	NNUEField all[NUM_FIELDS];
+
+	all[0].data = n->ft_biases;
+	all[0].count = NNUE_HIDDEN;
+	all[0].bytes = 2;
+	all[1].data = n->ft_weights;
+	all[1].count = (long)NNUE_FEATURES * NNUE_HIDDEN;
+	all[1].bytes = 2;
+	all[2].data = n->l1_biases;
+	all[2].count = NNUE_L1;
+	all[2].bytes = 4;
+	all[3].data = n->l1_weights;
+	all[3].count = NNUE_L1 * NNUE_INPUTS;
+	all[3].bytes = 1;
+	all[4].data = n->l2_biases;
+	all[4].count = NNUE_L2;
+	all[4].bytes = 4;
+	all[5].data = n->l2_weights;
+	all[5].count = NNUE_L2 * NNUE_L1;
+	all[5].bytes = 1;
+	all[6].data = &n->out_bias;
+	all[6].count = 1;
+	all[6].bytes = 4;
+	all[7].data = n->out_weights;
+	all[7].count = NNUE_L2;
+	all[7].bytes = 1;
+	memcpy(fields, all, sizeof(all));
+}
+
+/* Helper function. Reads a little-endian number of [bytes] bytes from
+ * [f] into [*value], sign extended. Returns 0 at the end of the file. */
+int read_le(FILE *f, int bytes, long *value)
+{
+	unsigned char buffer[4];
+	unsigned long v = 0;
+	int i;
+
+	if (fread(buffer, 1, bytes, f) != (size_t)bytes)
+		return 0;
+	for (i = bytes - 1; i >= 0; i--)
+		v = (v << 8) | buffer[i];
+	*value = (v & (1UL << ((8 * bytes) - 1))) ?
+			 (long)v - (long)(1UL << ((8 * bytes) - 1)) * 2 : (long)v;
+	return 1;
+}
+
+void write_le(FILE *f, int bytes, long value)
+{
+	unsigned char buffer[4];
+	int i;
+	for (i = 0; i < bytes; i++)
+		buffer[i] = (unsigned char)((unsigned long)value >> (8 * i));
+	fwrite(buffer, 1, bytes, f);
+}
+
+NNUE *NNUE_load(const char *filename, NNUEStatus *status)
+{
+	const long sizes[4] = { NNUE_FEATURES, NNUE_HIDDEN, NNUE_L1, NNUE_L2 };
+	NNUEField fields[NUM_FIELDS];
+	char magic[8];
+	FILE *f = fopen(filename, "rb");
+	NNUE *net;
+	long value, i;
+	int field;
+
+	if (f == NULL){
+		*status = NNUE_NO_FILE;
+		return NULL;
+	}
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, NNUE_MAGIC, 8) != 0){
+		*status = NNUE_BAD_HEADER;
+		fclose(f);
+		return NULL;
+	}
+	for (i = 0; i < 4; i++)
+		if (!read_le(f, 4, &value) || value != sizes[i]){
+			*status = NNUE_BAD_HEADER;
+			fclose(f);
+			return NULL;
+		}
+
+	net = (NNUE *) malloc(sizeof(NNUE));
+	net_fields(net, fields);
+	for (field = 0; field < NUM_FIELDS; field++)
+		for (i = 0; i < fields[field].count; i++){
+			if (!read_le(f, fields[field].bytes, &value)){
+				*status = NNUE_TRUNCATED;
+				free(net);
+				fclose(f);
+				return NULL;
+			}
+			if (fields[field].bytes == 1)
+				((signed char *)fields[field].data)[i] = (signed char)value;
+			else if (fields[field].bytes == 2)
+				((short *)fields[field].data)[i] = (short)value;
+			else
+				((int *)fields[field].data)[i] = (int)value;
+		}
+
+	fclose(f);
+	net->kernel = NNUE_best_kernel();
+	*status = NNUE_OK;
+	return net;
+}
+
+int NNUE_save(const NNUE *net, const char *filename)
+{
+	const long sizes[4] = { NNUE_FEATURES, NNUE_HIDDEN, NNUE_L1, NNUE_L2 };
+	NNUEField fields[NUM_FIELDS];
+	FILE *f = fopen(filename, "wb");
+	long i;
+	int field, ok;
+
+	if (f == NULL)
+		return 0;
+	fwrite(NNUE_MAGIC, 1, 8, f);
+	for (i = 0; i < 4; i++)
+		write_le(f, 4, sizes[i]);
+
+	net_fields(net, fields);
+	for (field = 0; field < NUM_FIELDS; field++)
+		for (i = 0; i < fields[field].count; i++){
+			const NNUEField *fd = &fields[field];
+			write_le(f, fd->bytes, fd->bytes == 1 ?
+					 ((signed char *)fd->data)[i] : (fd->bytes == 2 ?
+					 ((short *)fd->data)[i] : ((int *)fd->data)[i]));
+		}
+
+	ok = !ferror(f);
+	return fclose(f) == 0 && ok;
+}
+
+/* Helper function. splitmix64, for random nets. A number from [low]
+ * up to [high], inclusive. */
+long random_between(unsigned long long *state, long low, long high)
+{
+	unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	return low + (long)(z % (unsigned long long)(high - low + 1));
+}
+
+NNUE *NNUE_create_random(unsigned long long seed)
+{
+	NNUE *net = (NNUE *) malloc(sizeof(NNUE));
+	short *ft = &net->ft_weights[0][0];
+	long i;
+
+	/* Ranges that keep the layers mostly off their clipping limits, so
+	 * every path gets used */
+	for (i = 0; i < NNUE_HIDDEN; i++)
+		net->ft_biases[i] = (short)random_between(&seed, 0, 64);
+	for (i = 0; i < (long)NNUE_FEATURES * NNUE_HIDDEN; i++)
+		ft[i] = (short)random_between(&seed, -16, 16);
+	for (i = 0; i < NNUE_L1; i++)
+		net->l1_biases[i] = (int)random_between(&seed, -2000, 4000);
+	for (i = 0; i < NNUE_L1 * NNUE_INPUTS; i++)
+		(&net->l1_weights[0][0])[i] = (signed char)random_between(&seed,
+																-128, 127);
+	for (i = 0; i < NNUE_L2; i++)
+		net->l2_biases[i] = (int)random_between(&seed, -2000, 4000);
+	for (i = 0; i < NNUE_L2 * NNUE_L1; i++)
+		(&net->l2_weights[0][0])[i] = (signed char)random_between(&seed,
+																-128, 127);
+	net->out_bias = (int)random_between(&seed, -1000, 1000);
+	for (i = 0; i < NNUE_L2; i++)
+		net->out_weights[i] = (signed char)random_between(&seed, -128, 127);
+
+	net->kernel = NNUE_best_kernel();
+	return net;
+}
+
+void NNUE_destroy(NNUE *net)
+{
+	free(net);
+}
@@ -0,0 +1,96 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include "chess.h"
+
+/* Efficiently updatable neural network eval.
+ *
+ * The input is, from each side's point of view, which of its own and
+ * the other side's pieces (kings aside) are on which squares, given
+ * where its own king is: 64 king squares x 10 pieces x 64 squares.
+ * Black sees the board flipped, so both sides look at it the same way.
+ * The first layer (the feature transformer) sums one row of weights per
+ * piece on the board into an accumulator per side, which a move only
+ * changes by a few rows, so it's carried along from position to
+ * position with NNUE_update instead of being summed from scratch (a
+ * side's king moving is the exception: all of its rows change then).
+ *
+ * The rest is small, and quantized to run fast on plain CPUs:
+ *   accumulators, int16, clipped to 0-127, side to move first: 256
+ *   -> 32 (int8 weights) -> clipped, 0-127
+ *   -> 32 (int8 weights) -> clipped, 0-127
+ *   -> 1 (int8 weights), divided by NNUE_OUTPUT_SCALE into centipawns
+ * Each hidden layer's sums are shifted down by NNUE_WEIGHT_SHIFT before
+ * clipping. There are AVX2 and SSE4.1 versions of the hot loops as well
+ * as plain C, picked when the net is made by what the CPU can do; all
+ * give exactly the same numbers.
+ *
+ * A net is only read once made, so threads can share one. */
+
+#define NNUE_FEATURES (64 * 10 * 64)
+#define NNUE_HIDDEN 128
+#define NNUE_L1 32
+#define NNUE_L2 32
+#define NNUE_WEIGHT_SHIFT 6
+#define NNUE_OUTPUT_SCALE 16
+
+/* Weight files: NNUE_MAGIC, the four sizes above as 32-bit numbers,
+ * then every array of NNUE in the order declared, all little-endian. */
+#define NNUE_MAGIC "CHNNUE01"
+
+typedef enum { NNUE_SCALAR, NNUE_SSE41, NNUE_AVX2 } NNUEKernel;
+
+/* Result of reading a weight file: NNUE_BAD_HEADER if it isn't one or
+ * is for a different size of net, NNUE_TRUNCATED if it ends early. */
+typedef enum { NNUE_OK, NNUE_NO_FILE, NNUE_BAD_HEADER,
+			   NNUE_TRUNCATED } NNUEStatus;
+
+typedef struct nnue_t {
+	short ft_biases[NNUE_HIDDEN];
+	short ft_weights[NNUE_FEATURES][NNUE_HIDDEN];
+	int l1_biases[NNUE_L1];
+	signed char l1_weights[NNUE_L1][2 * NNUE_HIDDEN];
+	int l2_biases[NNUE_L2];
+	signed char l2_weights[NNUE_L2][NNUE_L1];
+	int out_bias;
+	signed char out_weights[NNUE_L2];
+
+	/* Which version of the hot loops to run. Starts out as
+	 * NNUE_best_kernel(), and can be set lower (never higher). */
+	NNUEKernel kernel;
+} NNUE;
+
+/* The first layer's output for a position, [WHITE_MOVE] and
+ * [BLACK_MOVE] from each side's point of view */
+typedef struct nnue_accumulator_t {
+	short values[2][NNUE_HIDDEN];
+} NNUEAccumulator;
+
+/* Reads a net from a weight file, NULL (and why in [status]) if it
+ * can't. NNUE_save writes one, returning 0 if it couldn't. */
+NNUE *NNUE_load(const char *filename, NNUEStatus *status);
+int NNUE_save(const NNUE *net, const char *filename);
+/* A net of random weights from [seed], for benchmarks and tests: it
+ * plays nonsense, but exercises everything. */
+NNUE *NNUE_create_random(unsigned long long seed);
+void NNUE_destroy(NNUE *net);
+
+/* Best kernel this CPU can run, and a name for a kernel */
+NNUEKernel NNUE_best_kernel();
+const char *NNUE_kernel_name(NNUEKernel kernel);
+
+/* Sums [acc] from scratch for position [p]. */
+void NNUE_refresh(const NNUE *net, const Position *p, NNUEAccumulator *acc);
+/* Sets [acc] for position [p], which Position_make_move got to from the
+ * position [parent] is for, given the move's [undo]. Only the rows the
+ * move changed are added and taken away. [acc] and [parent] can be the
+ * same. */
+void NNUE_update(const NNUE *net, const NNUEAccumulator *parent,
+				 const Position *p, const PositionUndo *undo,
+				 NNUEAccumulator *acc);
+/* The eval, in centipawns for [to_move], from [acc] */
+int NNUE_evaluate(const NNUE *net, const NNUEAccumulator *acc, int to_move);
+/* Same, summing the accumulator from scratch */
+int NNUE_eval(const NNUE *net, const Position *p);
+
+#endif
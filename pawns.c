@@ -0,0 +1,84 @@
+#include "pawns.h"
+#include <string.h>
+
+#define FILE_A_SET 0x0101010101010101ULL
+#define FILE_H_SET (FILE_A_SET << 7)
+#define RANK_8_SET 0xFFULL
+
+/* Helper functions. [set] moved a square toward the h file (east) or
+ * the a file (west), dropping what goes off the board, and every square
+ * from [set] on toward rank 8 (north, row 0) or rank 1 (south). */
+SquareSet east_of(SquareSet set)
+{
+	return (set & ~FILE_H_SET) << 1;
+}
+
+SquareSet west_of(SquareSet set)
+{
+	return (set & ~FILE_A_SET) >> 1;
+}
+
+SquareSet fill_north(SquareSet set)
+{
+	set |= set >> 8;
+	set |= set >> 16;
+	return set | (set >> 32);
+}
+
+SquareSet fill_south(SquareSet set)
+{
+	set |= set << 8;
+	set |= set << 16;
+	return set | (set << 32);
+}
+
+void PawnStructure_find(PawnStructure *s, SquareSet white_pawns,
+						SquareSet black_pawns)
+{
+	SquareSet pawns[2], attacks[2], stops[2], blocked[2], supported[2];
+	int color;
+
+	memset(s->passed_by_rank, 0, sizeof(s->passed_by_rank));
+	pawns[WHITE_MOVE] = white_pawns;
+	pawns[BLACK_MOVE] = black_pawns;
+
+	/* All worked out a whole set at a time. White pawns go north and
+	 * black ones south, so for white: a pawn's stop square is the one
+	 * north of it; it's passed if no enemy pawn is on any square north
+	 * of it on its file or either file beside it, and can be supported
+	 * if one of its own is beside it or south of that. */
+	attacks[WHITE_MOVE] = east_of(white_pawns >> 8) | west_of(white_pawns >> 8);
+	attacks[BLACK_MOVE] = east_of(black_pawns << 8) | west_of(black_pawns << 8);
+	stops[WHITE_MOVE] = attacks[BLACK_MOVE] << 8;
+	stops[BLACK_MOVE] = attacks[WHITE_MOVE] >> 8;
+	blocked[WHITE_MOVE] = fill_south(black_pawns | east_of(black_pawns) 
+									 | west_of(black_pawns)) << 8;
+	blocked[BLACK_MOVE] = fill_north(white_pawns | east_of(white_pawns) 
+									 | west_of(white_pawns)) >> 8;
+	supported[WHITE_MOVE] = fill_north(east_of(white_pawns) 
+									   | west_of(white_pawns));
+	supported[BLACK_MOVE] = fill_south(east_of(black_pawns) 
+									   | west_of(black_pawns));
+
+	for (color = 0; color < 2; color++){
+		const SquareSet own = pawns[color];
+		const SquareSet files = fill_north(fill_south(own));
+		const SquareSet isolated = own & ~east_of(files) & ~west_of(files);
+		SquareSet passed = own & ~blocked[color];
+
+		/* Every pawn but one per file it's on */
+		s->doubled[color] = SQUARESET_COUNT(own) 
+							- SQUARESET_COUNT(files & RANK_8_SET);
+		s->isolated[color] = SQUARESET_COUNT(isolated);
+		s->backward[color] = SQUARESET_COUNT(own & ~isolated
+											 & ~supported[color]
+											 & stops[color]);
+
+		s->passed[color] = passed;
+		while (passed){
+			const int row = SQUARESET_FIRST(passed) / 8;
+			passed &= passed - 1;
+			s->passed_by_rank[color][color == WHITE_MOVE ? 7 - row : row]++;
+		}
+	}
+}
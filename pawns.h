@@ -0,0 +1,33 @@
+#ifndef PAWNS_H
+#define PAWNS_H
+
+#include "chess.h"
+
+/* Pawn structure: what the pawns alone say about a position. It only
+ * changes when a pawn moves or is taken, so evals work it out once per
+ * pawn_key (see Position) and keep it in a pawn hash table.
+ *
+ * Per color, pawns are counted as:
+ *   doubled   each one past the first on its file
+ *   isolated  no pawn of its color on either file beside it
+ *   backward  not isolated, but every pawn beside it is further up the
+ *             board, so none can come to its defence, and the square in
+ *             front of it is attacked by an enemy pawn
+ *   passed    no enemy pawn in front of it on its own file or either
+ *             file beside it */
+typedef struct pawn_structure_t {
+	SquareSet passed[2];
+	int doubled[2];
+	int isolated[2];
+	int backward[2];
+	/* Passed pawns of each color by rank, counted from the color's own
+	 * side (0 is white's first rank for white, black's for black) */
+	int passed_by_rank[2][8];
+} PawnStructure;
+
+/* Fills [s] for [white_pawns] and [black_pawns] (a Position's
+ * piece_sets[W_P] and piece_sets[B_P]). */
+void PawnStructure_find(PawnStructure *s, SquareSet white_pawns,
+						SquareSet black_pawns);
+
+#endif
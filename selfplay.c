@@ -0,0 +1,513 @@
+/* Self-play training data (see train_data.h for the records).
+ *
+ * Plays games between ALPHA_BETA bots on [workers] threads, much like
+ * bot_fighter's tournaments: OPENING_PLIES random moves first, so that
+ * games differ, then both sides search to [depth]. After the opening,
+ * one position in [sample_every] is kept, unless the side to move is in
+ * check, the move found is a capture or promotion, or the score is a
+ * mate (the eval can't learn anything from those); once the game is
+ * over (or called, see MAX_PLIES), the kept positions are written with
+ * their scores and its result. Game g of worker k gets its random moves from seed
+ * [seed] + k * 2^32 + g, so any game can be played again.
+ *
+ * Worker k writes shard_k.bin in [out_dir], through a buffer of
+ * FLUSH_RECORDS records, and after every flush notes in shard_k.idx
+ * how many records and games of it are complete. With -r, shards pick
+ * up from there: anything written after the last flush is cut off, and
+ * games go on from the next one, so a run killed at any point can be
+ * resumed without losing or repeating games (with the same -j and -s).
+ *
+ * With -u, a position already written (in this run, or by the run being
+ * resumed) isn't written again: the workers share a table of
+ * 2^[dedupe_bits] position keys. Once it's 3/4 full, new positions are
+ * no longer remembered, so duplicates can get through after that.
+ * Since the table is shared, which worker's copy of a position is kept
+ * depends on how the threads happen to run, so unlike without -u, the
+ * shards aren't the same from one run to the next (each game is still
+ * the same game, given its seed).
+ *
+ * Usage: selfplay [-j workers] [-o out_dir] [-p positions] [-d depth]
+ *                 [-e sample_every] [-u dedupe_bits] [-s seed]
+ *                 [-n weights] [-r] */
+#define _POSIX_C_SOURCE 200809L
+#include "chess_bot.h"
+#include "train_data.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 256
+#define DEFAULT_POSITIONS 100000
+#define DEFAULT_DEPTH 4
+#define DEFAULT_SAMPLE_EVERY 4
+#define OPENING_PLIES 8
+/* Games this long are called a draw, and so is a threefold repetition.
+ * A game is also called once both sides' searches have had one side at
+ * least ADJUDICATE_SCORE up for ADJUDICATE_PLIES plies in a row. */
+#define MAX_PLIES 400
+#define ADJUDICATE_SCORE 1000
+#define ADJUDICATE_PLIES 8
+/* Scores past this are mates (see SearchStats) */
+#define MATE_SCORE_BOUND 29000
+/* Records buffered per worker before they're written */
+#define FLUSH_RECORDS 4096
+#define MAX_DEDUPE_BITS 34
+#define PROGRESS_SECONDS 10
+
+/* Position keys already written, shared by all workers. 0 is empty. */
+typedef struct dedupe_table_t {
+	unsigned long long *keys;
+	unsigned long long mask;
+	/* Keys in the table, and how many it takes before it stops taking
+	 * more */
+	volatile long used;
+	long limit;
+} DedupeTable;
+
+/* Settings every worker shares */
+typedef struct selfplay_t {
+	const char *out_dir;
+	long shard_positions;
+	int depth;
+	int sample_every;
+	unsigned long long seed;
+	int resume;
+	const NNUE *net;
+	/* NULL if not deduplicating */
+	DedupeTable *dedupe;
+	/* Workers done so far, signalling [done] as each one finishes */
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	int finished;
+} SelfPlay;
+
+typedef struct worker_t {
+	pthread_t thread;
+	SelfPlay *sp;
+	int shard;
+	char path[512];
+	char index_path[512];
+	FILE *out;
+
+	/* Records and games complete in the shard, and how many records
+	 * were already there when resuming */
+	volatile long records;
+	long games;
+	long resumed;
+	/* Records waiting to be written */
+	TrainRecord *buffer;
+	int buffered;
+
+	long duplicates;
+	int failed;
+	/* When it was done, by now_seconds */
+	double finish_seconds;
+} Worker;
+
+
+/* DEDUPE */
+
+/* Helper function. Adds [key] to [t]. Returns 0 if it was already
+ * there. */
+int dedupe_insert(DedupeTable *t, unsigned long long key)
+{
+	unsigned long long slot = key & t->mask;
+
+	for (;;){
+		const unsigned long long old = t->keys[slot];
+		if (old == key)
+			return 0;
+		if (old == 0){
+			if (t->used >= t->limit)
+				return 1;
+			if (__sync_bool_compare_and_swap(&t->keys[slot], 0, key)){
+				__sync_fetch_and_add(&t->used, 1);
+				return 1;
+			}
+			/* Someone else took the slot first: look at it again */
+			continue;
+		}
+		slot = (slot + 1) & t->mask;
+	}
+}
+
+DedupeTable *dedupe_create(int bits)
+{
+	DedupeTable *t = (DedupeTable *) malloc(sizeof(DedupeTable));
+	t->keys = (unsigned long long *) calloc((size_t)1 << bits,
+											sizeof(unsigned long long));
+	if (t->keys == NULL){
+		free(t);
+		return NULL;
+	}
+	t->mask = ((unsigned long long)1 << bits) - 1;
+	t->used = 0;
+	t->limit = (long)(3 * (t->mask + 1) / 4);
+	return t;
+}
+
+void dedupe_destroy(DedupeTable *t)
+{
+	free(t->keys);
+	free(t);
+}
+
+
+/* SHARDS */
+
+/* Helper function. Notes how much of [w]'s shard is complete, in a
+ * file that's swapped in whole. Returns 0 if it couldn't. */
+int write_index(Worker *w)
+{
+	char tmp_path[520];
+	FILE *f;
+
+	sprintf(tmp_path, "%s.tmp", w->index_path);
+	f = fopen(tmp_path, "w");
+	if (f == NULL)
+		return 0;
+	fprintf(f, "%ld %ld\n", w->records, w->games);
+	if (fclose(f) != 0)
+		return 0;
+	return rename(tmp_path, w->index_path) == 0;
+}
+
+/* Helper function. Writes [w]'s buffered records out, then the index.
+ * Only called between games, so the index always ends on a game. */
+int flush_records(Worker *w)
+{
+	if (w->buffered > 0 &&
+		fwrite(w->buffer, sizeof(TrainRecord), w->buffered, w->out)
+		!= (size_t)w->buffered)
+		return 0;
+	if (fflush(w->out) != 0)
+		return 0;
+	w->records += w->buffered;
+	w->buffered = 0;
+	return write_index(w);
+}
+
+/* Helper function. Opens [w]'s shard: empty, or if resuming, cut back
+ * to what its index says is complete, with its positions put in the
+ * dedupe table. Returns 0 if it couldn't. */
+int open_shard(Worker *w)
+{
+	SelfPlay *sp = w->sp;
+	FILE *f;
+
+	sprintf(w->path, "%s/shard_%03d.bin", sp->out_dir, w->shard);
+	sprintf(w->index_path, "%s/shard_%03d.idx", sp->out_dir, w->shard);
+	w->records = 0;
+	w->games = 0;
+	w->resumed = 0;
+
+	if (sp->resume && (f = fopen(w->index_path, "r")) != NULL){
+		if (fscanf(f, "%ld %ld", &w->records, &w->games) != 2)
+			w->records = w->games = 0;
+		fclose(f);
+	}
+	if (w->records == 0){
+		w->out = fopen(w->path, "wb");
+		return w->out != NULL && write_index(w);
+	}
+
+	if (truncate(w->path, w->records * (long)sizeof(TrainRecord)) != 0)
+		return 0;
+	w->resumed = w->records;
+	if (sp->dedupe != NULL){
+		TrainRecord r;
+		f = fopen(w->path, "rb");
+		if (f == NULL)
+			return 0;
+		while (fread(&r, sizeof(TrainRecord), 1, f) == 1)
+			dedupe_insert(sp->dedupe, TrainRecord_key(&r));
+		fclose(f);
+	}
+	w->out = fopen(w->path, "ab");
+	return w->out != NULL;
+}
+
+
+/* GAMES */
+
+/* Helper function. True if the position after [ply] plies has come up
+ * twice before in [history], since the last capture or pawn move. */
+int threefold(const Position *history, int ply)
+{
+	const Position *p = &history[ply];
+	int seen = 0;
+	int i;
+	for (i = ply - 2; i >= 0 && i >= ply - p->halfmove_clock; i -= 2)
+		if (history[i].to_move == p->to_move &&
+			memcmp(history[i].piece_locations, p->piece_locations, 64) == 0)
+			seen++;
+	return seen >= 2;
+}
+
+/* Helper function. Plays one game from [seed], and buffers its kept
+ * positions into [w]. [history] has room for every position of it. */
+void play_game(Worker *w, ChessGame *game, Position *history, 
+			   Position *kept, int *scores, unsigned long long seed)
+{
+	SelfPlay *sp = w->sp;
+	ChessBot *opener;
+	ChessBot *bot;
+	GameCondition status = PLAYING;
+	int num_kept = 0;
+	/* Plies in a row that one side has been way up, positive for 
+	 * white */
+	int decided = 0;
+	int ply, i;
+
+	Game_init(game);
+	opener = ChessBot_create(game, RANDOM_MOVE, WHITE_MOVE, seed);
+	bot = ChessBot_create(game, ALPHA_BETA, WHITE_MOVE, seed);
+	ChessBot_set_search(bot, SEARCH_ALL, sp->depth, 0);
+	ChessBot_set_net(bot, sp->net);
+
+	history[0] = game->current_pos;
+	for (ply = 0; status == PLAYING && ply < MAX_PLIES; ply++){
+		Move m;
+		if (ply < OPENING_PLIES)
+			m = ChessBot_find_next_move(opener);
+		else {
+			const Position *p = &game->current_pos;
+			int score, white_score;
+
+			m = ChessBot_find_next_move(bot);
+			score = bot->last_search.score;
+			if (ChessBot_random(opener) % sp->sample_every == 0 &&
+				!Position_in_check(p) && !Move_is_capture(m, p) &&
+				m.promoting_to == EMT && score < MATE_SCORE_BOUND &&
+				score > -MATE_SCORE_BOUND){
+				kept[num_kept] = *p;
+				scores[num_kept++] = score;
+			}
+
+			white_score = p->to_move == WHITE_MOVE ? score : -score;
+			if (white_score >= ADJUDICATE_SCORE)
+				decided = decided > 0 ? decided + 1 : 1;
+			else if (white_score <= -ADJUDICATE_SCORE)
+				decided = decided < 0 ? decided - 1 : -1;
+			else
+				decided = 0;
+		}
+		status = Game_advanceturn(game, m);
+		history[ply + 1] = game->current_pos;
+		if (status == PLAYING && threefold(history, ply + 1))
+			status = DRAW;
+		else if (status == PLAYING && decided >= ADJUDICATE_PLIES)
+			status = WHITE;
+		else if (status == PLAYING && decided <= -ADJUDICATE_PLIES)
+			status = BLACK;
+	}
+	if (status == PLAYING)
+		status = DRAW;
+
+	for (i = 0; i < num_kept; i++){
+		TrainRecord *r = &w->buffer[w->buffered];
+		TrainRecord_pack(r, &kept[i], scores[i], status);
+		if (sp->dedupe != NULL &&
+			!dedupe_insert(sp->dedupe, TrainRecord_key(r)))
+			w->duplicates++;
+		else
+			w->buffered++;
+	}
+
+	ChessBot_destroy(bot);
+	ChessBot_destroy(opener);
+}
+
+double now_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+void *selfplay_worker(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	SelfPlay *sp = w->sp;
+	ChessGame *game = Game_create();
+	Position *history = (Position *) malloc((MAX_PLIES + 1) 
+											* sizeof(Position));
+	Position *kept = (Position *) malloc(MAX_PLIES * sizeof(Position));
+	int *scores = (int *) malloc(MAX_PLIES * sizeof(int));
+
+	/* Room for a whole game more than a flush's worth */
+	w->buffer = (TrainRecord *) malloc((FLUSH_RECORDS + MAX_PLIES)
+									   * sizeof(TrainRecord));
+	w->buffered = 0;
+	if (!open_shard(w))
+		w->failed = 1;
+
+	while (!w->failed && w->records + w->buffered < sp->shard_positions){
+		play_game(w, game, history, kept, scores,
+				  sp->seed + ((unsigned long long)w->shard << 32) + w->games);
+		w->games++;
+		if (w->buffered >= FLUSH_RECORDS && !flush_records(w))
+			w->failed = 1;
+	}
+	if (!w->failed && !flush_records(w))
+		w->failed = 1;
+	if (w->out != NULL)
+		fclose(w->out);
+
+	free(w->buffer);
+	free(scores);
+	free(kept);
+	free(history);
+	Game_destroy(game);
+
+	w->finish_seconds = now_seconds();
+	pthread_mutex_lock(&sp->lock);
+	sp->finished++;
+	pthread_cond_signal(&sp->done);
+	pthread_mutex_unlock(&sp->lock);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	static Worker workers[MAX_WORKERS];
+	SelfPlay sp;
+	NNUE *net = NULL;
+	const char *weights = NULL;
+	int num_workers = DEFAULT_WORKERS;
+	long positions = DEFAULT_POSITIONS;
+	int dedupe_bits = 0;
+	long records = 0;
+	long new_records = 0;
+	long games = 0;
+	long duplicates = 0;
+	int failed = 0;
+	long cores;
+	double start, end, last_progress;
+	int i;
+
+	memset(&sp, 0, sizeof(sp));
+	sp.out_dir = ".";
+	sp.depth = DEFAULT_DEPTH;
+	sp.sample_every = DEFAULT_SAMPLE_EVERY;
+	sp.seed = 1;
+	pthread_mutex_init(&sp.lock, NULL);
+	pthread_cond_init(&sp.done, NULL);
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			num_workers = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			sp.out_dir = argv[++i];
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+			positions = atol(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			sp.depth = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+			sp.sample_every = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+			dedupe_bits = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			sp.seed = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			weights = argv[++i];
+		else if (strcmp(argv[i], "-r") == 0)
+			sp.resume = 1;
+		else
+			break;
+	}
+	if (i < argc || num_workers < 1 || num_workers > MAX_WORKERS ||
+		positions < 1 || sp.depth < 1 || sp.depth > SEARCH_DEFAULT_DEPTH ||
+		sp.sample_every < 1 || dedupe_bits < 0 ||
+		dedupe_bits > MAX_DEDUPE_BITS){
+		fprintf(stderr, "usage: %s [-j workers] [-o out_dir] [-p positions]"
+				" [-d depth] [-e sample_every] [-u dedupe_bits] [-s seed]"
+				" [-n weights] [-r]\n", argv[0]);
+		return 2;
+	}
+	sp.shard_positions = (positions + num_workers - 1) / num_workers;
+
+	if (weights != NULL){
+		NNUEStatus status;
+		if ((net = NNUE_load(weights, &status)) == NULL){
+			fprintf(stderr, "couldn't load %s (%d)\n", weights, (int)status);
+			return 1;
+		}
+		sp.net = net;
+	}
+	if (dedupe_bits > 0 && (sp.dedupe = dedupe_create(dedupe_bits)) == NULL){
+		fprintf(stderr, "couldn't make a dedupe table of 2^%d\n",
+				dedupe_bits);
+		return 1;
+	}
+
+	/* Shards are opened (and resumed, and their keys loaded) by the
+	 * workers, so all of that happens in parallel too */
+	start = last_progress = now_seconds();
+	for (i = 0; i < num_workers; i++){
+		workers[i].sp = &sp;
+		workers[i].shard = i;
+		if (pthread_create(&workers[i].thread, NULL, selfplay_worker,
+						   &workers[i]) != 0){
+			fprintf(stderr, "couldn't start worker %d\n", i);
+			return 1;
+		}
+	}
+
+	/* Woken by each worker as it finishes, and every PROGRESS_SECONDS
+	 * for a progress line */
+	pthread_mutex_lock(&sp.lock);
+	while (sp.finished < num_workers){
+		struct timespec wake;
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_sec += PROGRESS_SECONDS;
+		pthread_cond_timedwait(&sp.done, &sp.lock, &wake);
+		if (now_seconds() - last_progress >= PROGRESS_SECONDS){
+			long so_far = 0;
+			for (i = 0; i < num_workers; i++)
+				so_far += workers[i].records;
+			last_progress = now_seconds();
+			fprintf(stderr, "%ld positions written, %.0f s\n", so_far,
+					last_progress - start);
+		}
+	}
+	pthread_mutex_unlock(&sp.lock);
+
+	/* The run took until the last worker was done */
+	end = start;
+	for (i = 0; i < num_workers; i++){
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].finish_seconds > end)
+			end = workers[i].finish_seconds;
+		records += workers[i].records;
+		new_records += workers[i].records - workers[i].resumed;
+		games += workers[i].games;
+		duplicates += workers[i].duplicates;
+		failed += workers[i].failed;
+		if (workers[i].failed)
+			fprintf(stderr, "couldn't write %s\n", workers[i].path);
+	}
+
+	printf("%ld positions in %d shards, %ld games, %ld duplicates"
+		   " skipped\n", records, num_workers, games, duplicates);
+	/* Only what this run wrote counts towards the speed, and workers
+	 * past the number of cores don't add any */
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores < 1 || cores > num_workers)
+		cores = num_workers;
+	printf("%ld new in %.2f s, %.0f positions/s, %.0f positions/s per"
+		   " core (%ld cores)\n", new_records, end - start,
+		   new_records / (end - start), new_records / (end - start) / cores,
+		   cores);
+
+	pthread_mutex_destroy(&sp.lock);
+	pthread_cond_destroy(&sp.done);
+	if (sp.dedupe != NULL)
+		dedupe_destroy(sp.dedupe);
+	if (net != NULL)
+		NNUE_destroy(net);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,534 @@
+/* Load generator for gameserver (see game_server.h).
+ *
+ * Opens [connections] connections, a thread each, and on each plays
+ * [sessions] games at once: every session always has one request out,
+ * and sends the next as soon as the reply is in. Games are played with
+ * random legal moves, except that every [bot_every]th request of a
+ * session asks for a bot move of [bot_ms] instead; finished games are
+ * closed and new ones started. After [seconds] no more requests are
+ * sent, and once the last replies are in it reports requests per
+ * second and the p50/p99 latency of quick requests and of bot ones.
+ *
+ * Usage: serverload [-c connections] [-n sessions] [-d seconds]
+ *                   [-b bot_every] [-m bot_ms] [-S socket_path] [-t]
+ *   -t doesn't load the server: it sends it requests it has answered
+ *      wrongly before (FENs no game can reach, a position with the most
+ *      legal moves there can be, more replies at once than it holds
+ *      back), checks every reply, and exits with 1 if any is wrong. */
+#define _GNU_SOURCE
+#include "game_server.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_CONNECTIONS 4
+#define DEFAULT_SESSIONS 64
+#define DEFAULT_SECONDS 5
+#define DEFAULT_BOT_EVERY 16
+#define DEFAULT_BOT_MS 10
+#define MAX_CONNECTIONS 1024
+/* Replies can be long (a whole list of moves), so read in big pieces */
+#define READ_BUFFER_SIZE 65536
+/* How many moves requests -t sends before reading any replies: enough
+ * for the replies to go past what gameserver holds for a connection
+ * before it stops reading its requests */
+#define CHECK_FLOOD 256
+/* A position with 218 legal moves, the most any can have */
+#define CHECK_MOST_MOVES_FEN \
+	"R6R/3Q4/1Q4Q1/4Q3/2Q4Q/Q4Q2/pp1Q4/kBNN1KB1 w - - 0 1"
+#define CHECK_MOST_MOVES 218
+
+/* What a session is waiting on a reply to */
+typedef enum { SENT_NEW, SENT_MOVES, SENT_MOVE, SENT_BOT,
+			   SENT_CLOSE } SentRequest;
+
+typedef struct {
+	/* The server's id for the game, as it wrote it */
+	char id[SERVER_TAG_MAX];
+	SentRequest sent;
+	double sent_ns;
+	long requests;
+} LoadSession;
+
+/* Latencies, in ns */
+typedef struct {
+	double *ns;
+	long length;
+	long capacity;
+} Latencies;
+
+typedef struct {
+	pthread_t thread;
+	const char *path;
+	int num_sessions;
+	int bot_every;
+	long bot_ms;
+	double end_ns;
+	unsigned long long rng;
+
+	int fd;
+	LoadSession *sessions;
+	Latencies quick;
+	Latencies bot;
+	long errors;
+	int failed;
+} LoadClient;
+
+double now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Helper function. xorshift64*, plenty for picking moves. */
+unsigned int next_random(LoadClient *client)
+{
+	client->rng ^= client->rng >> 12;
+	client->rng ^= client->rng << 25;
+	client->rng ^= client->rng >> 27;
+	return (unsigned int)((client->rng * 2685821657736338717ULL) >> 32);
+}
+
+void latencies_add(Latencies *l, double ns)
+{
+	if (l->length == l->capacity){
+		l->capacity = l->capacity ? 2 * l->capacity : 1024;
+		l->ns = (double *) realloc(l->ns, l->capacity * sizeof(double));
+	}
+	l->ns[l->length++] = ns;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+	const double x = *(const double *)a;
+	const double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* Helper function. Sends all of [line] to [fd]. Returns 0 if it
+ * couldn't. */
+int send_all(int fd, const char *line)
+{
+	const int length = strlen(line);
+	int done;
+
+	for (done = 0; done < length; ){
+		const ssize_t n = send(fd, line + done, length - done,
+							   MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		done += n;
+	}
+	return 1;
+}
+
+/* Helper function. Sends [session]'s next request, a [sent] one, with
+ * [arg] after the session id if not NULL. Returns 0 if it couldn't. */
+int send_request(LoadClient *client, int index, SentRequest sent,
+				 const char *arg)
+{
+	const char *commands[] = { "new", "moves", "move", "bot", "close" };
+	LoadSession *session = &client->sessions[index];
+	char line[SERVER_LINE_MAX];
+
+	if (sent == SENT_NEW)
+		sprintf(line, "%d new\n", index);
+	else
+		sprintf(line, "%d %s %s%s%s\n", index, commands[sent],
+				session->id, arg ? " " : "", arg ? arg : "");
+	session->sent = sent;
+	session->sent_ns = now_ns();
+	session->requests++;
+	return send_all(client->fd, line);
+}
+
+/* Helper function. Picks [session]'s next request given the reply
+ * [words] to its last one, and sends it. */
+int next_request(LoadClient *client, int index, int ok, char *words)
+{
+	LoadSession *session = &client->sessions[index];
+	char bot_ms[24];
+	char *move;
+	int num_words, pick;
+
+	if (!ok)
+		return send_request(client, index, SENT_NEW, NULL);
+
+	switch (session->sent){
+		case SENT_NEW:
+			sscanf(words, "%31s", session->id);
+			return send_request(client, index, SENT_MOVES, NULL);
+		case SENT_MOVES:
+			num_words = 0;
+			for (move = words; *move != '\0'; move++)
+				if (*move != ' ' && (move == words || move[-1] == ' '))
+					num_words++;
+			if (num_words == 0)
+				return send_request(client, index, SENT_CLOSE, NULL);
+			if (session->requests % client->bot_every == 0){
+				sprintf(bot_ms, "%ld", client->bot_ms);
+				return send_request(client, index, SENT_BOT, bot_ms);
+			}
+			pick = next_random(client) % num_words;
+			for (move = words; ; move++)
+				if (*move != ' ' && (move == words || move[-1] == ' ') &&
+					pick-- == 0)
+					break;
+			move[strcspn(move, " ")] = '\0';
+			return send_request(client, index, SENT_MOVE, move);
+		case SENT_MOVE:
+		case SENT_BOT:
+			if (strstr(words, "playing") != NULL)
+				return send_request(client, index, SENT_MOVES, NULL);
+			return send_request(client, index, SENT_CLOSE, NULL);
+		default:
+			return send_request(client, index, SENT_NEW, NULL);
+	}
+}
+
+int connect_to(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr *)&addr,
+						   sizeof(addr)) < 0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void *load_client(void *arg)
+{
+	LoadClient *client = (LoadClient *)arg;
+	char *buffer = (char *) malloc(READ_BUFFER_SIZE);
+	int buffered = 0;
+	int outstanding = 0;
+	int i;
+
+	client->fd = connect_to(client->path);
+	if (client->fd < 0){
+		client->failed = 1;
+		free(buffer);
+		return NULL;
+	}
+
+	for (i = 0; i < client->num_sessions; i++)
+		if (send_request(client, i, SENT_NEW, NULL))
+			outstanding++;
+
+	while (outstanding > 0){
+		char *line, *newline;
+		const ssize_t got = recv(client->fd, buffer + buffered,
+								 READ_BUFFER_SIZE - buffered, 0);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0){
+			client->failed = 1;
+			break;
+		}
+		buffered += got;
+
+		line = buffer;
+		while ((newline = memchr(line, '\n', buffer + buffered - line))
+			   != NULL){
+			const double now = now_ns();
+			char *words;
+			int index, ok;
+
+			*newline = '\0';
+			index = atoi(line);
+			words = strchr(line, ' ');
+			line = newline + 1;
+			if (words == NULL || index < 0 ||
+				index >= client->num_sessions)
+				continue;
+			words++;
+			ok = strncmp(words, "ok", 2) == 0;
+			words += strcspn(words, " ");
+
+			latencies_add(client->sessions[index].sent == SENT_BOT ?
+						  &client->bot : &client->quick,
+						  now - client->sessions[index].sent_ns);
+			if (!ok)
+				client->errors++;
+			outstanding--;
+			if (now < client->end_ns &&
+				next_request(client, index, ok, words))
+				outstanding++;
+		}
+		buffered -= line - buffer;
+		memmove(buffer, line, buffered);
+	}
+
+	close(client->fd);
+	free(buffer);
+	return NULL;
+}
+
+/* Helper function. Reads the next reply from [fd] into [reply], its
+ * newline dropped, keeping what comes after it in [buffer], which has
+ * [*buffered] bytes in it. Returns 0 if the connection closed first. */
+int read_reply(int fd, char *buffer, int *buffered, char *reply)
+{
+	char *newline;
+
+	while ((newline = memchr(buffer, '\n', *buffered)) == NULL){
+		const ssize_t got = recv(fd, buffer + *buffered,
+								 READ_BUFFER_SIZE - *buffered, 0);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return 0;
+		*buffered += got;
+	}
+	*newline = '\0';
+	strcpy(reply, buffer);
+	*buffered -= newline + 1 - buffer;
+	memmove(buffer, newline + 1, *buffered);
+	return 1;
+}
+
+/* Helper function. Number of space separated words in [text]. */
+int count_words(const char *text)
+{
+	int n = 0;
+	const char *c;
+
+	for (c = text; *c != '\0'; c++)
+		if (*c != ' ' && (c == text || c[-1] == ' '))
+			n++;
+	return n;
+}
+
+/* Helper function. Sends [request] and checks the reply starts with
+ * [expected], printing it if not. Leaves the reply in [reply]. Returns
+ * 0 if it's wrong. */
+int check_request(int fd, char *buffer, int *buffered, const char *request,
+				  const char *expected, char *reply)
+{
+	if (!send_all(fd, request) || !read_reply(fd, buffer, buffered, reply)){
+		printf("%.*s: connection closed\n", (int)strcspn(request, "\n"),
+			   request);
+		return 0;
+	}
+	if (strncmp(reply, expected, strlen(expected)) != 0){
+		printf("%.*s: got \"%s\", expected \"%s\"\n",
+			   (int)strcspn(request, "\n"), request, reply, expected);
+		return 0;
+	}
+	return 1;
+}
+
+int run_checks(const char *path)
+{
+	const char *bad_fens[] = {
+		"P3k3/8/8/8/8/8/8/4K3 w - - 0 1",
+		"4k3/8/8/8/8/8/8/4K2p b - - 0 1",
+		"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e3 0 1",
+		"4k3/8/8/8/8/8/4R3/4K3 w - - 0 1"
+	};
+	char *buffer = (char *) malloc(READ_BUFFER_SIZE);
+	char *reply = (char *) malloc(READ_BUFFER_SIZE);
+	char request[SERVER_LINE_MAX];
+	char id[SERVER_TAG_MAX];
+	int buffered = 0;
+	int checked = 0, bad = 0;
+	int fd, i, n;
+
+	fd = connect_to(path);
+	if (fd < 0){
+		fprintf(stderr, "couldn't connect (is gameserver running on %s?)\n",
+				path);
+		free(buffer);
+		free(reply);
+		return 1;
+	}
+
+	for (i = 0; i < (int)(sizeof(bad_fens) / sizeof(bad_fens[0])); i++){
+		sprintf(request, "t new %s\n", bad_fens[i]);
+		checked++;
+		bad += !check_request(fd, buffer, &buffered, request,
+							  "t err bad fen", reply);
+	}
+
+	/* The most moves a position can have all fit in the reply */
+	checked++;
+	if (!check_request(fd, buffer, &buffered,
+					   "t new " CHECK_MOST_MOVES_FEN "\n", "t ok ", reply))
+		bad++;
+	else {
+		sscanf(reply + 5, "%31s", id);
+		sprintf(request, "t moves %s\n", id);
+		checked++;
+		if (!check_request(fd, buffer, &buffered, request, "t ok ", reply))
+			bad++;
+		else if ((n = count_words(reply + 5)) != CHECK_MOST_MOVES){
+			printf("%.*s: got %d moves, expected %d\n",
+				   (int)strcspn(request, "\n"), request, n,
+				   CHECK_MOST_MOVES);
+			bad++;
+		}
+
+		/* Every request gets answered, however long the replies to
+		 * ones before it are left unread */
+		checked++;
+		for (i = 0; i < CHECK_FLOOD; i++)
+			if (!send_all(fd, request))
+				break;
+		for (n = 0; n < i; n++)
+			if (!read_reply(fd, buffer, &buffered, reply) ||
+				count_words(reply + 5) != CHECK_MOST_MOVES)
+				break;
+		if (n < CHECK_FLOOD){
+			printf("%d moves requests at once: %d right replies\n",
+				   CHECK_FLOOD, n);
+			bad++;
+		}
+	}
+
+	/* And the server is still there */
+	checked++;
+	bad += !check_request(fd, buffer, &buffered, "t stats\n",
+						  "t ok sessions", reply);
+
+	close(fd);
+	free(buffer);
+	free(reply);
+	printf("%d requests checked, %d wrong\n", checked, bad);
+	return bad > 0;
+}
+
+
+/* Helper function. Prints how many of [name] requests all the clients
+ * sent, and the median and 99th percentile latency of them, of the
+ * clients' bot requests if [bot] and their quick ones if not. */
+void print_latencies(const char *name, const LoadClient *clients, int n,
+					 int bot)
+{
+	Latencies all;
+	long i;
+	int c;
+
+	memset(&all, 0, sizeof(all));
+	for (c = 0; c < n; c++){
+		const Latencies *l = bot ? &clients[c].bot : &clients[c].quick;
+		for (i = 0; i < l->length; i++)
+			latencies_add(&all, l->ns[i]);
+	}
+	if (all.length == 0){
+		printf("%-6s %9d requests\n", name, 0);
+		return;
+	}
+	qsort(all.ns, all.length, sizeof(double), compare_doubles);
+	printf("%-6s %9ld requests  p50 %9.1f us  p99 %9.1f us\n", name,
+		   all.length, all.ns[(all.length - 1) / 2] / 1e3,
+		   all.ns[(long)((all.length - 1) * 0.99)] / 1e3);
+	free(all.ns);
+}
+
+int main(int argc, char **argv)
+{
+	LoadClient *clients;
+	const char *path = SERVER_DEFAULT_SOCKET;
+	int num_clients = DEFAULT_CONNECTIONS;
+	int num_sessions = DEFAULT_SESSIONS;
+	int bot_every = DEFAULT_BOT_EVERY;
+	long bot_ms = DEFAULT_BOT_MS;
+	double seconds = DEFAULT_SECONDS;
+	double start, elapsed;
+	long requests = 0;
+	long errors = 0;
+	int failed = 0;
+	int check = 0;
+	int i;
+
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			num_clients = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			num_sessions = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			seconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			bot_every = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			bot_ms = atol(argv[++i]);
+		else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+			path = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0)
+			check = 1;
+		else
+			break;
+	}
+	if (i < argc || num_clients < 1 || num_clients > MAX_CONNECTIONS ||
+		num_sessions < 1 || bot_every < 1 || bot_ms < 1 || seconds <= 0){
+		fprintf(stderr, "usage: %s [-c connections] [-n sessions]"
+				" [-d seconds] [-b bot_every] [-m bot_ms]"
+				" [-S socket_path] [-t]\n", argv[0]);
+		return 2;
+	}
+	if (check)
+		return run_checks(path);
+
+	clients = (LoadClient *) calloc(num_clients, sizeof(LoadClient));
+	start = now_ns();
+	for (i = 0; i < num_clients; i++){
+		clients[i].path = path;
+		clients[i].num_sessions = num_sessions;
+		clients[i].bot_every = bot_every;
+		clients[i].bot_ms = bot_ms;
+		clients[i].end_ns = start + (seconds * 1e9);
+		clients[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+		clients[i].sessions = (LoadSession *) calloc(num_sessions,
+													sizeof(LoadSession));
+		if (pthread_create(&clients[i].thread, NULL, load_client,
+						   &clients[i]) != 0){
+			fprintf(stderr, "couldn't start client %d\n", i);
+			return 1;
+		}
+	}
+	for (i = 0; i < num_clients; i++){
+		pthread_join(clients[i].thread, NULL);
+		requests += clients[i].quick.length + clients[i].bot.length;
+		errors += clients[i].errors;
+		failed += clients[i].failed;
+	}
+	elapsed = (now_ns() - start) / 1e9;
+
+	printf("%d connections x %d sessions, %.2f s, bot every %d requests"
+		   " at %ld ms\n", num_clients, num_sessions, elapsed, bot_every,
+		   bot_ms);
+	printf("%ld requests, %.0f requests/s, %ld errors\n", requests,
+		   elapsed > 0 ? requests / elapsed : 0.0, errors);
+	print_latencies("quick", clients, num_clients, 0);
+	print_latencies("bot", clients, num_clients, 1);
+	if (failed)
+		fprintf(stderr, "%d connections failed (is gameserver running on"
+				" %s?)\n", failed, path);
+
+	for (i = 0; i < num_clients; i++){
+		free(clients[i].sessions);
+		free(clients[i].quick.ns);
+		free(clients[i].bot.ns);
+	}
+	free(clients);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,646 @@
+/* Texel-style tuning of pst_eval's parameters (eval_params.h).
+ *
+ * Reads positions labeled with the result of the game they came from,
+ * and fits the parameters so that sigmoid(K * eval / 400), with eval
+ * from white's side, predicts the results (1 white won, 1/2 a draw, 0
+ * black won) with the least mean squared error. Files ending in .bin
+ * are selfplay records (see train_data.h); any other file is read as
+ * text, a FEN or EPD position per line with its result somewhere after
+ * it: 1-0, 0-1 or 1/2-1/2 (as in c9 "1-0";), or [1.0], [0.5], [0.0].
+ * Blank lines and lines starting with '#' are skipped.
+ *
+ * Only quiet positions are kept (unless -a): not in check, and with no
+ * piece of the side not to move (kings aside) attacked and undefended,
+ * since the eval can't see a capture coming. Each is packed into a
+ * TunePosition of 40 bytes, so 10M positions take 400MB.
+ *
+ * pst_eval is linear in its parameters once it's known whether the
+ * position counts as an endgame, so that's settled per position from
+ * the starting piece values, as are its pawn structure counts (see
+ * pawns.h); the gradient comes straight from which pieces are on which
+ * squares and those counts. Each epoch, [threads] threads work out
+ * the error and its gradient over their own slice of the positions, and
+ * then one step of Adam is taken with step size [rate] (in centipawns).
+ * The king's value, pawns on the first and last ranks and passed pawns
+ * on them are left be.
+ *
+ * K is fitted first, to the starting parameters, unless given with -k.
+ * The parameters are written to [out] as a header in eval_params.h's
+ * layout, rounded to whole centipawns, whenever they're the best so far
+ * (so with -e 0, just as they started); rebuild with it to use them.
+ *
+ * Usage: texeltune [-j threads] [-e epochs] [-r rate] [-k K] [-a]
+ *                  [-o out] files... */
+#define _POSIX_C_SOURCE 200809L
+#include "chess.h"
+#include "pawns.h"
+#include "train_data.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* The starting parameters: piece_values, pst, king_endgame_pst and the
+ * pawn structure terms */
+#include "eval_params.h"
+
+#define DEFAULT_THREADS 4
+#define MAX_THREADS 256
+#define DEFAULT_EPOCHS 100
+#define DEFAULT_RATE 1.0
+#define DEFAULT_OUT "eval_params.h"
+#define LINE_SIZE 512
+#define READ_RECORDS 4096
+
+/* Same as pst_eval's (chess_bot.c) */
+#define ENDGAME_MATERIAL 1300
+
+/* Where each parameter is in the vector being fitted */
+#define PARAM_VALUE(type) (type)
+#define PARAM_PST(type, sq) (6 + 64 * (type) + (sq))
+#define PARAM_KING_ENDGAME(sq) (6 + 6 * 64 + (sq))
+#define PARAM_PAWN(term) (6 + 7 * 64 + (term))
+#define NUM_PARAMS (6 + 7 * 64 + PAWN_TERMS)
+
+/* Pawn structure terms, as counted into TunePosition.pawn_terms:
+ * pawn_doubled, pawn_isolated, pawn_backward, then passed_pawn[8] */
+#define PAWN_DOUBLED 0
+#define PAWN_ISOLATED 1
+#define PAWN_BACKWARD 2
+#define PAWN_PASSED(rank) (3 + (rank))
+#define PAWN_TERMS 11
+
+/* Adam's decay rates */
+#define BETA1 0.9
+#define BETA2 0.999
+#define ADAM_EPSILON 1e-8
+
+/* K is looked for between these, to within K_TOLERANCE */
+#define K_MIN 0.05
+#define K_MAX 4.0
+#define K_TOLERANCE 0.0005
+#define LN10 2.302585092994046
+
+/* A position, packed like a TrainRecord's board: the occupied squares,
+ * then their pieces in square order, 4 bits each. */
+typedef struct tune_position_t {
+	SquareSet occupied;
+	unsigned char pieces[16];
+	/* Whether pst_eval has its king on king_endgame_pst */
+	unsigned char endgame;
+	/* 0 black won, 1 draw, 2 white won */
+	unsigned char result;
+	/* White's count of each pawn structure term less black's */
+	signed char pawn_terms[PAWN_TERMS];
+	unsigned char padding[3];
+} TunePosition;
+
+typedef struct position_set_t {
+	TunePosition *positions;
+	long count;
+	long capacity;
+	/* Read but not quiet, and couldn't be read */
+	long skipped;
+	long bad;
+} PositionSet;
+
+/* A thread's share of an epoch */
+typedef struct tune_job_t {
+	const TunePosition *positions;
+	long count;
+	const double *params;
+	double k;
+	/* Whether to work out the gradient as well as the error */
+	int want_gradient;
+
+	double error;
+	double gradient[NUM_PARAMS];
+} TuneJob;
+
+
+
+/* LOADING */
+
+/* Helper function. Whether [p] is quiet enough to tune on (see top). */
+int is_quiet(const Position *p)
+{
+	const int mover = p->to_move;
+	const int other = 1 - mover;
+	SquareSet hanging;
+
+	if (Position_in_check(p))
+		return 0;
+	hanging = p->color_sets[other] & ~p->piece_sets[other == WHITE_MOVE ?
+													 W_K : B_K]
+			  & p->attacked_sets[mover] & ~p->attacked_sets[other];
+	return hanging == 0;
+}
+
+/* Helper function. Packs [p] with [result] onto the end of [set]. */
+void add_position(PositionSet *set, const Position *p,
+				  GameCondition result)
+{
+	TunePosition *t;
+	PawnStructure ps;
+	SquareSet pieces = p->color_sets[0] | p->color_sets[1];
+	int material = 0;
+	int i;
+
+	if (set->count == set->capacity){
+		set->capacity = set->capacity ? 2 * set->capacity : 1 << 16;
+		set->positions = (TunePosition *)realloc(set->positions,
+								set->capacity * sizeof(TunePosition));
+		if (set->positions == NULL){
+			fprintf(stderr, "Out of memory at %ld positions\n", set->count);
+			exit(1);
+		}
+	}
+
+	t = &set->positions[set->count++];
+	memset(t, 0, sizeof(TunePosition));
+	t->occupied = pieces;
+	for (i = 0; pieces; i++){
+		const int sq = SQUARESET_FIRST(pieces);
+		const ChessPiece piece = p->piece_locations[sq];
+		pieces &= pieces - 1;
+		t->pieces[i / 2] |= piece << (4 * (i % 2));
+		if (piece % 6 != W_P)
+			material += piece_values[piece % 6];
+	}
+	t->endgame = material <= ENDGAME_MATERIAL;
+
+	PawnStructure_find(&ps, p->piece_sets[W_P], p->piece_sets[B_P]);
+	t->pawn_terms[PAWN_DOUBLED] = ps.doubled[0] - ps.doubled[1];
+	t->pawn_terms[PAWN_ISOLATED] = ps.isolated[0] - ps.isolated[1];
+	t->pawn_terms[PAWN_BACKWARD] = ps.backward[0] - ps.backward[1];
+	for (i = 0; i < 8; i++)
+		t->pawn_terms[PAWN_PASSED(i)] = ps.passed_by_rank[0][i]
+										- ps.passed_by_rank[1][i];
+	t->result = result == WHITE ? 2 : (result == BLACK ? 0 : 1);
+}
+
+/* Helper function. Finds the result on text line [line], cutting the
+ * line off where it starts so only the position is left. Returns 0 if
+ * there's none. */
+int read_result(char *line, GameCondition *result)
+{
+	static const char *tokens[] = { "1/2-1/2", "1-0", "0-1" };
+	static const GameCondition results[] = { DRAW, WHITE, BLACK };
+	char *found;
+	int i;
+
+	for (i = 0; i < 3; i++){
+		found = strstr(line, tokens[i]);
+		if (found != NULL){
+			*result = results[i];
+			/* Back over an EPD opcode and quote, c9 "1-0"; */
+			while (found > line && found[-1] != ' ' && found[-1] != '\t')
+				found--;
+			if (found > line + 3 && strncmp(found - 3, "c9 ", 3) == 0)
+				found -= 3;
+			*found = '\0';
+			return 1;
+		}
+	}
+
+	found = strchr(line, '[');
+	if (found != NULL){
+		const double value = atof(found + 1);
+		*result = value > 0.75 ? WHITE : (value < 0.25 ? BLACK : DRAW);
+		*found = '\0';
+		return 1;
+	}
+	return 0;
+}
+
+/* Helper function. Reads FEN/EPD lines with results from [filename]. */
+int load_text(PositionSet *set, const char *filename, int keep_all)
+{
+	char line[LINE_SIZE];
+	ChessGame *g;
+	GameCondition result;
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL)
+		return 0;
+
+	g = Game_create();
+	while (fgets(line, LINE_SIZE, fp) != NULL){
+		const char *s = line;
+		while (*s == ' ' || *s == '\t')	s++;
+		if (*s == '\0' || *s == '\n' || *s == '\r' || *s == '#')
+			continue;
+		if (!read_result(line, &result) || Game_set_FEN(g, s) != FEN_OK){
+			set->bad++;
+			continue;
+		}
+		if (keep_all || is_quiet(&g->current_pos))
+			add_position(set, &g->current_pos, result);
+		else
+			set->skipped++;
+	}
+	Game_destroy(g);
+	fclose(fp);
+	return 1;
+}
+
+/* Helper function. Reads selfplay records from [filename]. */
+int load_records(PositionSet *set, const char *filename, int keep_all)
+{
+	TrainRecord *records;
+	Position p;
+	GameCondition result;
+	int score;
+	size_t n, i;
+	FILE *fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return 0;
+
+	records = (TrainRecord *)malloc(READ_RECORDS * sizeof(TrainRecord));
+	while ((n = fread(records, sizeof(TrainRecord), READ_RECORDS, fp)) > 0){
+		for (i = 0; i < n; i++){
+			if (!TrainRecord_unpack(&records[i], &p, &score, &result))
+				set->bad++;
+			else if (keep_all || is_quiet(&p))
+				add_position(set, &p, result);
+			else
+				set->skipped++;
+		}
+	}
+	free(records);
+	fclose(fp);
+	return 1;
+}
+
+
+
+/* TUNING */
+
+/* Helper function. The eval of [t], in centipawns for white. The
+ * parameters it's the sum of go in [terms], 2 per piece (its value and
+ * its square), white's counting +1 and black's -1 in [signs]; returns
+ * how many pieces there are. The pawn structure terms come on top, by
+ * t->pawn_terms. */
+double tune_eval(const TunePosition *t, const double *params,
+				 short *terms, signed char *signs, int *num_pieces)
+{
+	SquareSet pieces = t->occupied;
+	double eval = 0;
+	int i;
+
+	for (i = 0; pieces; i++){
+		const int sq = SQUARESET_FIRST(pieces);
+		const int piece = (t->pieces[i / 2] >> (4 * (i % 2))) & 0xF;
+		const int type = piece % 6;
+		const int white = piece / 6 == WHITE_MOVE;
+		const int square = white ? sq : sq ^ 56;
+		pieces &= pieces - 1;
+
+		terms[2 * i] = PARAM_VALUE(type);
+		terms[2 * i + 1] = type == W_K && t->endgame
+						   ? PARAM_KING_ENDGAME(square)
+						   : PARAM_PST(type, square);
+		signs[i] = white ? 1 : -1;
+		eval += signs[i] * (params[terms[2 * i]] + params[terms[2 * i + 1]]);
+	}
+	*num_pieces = i;
+
+	for (i = 0; i < PAWN_TERMS; i++)
+		eval += t->pawn_terms[i] * params[PARAM_PAWN(i)];
+	return eval;
+}
+
+/* Helper function. Predicted result (0 to 1) for an [eval] for white. */
+double sigmoid(double k, double eval)
+{
+	return 1.0 / (1.0 + exp(-k * eval * LN10 / 400.0));
+}
+
+/* Helper function. Runs one thread's [job]: the sum of its squared
+ * errors, and of their gradient. */
+void *run_tune_job(void *arg)
+{
+	TuneJob *job = (TuneJob *)arg;
+	short terms[64];
+	signed char signs[32];
+	double error = 0;
+	long i;
+	int n, j;
+
+	memset(job->gradient, 0, sizeof(job->gradient));
+	for (i = 0; i < job->count; i++){
+		const TunePosition *t = &job->positions[i];
+		const double target = t->result / 2.0;
+		const double predicted = sigmoid(job->k, tune_eval(t, job->params,
+														   terms, signs, &n));
+		const double diff = predicted - target;
+		error += diff * diff;
+
+		/* d(diff^2)/d(eval), through the sigmoid */
+		if (job->want_gradient){
+			const double slope = 2 * diff * predicted * (1 - predicted)
+								 * job->k * LN10 / 400.0;
+			for (j = 0; j < n; j++){
+				job->gradient[terms[2 * j]] += signs[j] * slope;
+				job->gradient[terms[2 * j + 1]] += signs[j] * slope;
+			}
+			for (j = 0; j < PAWN_TERMS; j++)
+				job->gradient[PARAM_PAWN(j)] += t->pawn_terms[j] * slope;
+		}
+	}
+	job->error = error;
+	return NULL;
+}
+
+/* Helper function. Mean squared error over [set], and its gradient in
+ * [gradient] unless that's NULL, split over [threads] threads. A job
+ * whose thread can't be started is run on this one instead. */
+double tune_error(const PositionSet *set, const double *params,
+				  double k, int threads, TuneJob *jobs,
+				  double *gradient)
+{
+	pthread_t ids[MAX_THREADS];
+	int started[MAX_THREADS];
+	const long per = (set->count + threads - 1) / threads;
+	double error = 0;
+	int i, j;
+
+	for (i = 0; i < threads; i++){
+		const long start = i * per < set->count ? i * per : set->count;
+		const long end = start + per < set->count ? start + per
+												  : set->count;
+		jobs[i].positions = set->positions + start;
+		jobs[i].count = end - start;
+		jobs[i].params = params;
+		jobs[i].k = k;
+		jobs[i].want_gradient = gradient != NULL;
+		started[i] = pthread_create(&ids[i], NULL, run_tune_job,
+									&jobs[i]) == 0;
+		if (!started[i])
+			run_tune_job(&jobs[i]);
+	}
+
+	if (gradient != NULL)
+		memset(gradient, 0, NUM_PARAMS * sizeof(double));
+	for (i = 0; i < threads; i++){
+		if (started[i])
+			pthread_join(ids[i], NULL);
+		error += jobs[i].error;
+		if (gradient != NULL)
+			for (j = 0; j < NUM_PARAMS; j++)
+				gradient[j] += jobs[i].gradient[j] / set->count;
+	}
+	return error / set->count;
+}
+
+/* Helper function. K that fits [params] best, by golden section search
+ * (the error is smooth and has one minimum in K). */
+double fit_k(const PositionSet *set, const double *params,
+			 int threads, TuneJob *jobs)
+{
+	const double ratio = (sqrt(5.0) - 1) / 2;
+	double lo = K_MIN, hi = K_MAX;
+	double a = hi - ratio * (hi - lo), b = lo + ratio * (hi - lo);
+	double error_a = tune_error(set, params, a, threads, jobs, NULL);
+	double error_b = tune_error(set, params, b, threads, jobs, NULL);
+
+	while (hi - lo > K_TOLERANCE){
+		if (error_a < error_b){
+			hi = b;
+			b = a;
+			error_b = error_a;
+			a = hi - ratio * (hi - lo);
+			error_a = tune_error(set, params, a, threads, jobs, NULL);
+		}
+		else {
+			lo = a;
+			a = b;
+			error_a = error_b;
+			b = lo + ratio * (hi - lo);
+			error_b = tune_error(set, params, b, threads, jobs, NULL);
+		}
+	}
+	return (lo + hi) / 2;
+}
+
+/* Helper function. Whether parameter [i] is left as it starts. */
+int is_fixed(int i)
+{
+	int sq;
+	if (i == PARAM_VALUE(W_K) || i == PARAM_PAWN(PAWN_PASSED(0)) ||
+		i == PARAM_PAWN(PAWN_PASSED(7)))
+		return 1;
+	if (i < PARAM_PST(W_P, 0) || i >= PARAM_PST(W_P, 64))
+		return 0;
+	sq = i - PARAM_PST(W_P, 0);
+	return sq < 8 || sq >= 56;
+}
+
+
+
+/* OUTPUT */
+
+/* Helper function. Writes the 64 [params] from [first] as rows of
+ * 8, the way eval_params.h has its tables. */
+void write_table(FILE *fp, const double *params, int first)
+{
+	int i;
+	for (i = 0; i < 64; i++)
+		fprintf(fp, "%s%3d%s", i == 0 ? "{ " : (i % 8 == 0 ? "  " : ""),
+				(int)floor(params[first + i] + 0.5),
+				i == 63 ? " }" : (i % 8 == 7 ? ",\n\t" : ","));
+}
+
+/* Helper function. Writes [params] to [filename] as eval_params.h.
+ * Returns 0 if it couldn't. */
+int write_params(const char *filename, const double *params)
+{
+	static const char *names[6] = { "King, middlegame", "Queen", "Rook",
+									"Knight", "Bishop", "Pawn" };
+	char temp[1024];
+	int i;
+	FILE *fp;
+
+	/* Written beside it and renamed over it, so it's never half there */
+	sprintf(temp, "%.1000s.tmp", filename);
+	fp = fopen(temp, "w");
+	if (fp == NULL)
+		return 0;
+
+	fprintf(fp, "/* Parameters of pst_eval, which chess_bot.c includes this for. Written\n"
+				" * by texeltune (see texel_tune.c), which fits them to played games:\n"
+				" * regenerate rather than edit by hand, or keep the layout. */\n\n");
+
+	fprintf(fp, "/* Piece values, indexed by ChessPiece %% 6 */\n"
+				"const int piece_values[6] = { ");
+	for (i = 0; i < 6; i++)
+		fprintf(fp, "%d%s", (int)floor(params[PARAM_VALUE(i)] + 0.5),
+				i == 5 ? " };\n\n" : ", ");
+
+	fprintf(fp, "/* Piece-square tables, from white's side: index 0 is a8, like \n"
+				" * piece_locations. Black looks its squares up flipped (sq ^ 56). */\n"
+				"const int pst[6][64] = {\n");
+	for (i = 0; i < 6; i++){
+		fprintf(fp, "\t/* %s */\n\t", names[i]);
+		write_table(fp, params, PARAM_PST(i, 0));
+		fprintf(fp, "%s\n", i == 5 ? "" : ",");
+	}
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp, "/* Kings walk to the middle once the queens and most pieces are gone */\n"
+				"const int king_endgame_pst[64] = {\n\t");
+	for (i = 0; i < 64; i++)
+		fprintf(fp, "%3d%s", (int)floor(params[PARAM_KING_ENDGAME(i)] + 0.5),
+				i == 63 ? " };\n\n" : (i % 8 == 7 ? ",\n\t" : ","));
+
+	fprintf(fp, "/* Pawn structure (see pawns.h), per pawn: doubled, isolated and\n"
+				" * backward, and passed by rank from its own side */\n"
+				"const int pawn_doubled = %d;\n"
+				"const int pawn_isolated = %d;\n"
+				"const int pawn_backward = %d;\n"
+				"const int passed_pawn[8] = { ",
+			(int)floor(params[PARAM_PAWN(PAWN_DOUBLED)] + 0.5),
+			(int)floor(params[PARAM_PAWN(PAWN_ISOLATED)] + 0.5),
+			(int)floor(params[PARAM_PAWN(PAWN_BACKWARD)] + 0.5));
+	for (i = 0; i < 8; i++)
+		fprintf(fp, "%d%s", 
+				(int)floor(params[PARAM_PAWN(PAWN_PASSED(i))] + 0.5),
+				i == 7 ? " };\n" : ", ");
+
+	if (fclose(fp) != 0 || rename(temp, filename) != 0)
+		return 0;
+	return 1;
+}
+
+
+
+/* Helper function. Seconds since [start]. */
+double seconds_since(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec)
+		   + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	static TuneJob jobs[MAX_THREADS];
+	static double params[NUM_PARAMS], gradient[NUM_PARAMS];
+	static double moment[NUM_PARAMS], velocity[NUM_PARAMS];
+	PositionSet set;
+	struct timespec start;
+	int threads = DEFAULT_THREADS;
+	int epochs = DEFAULT_EPOCHS;
+	double rate = DEFAULT_RATE;
+	double k = 0;
+	int keep_all = 0;
+	const char *out = DEFAULT_OUT;
+	int files = 0;
+	double error, best_error;
+	int i, j, epoch;
+
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+			epochs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			rate = atof(argv[++i]);
+		else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+			k = atof(argv[++i]);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			out = argv[++i];
+		else if (strcmp(argv[i], "-a") == 0)
+			keep_all = 1;
+		else if (argv[i][0] == '-'){
+			fprintf(stderr, "Usage: %s [-j threads] [-e epochs] [-r rate] "
+					"[-k K] [-a] [-o out] files...\n", argv[0]);
+			return 2;
+		}
+		else
+			argv[++files] = argv[i];
+	}
+	if (files == 0 || threads < 1 || threads > MAX_THREADS || epochs < 0
+		|| rate <= 0 || k < 0){
+		fprintf(stderr, "Usage: %s [-j threads] [-e epochs] [-r rate] "
+				"[-k K] [-a] [-o out] files...\n", argv[0]);
+		return 2;
+	}
+
+	memset(&set, 0, sizeof(PositionSet));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 1; i <= files; i++){
+		const size_t len = strlen(argv[i]);
+		const int ok = len > 4 && strcmp(argv[i] + len - 4, ".bin") == 0
+					   ? load_records(&set, argv[i], keep_all)
+					   : load_text(&set, argv[i], keep_all);
+		if (!ok){
+			fprintf(stderr, "Couldn't open %s\n", argv[i]);
+			return 1;
+		}
+	}
+	printf("%ld positions (%ld not quiet, %ld bad) in %.1fs, %.0fMB\n",
+		   set.count, set.skipped, set.bad, seconds_since(&start),
+		   set.count * (double)sizeof(TunePosition) / (1 << 20));
+	if (set.count == 0)
+		return 1;
+	if ((long)threads > set.count)
+		threads = (int)set.count;
+
+	for (i = 0; i < 6; i++)
+		params[PARAM_VALUE(i)] = piece_values[i];
+	for (i = 0; i < 6; i++)
+		for (j = 0; j < 64; j++)
+			params[PARAM_PST(i, j)] = pst[i][j];
+	for (j = 0; j < 64; j++)
+		params[PARAM_KING_ENDGAME(j)] = king_endgame_pst[j];
+	params[PARAM_PAWN(PAWN_DOUBLED)] = pawn_doubled;
+	params[PARAM_PAWN(PAWN_ISOLATED)] = pawn_isolated;
+	params[PARAM_PAWN(PAWN_BACKWARD)] = pawn_backward;
+	for (j = 0; j < 8; j++)
+		params[PARAM_PAWN(PAWN_PASSED(j))] = passed_pawn[j];
+
+	if (k == 0){
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		k = fit_k(&set, params, threads, jobs);
+		printf("K %.4f (%.1fs)\n", k, seconds_since(&start));
+	}
+	/* Each epoch's pass gets the error of the parameters it starts
+	 * with, so those are what's written if they're the best yet */
+	best_error = -1;
+	for (epoch = 1; epoch <= epochs + 1; epoch++){
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		error = tune_error(&set, params, k, threads, jobs,
+						   epoch <= epochs ? gradient : NULL);
+		printf("epoch %d: error %.6f (%.2fs)\n", epoch - 1, error,
+			   seconds_since(&start));
+		fflush(stdout);
+		if (best_error < 0 || error < best_error){
+			best_error = error;
+			if (!write_params(out, params)){
+				fprintf(stderr, "Couldn't write %s\n", out);
+				return 1;
+			}
+		}
+		if (epoch > epochs)
+			break;
+
+		/* Adam, bias corrected */
+		for (i = 0; i < NUM_PARAMS; i++){
+			double m, v;
+			if (is_fixed(i))
+				continue;
+			moment[i] = BETA1 * moment[i] + (1 - BETA1) * gradient[i];
+			velocity[i] = BETA2 * velocity[i]
+						  + (1 - BETA2) * gradient[i] * gradient[i];
+			m = moment[i] / (1 - pow(BETA1, epoch));
+			v = velocity[i] / (1 - pow(BETA2, epoch));
+			params[i] -= rate * m / (sqrt(v) + ADAM_EPSILON);
+		}
+	}
+
+	free(set.positions);
+	return 0;
+}
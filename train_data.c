@@ -0,0 +1,99 @@
+#include "train_data.h"
+#include <string.h>
+
+#define NO_EN_PASSANT 64
+#define RESULT_BLACK 0
+#define RESULT_DRAW 1
+#define RESULT_WHITE 2
+
+void TrainRecord_pack(TrainRecord *r, const Position *p, int score,
+					  GameCondition result)
+{
+	const SquareSet occupied = p->color_sets[0] | p->color_sets[1];
+	SquareSet pieces = occupied;
+	int i = 0;
+
+	memset(r, 0, sizeof(TrainRecord));
+	for (i = 0; i < 8; i++)
+		r->bytes[i] = (unsigned char)(occupied >> (8 * i));
+
+	for (i = 0; pieces && i < 32; i++){
+		const int sq = SQUARESET_FIRST(pieces);
+		pieces &= pieces - 1;
+		r->bytes[8 + (i / 2)] |= p->piece_locations[sq] << (4 * (i % 2));
+	}
+
+	r->bytes[24] = p->to_move | (p->castling_rights[0] << 1)
+				   | (p->castling_rights[1] << 3);
+	r->bytes[25] = p->en_passant_target < 0 ? NO_EN_PASSANT
+											: p->en_passant_target;
+	r->bytes[26] = p->halfmove_clock > 255 ? 255 : p->halfmove_clock;
+	r->bytes[27] = result == WHITE ? RESULT_WHITE :
+				   (result == BLACK ? RESULT_BLACK : RESULT_DRAW);
+	r->bytes[28] = (unsigned char)score;
+	r->bytes[29] = (unsigned char)((unsigned int)score >> 8);
+	r->bytes[30] = (unsigned char)p->fullmove_clock;
+	r->bytes[31] = (unsigned char)(p->fullmove_clock >> 8);
+}
+
+int TrainRecord_unpack(const TrainRecord *r, Position *p, int *score,
+					   GameCondition *result)
+{
+	SquareSet occupied = 0;
+	int kings[2] = { 0, 0 };
+	int i, sq;
+
+	for (i = 7; i >= 0; i--)
+		occupied = (occupied << 8) | r->bytes[i];
+	if (SQUARESET_COUNT(occupied) > 32 || r->bytes[25] > NO_EN_PASSANT ||
+		r->bytes[27] > RESULT_WHITE)
+		return 0;
+
+	for (sq = 0; sq < 64; sq++)
+		p->piece_locations[sq] = EMT;
+	for (i = 0; occupied; i++){
+		const ChessPiece piece = (r->bytes[8 + (i / 2)] >> (4 * (i % 2)))
+								 & 0xF;
+		sq = SQUARESET_FIRST(occupied);
+		occupied &= occupied - 1;
+		if (piece >= EMT)
+			return 0;
+		if (piece == W_K){
+			p->white_kingsrc = sq;
+			kings[0]++;
+		}
+		else if (piece == B_K){
+			p->black_kingsrc = sq;
+			kings[1]++;
+		}
+		p->piece_locations[sq] = piece;
+	}
+	if (kings[0] != 1 || kings[1] != 1)
+		return 0;
+
+	p->to_move = r->bytes[24] & 1;
+	p->castling_rights[0] = (r->bytes[24] >> 1) & 3;
+	p->castling_rights[1] = (r->bytes[24] >> 3) & 3;
+	p->en_passant_target = r->bytes[25] == NO_EN_PASSANT ? -1
+														 : r->bytes[25];
+	p->halfmove_clock = r->bytes[26];
+	p->fullmove_clock = r->bytes[30] | (r->bytes[31] << 8);
+	Position_refresh_sets(p);
+
+	*score = (short)(r->bytes[28] | (r->bytes[29] << 8));
+	*result = r->bytes[27] == RESULT_WHITE ? WHITE :
+			  (r->bytes[27] == RESULT_BLACK ? BLACK : DRAW);
+	return 1;
+}
+
+unsigned long long TrainRecord_key(const TrainRecord *r)
+{
+	/* FNV-1a */
+	unsigned long long hash = 14695981039346656037ULL;
+	int i;
+	for (i = 0; i < TRAIN_KEY_BYTES; i++){
+		hash ^= r->bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash ? hash : 1;
+}
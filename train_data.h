@@ -0,0 +1,42 @@
+#ifndef TRAIN_DATA_H
+#define TRAIN_DATA_H
+
+#include "chess.h"
+
+/* Training data: positions labeled with a search score and the result
+ * of the game they came from, in fixed-size records so that files of
+ * them can be read in bulk, split and shuffled by byte offset.
+ *
+ * A record, TRAIN_RECORD_SIZE bytes, numbers little-endian:
+ *    0-7   which squares have a piece, bit i for piece_locations[i]
+ *    8-23  those pieces in square order, a ChessPiece per 4 bits (low
+ *          bits first)
+ *   24     side to move (bit 0), then white's and black's
+ *          CastlingRights (2 bits each)
+ *   25     en passant target square, or 64 for none
+ *   26     halfmove clock (up to 255)
+ *   27     result: 0 black won, 1 draw, 2 white won
+ *   28-29  search score in centipawns for the side to move, signed
+ *   30-31  fullmove number
+ * The first TRAIN_KEY_BYTES are the position itself, clocks aside, and
+ * are what TrainRecord_key hashes. */
+
+#define TRAIN_RECORD_SIZE 32
+#define TRAIN_KEY_BYTES 26
+
+typedef struct train_record_t {
+	unsigned char bytes[TRAIN_RECORD_SIZE];
+} TrainRecord;
+
+/* Packs position [p], with [score] (for the side to move) and the
+ * game's [result] (WHITE, BLACK or DRAW). */
+void TrainRecord_pack(TrainRecord *r, const Position *p, int score,
+					  GameCondition result);
+/* Unpacks [r] into [p], [score] and [result]. Returns 0 if it isn't a
+ * record TrainRecord_pack could have written. */
+int TrainRecord_unpack(const TrainRecord *r, Position *p, int *score,
+					   GameCondition *result);
+/* Hash of the position [r] is for, never 0 */
+unsigned long long TrainRecord_key(const TrainRecord *r);
+
+#endif